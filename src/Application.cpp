@@ -1,5 +1,6 @@
 #include "headers/Starter.hpp"
 #include <iostream>
+#include <numeric>
 
 #define MINIAUDIO_IMPLEMENTATION
 #include "headers/miniaudio.h"  // Miniaudio library (used to play sounds)
@@ -7,10 +8,13 @@
 #define MESH 210    // Number of models in the city json
 #define CARS 9  // Number of autonomus cars
 #define STREET_LIGHT_COUNT 36   // Number of streetlights in the city
-#define MAX_STREET_LIGHTS 5 // Number of people in the city
 #define PEOPLE 45   // Number of people in the city
 #define TAXI_ELEMENTS 8 // Number of elements in the taxi model
 #define TAXI_LIGHT_COUNT 4  // Number of lights in the taxi
+#define CLUSTER_GRID 16 // Number of light clusters along X and along Z (same value in BaseShader.frag)
+#define MAX_CLUSTER_LIGHTS 256  // Maximum number of lights in the scene (same value in BaseShader.frag)
+#define MAX_CLUSTER_INDICES 8192    // Maximum number of light references of all the clusters together
+#define SCENE_TEXTURES 3    // Textures of the scene set: city, people and taxi (same value in BaseShader.frag)
 #define PICKUP_COUNT 5  // Number of people that the player can pickup
 #define INGAME_SCENE_COUNT 2    // Number of active scenes in the game
 #define GAMEMODE_COUNT 2    // Number of game modes
@@ -23,10 +27,23 @@
 #define COLLISION_SPHERE_RADIUS 0.75f   // Radius of the collision sphere between taxi and cars
 #define PICKUP_POINT_Y_OFFSET 2.0f  // Y offset for the pickup point light
 #define ARROW_Y_OFFSET 3.25f    // Y offset for the pickup point arrow
+#define MAX_UNIFORM_ALIGNMENT 256   // Largest offset alignment of uniform and storage buffers allowed by Vulkan
+#define LOD_HYSTERESIS 0.15f    // Fraction of the LOD thresholds to cross before changing level (no flickering at the threshold)
+#define BENCHMARK_RUNS (2 * GRAPHICS_SETTINGS_COUNT)    // Benchmark runs: every graphics setting by day and by night
+#define BENCHMARK_WARMUP_FRAMES 30  // Frames rendered at the start of each benchmark run without measuring them
+#define BENCHMARK_FRAMES 600    // Frames measured in each benchmark run (one lap of the camera path)
+#define BENCHMARK_DELTA_T (1.0f / 60.0f)    // Fixed time step of the benchmark (every run renders the same frames)
+#define SIMULATION_RATE 120.0f  // Steps per second of the game simulation (independent of the frame rate)
+#define MAX_SIMULATION_STEPS 8  // Maximum number of steps to catch up after a stall (the older ones are dropped)
+#define DAY_LENGTH 72.0f    // Seconds of a whole day in the game (cyclic timer)
+#define DOOR_SPEED 300.0f   // Speed of the door animation (degrees per second)
+#define WHEEL_STEER_RATE 15.0f  // Speed of the wheels turning towards the steering direction (per second)
+#define WHEEL_ROLL_RATE 60.0f   // Roll of the wheels per unit of taxi speed (per second)
+#define MIN_TAXI_SPEED 0.6f // Speed under which the taxi is considered still
 
 // One type of UBO used by the majority of the shaders
+// The MVP matrix is computed in the vertex shader using the view-projection matrix of the Global GUBO
 struct UniformBufferObject {
-    alignas(16) glm::mat4 mvpMat;   // Model-view-projection matrix
     alignas(16) glm::mat4 mMat; // Model matrix
     alignas(16) glm::mat4 nMat; // Normal matrix
 };
@@ -35,16 +52,9 @@ struct UniformBufferObject {
  * It contains all the parameters that are equally used by the majority of the shaders.
  */
 struct GlobalUniformBufferObject {
+    alignas(16) glm::mat4 viewProjMat;  // View-projection matrix of the camera
     alignas(16) glm::vec4 directLightPos; // Position of the sun
     alignas(16) glm::vec4 directLightCol;   // Color of the sun
-    alignas(16) glm::vec4 taxiLightPos[TAXI_LIGHT_COUNT];   // Position of the taxi lights
-    alignas(16) glm::vec4 frontLightCol;    // Color of the front light
-    alignas(16) glm::vec4 rearLightCol; // Color of the rear light
-    alignas(16) glm::vec4 frontLightDir;    // Direction of the front light (SPOTLIGHTS)
-    alignas(16) glm::vec4 frontLightCosines;    // Cosines of the front light (SPOTLIGHTS)
-    alignas(16) glm::vec4 streetLightCol;   // Color of the streetlights
-    alignas(16) glm::vec4 streetLightDirection; // Direction of the streetlights (SPOTLIGHTS)
-    alignas(16) glm::vec4 streetLightCosines;   // Cosines of the streetlights (SPOTLIGHTS)
     alignas(16) glm::vec4 pickupPointPos;   // Position of the pickup point
     alignas(16) glm::vec4 pickupPointCol;   // Color of the pickup point
     alignas(16) glm::vec4 eyePos;   // Position of the camera
@@ -54,16 +64,45 @@ struct GlobalUniformBufferObject {
      */
 };
 
-/* "Local" GUBO used by the majority of the shaders.
- * There will be one different LUBO for each Descriptor Set.
- * It contains some "local" parameters that are dependent from the model.
+/* Material used by the objects of the scene (taxi, NPCs, city and people).
+ * The materials are stored in a storage buffer, and each draw call selects one with a push constant.
  */
-struct LocalGUBO {
-    alignas(16) glm::vec4 streetLightPos[MAX_STREET_LIGHTS]; // Position of the 5 streetlights to count during the BRDF calculation
+struct Material {
     alignas(16) glm::vec4 gammaAndMetallic; // Vector containing some values:
     /* gammaAndMetallic.x ==> gamma value (BRDF)
      * gammaAndMetallic.y ==> metallic value (BRDF)
      */
+    alignas(16) glm::uvec4 texture; // texture.x ==> index of the texture in the texture array of the scene
+};
+
+// Materials of the scene
+enum SceneMaterial {MATERIAL_CITY, MATERIAL_PEOPLE, MATERIAL_TAXI, MATERIAL_CARS, MATERIAL_COUNT};
+
+// Push constants of each draw call of the scene pipeline
+// (the taxi and the NPCs select their dynamic object with firstInstance)
+struct ScenePushConstants {
+    uint32_t material;  // Index of the material
+    uint32_t instanced; // 1 if the objects are static instances (city and people) selected by the instance ids
+};
+
+// Light of the scene (street lights and taxi lights) used by the clustered lighting
+struct ClusterLight {
+    alignas(16) glm::vec4 posRange; // Position and range of the light (no contribution beyond it)
+    alignas(16) glm::vec4 colorIntensity;   // Color, and distance at which the intensity is 1 (decay with the squared distance)
+    alignas(16) glm::vec4 direction;    // Direction of the light, w = 1 for SPOTLIGHTS and 0 for POINT LIGHTS
+    alignas(16) glm::vec4 cosines;  // Cosines of the inner and outer angles (SPOTLIGHTS)
+};
+
+/* Lights of the frame binned in a grid of clusters on the XZ plane, stored in a storage buffer.
+ * Each cluster references the lights whose range touches it, so every fragment
+ * only loops over the lights of its own cluster.
+ */
+struct LightClusters {
+    alignas(16) glm::vec4 gridOrigin;   // X and Z of the corner of the grid, size of a cluster
+    alignas(16) glm::uvec4 gridSize;    // Clusters along X and Z, number of lights
+    ClusterLight lights[MAX_CLUSTER_LIGHTS];    // Active lights of the frame
+    uint32_t clusters[CLUSTER_GRID * CLUSTER_GRID][2];  // First index in lightIndices and number of lights of each cluster
+    uint32_t lightIndices[MAX_CLUSTER_INDICES]; // Lights of the clusters, grouped by cluster
 };
 
 // GUBO used for the skybox shader
@@ -79,6 +118,13 @@ struct ArrowGUBO {
     alignas(16) glm::vec4 gammaAndMetallic; // Vector containing gamma and metallic values
 };
 
+// Group of instances sharing the same mesh, drawn with a single instanced draw call
+struct InstanceBatch {
+    Model *mesh;    // Model that owns the shared vertex and index buffers
+    uint32_t firstInstance; // First entry of the batch in the instance id list
+    uint32_t instanceCount; // Number of instances of the batch
+};
+
 // Vertex definition for 3D objects
 struct Vertex {
     glm::vec3 pos;  // Position
@@ -92,6 +138,19 @@ struct TwoDimVertex {
     glm::vec2 UV;   // UV coordinates
 };
 
+// Cached data of a static instance of the scene (city and people), built once from the json files
+struct SceneInstance {
+    glm::mat4 mMat; // World matrix
+    glm::mat4 nMat; // Normal matrix
+    glm::vec3 bbMin;    // Minimum corner of the bounding box (world space)
+    glm::vec3 bbMax;    // Maximum corner of the bounding box (world space)
+    glm::vec3 center;   // Center of the bounding sphere (world space)
+    float radius;   // Radius of the bounding sphere (world space)
+};
+
+// Buckets of draw calls, each one recorded in its own secondary command buffer
+enum CommandBucket {BUCKET_TAXI, BUCKET_CITY, BUCKET_SKYBOX, BUCKET_CARS, BUCKET_PEOPLE, BUCKET_ARROW, BUCKET_TWO_DIM, BUCKET_COUNT};
+
 // Struct to easily manage collision boxes
 struct CollisionBox {
     float xMin;
@@ -100,6 +159,31 @@ struct CollisionBox {
     float zMax;
 };
 
+// State of the game after a simulation step, the part of it that the frames need to be drawn
+struct SimulationState {
+    glm::vec3 taxiPos;
+    float steeringAng;
+    float wheelRoll;
+    float wheelAndSteerAng;
+    float openingDoorAngle;
+    glm::vec4 frontLightDirection;
+    glm::vec3 carPositions[CARS];
+    float steeringAngCars[CARS];
+    float cTime;
+    bool pickedPassenger;
+    glm::vec4 pickupPoint;
+    glm::vec4 dropoffPoint;
+    bool drawPeople[PICKUP_COUNT];  // False for the person in the taxi
+    float money;
+    bool gameOver;  // True when the last drive of the arcade game has been completed
+};
+
+// Inputs of the player read by the last frame, used by the next simulation steps
+struct SimulationInput {
+    glm::vec3 m = glm::vec3(0.0f);  // Movement (WASD keys + RF keys)
+    int scene = -2; // Current scene
+};
+
 class Application : public BaseProject {
 
     public:
@@ -115,6 +199,7 @@ class Application : public BaseProject {
         ma_sound pickupSound;   // Sound used when the taxi picks up a person
         ma_sound moneySound;    // Sound used when the taxi earns money
         ma_sound clacsonSound;  // Sound used when the taxi collides with a car
+        std::string benchmarkFile = "benchmark.json";   // Output file of the headless benchmark
     
     protected:
         
@@ -123,29 +208,54 @@ class Application : public BaseProject {
         // Vertex Descrpitors: just two, one for 3D objects and one for 2D objects
         VertexDescriptor VDthreeDim, VDtwoDim;
 
-        // Pipelines: one for each kind of object
-        Pipeline Ptaxi, Pcity, PskyBox, Pcars, Ppeople, PtwoDim, Parrow;
+        // Pipelines: one shared by all the objects of the scene (taxi, NPCs, city and people),
+        // plus the ones of the skybox, of the 2D plane and of the arrow
+        Pipeline Pscene, PskyBox, PtwoDim, Parrow;
 
-        // Descriptor Set Layouts: a global DSL and one for each kind of object
-        DescriptorSetLayout DSLglobal, DSLpeople, DSLtaxi, DSLcars, DSLcity, DSLskyBox, DSLtwoDim, DSLarrow;
+        // Descriptor Set Layouts: a global DSL, the DSL of the scene and one for each other kind of object
+        DescriptorSetLayout DSLglobal, DSLscene, DSLskyBox, DSLtwoDim, DSLarrow;
 
-        // Descriptor Sets: a global DS and one for each type of object (MODEL)
-        DescriptorSet DSglobal, DSpeople[PEOPLE], DStaxi[TAXI_ELEMENTS], DScars[CARS], DScity[MESH], DSskyBox, DStwoDim, DSarrow;
+        // Descriptor Sets: a global DS and a single DS for all the objects of the scene
+        // (objects, texture array and materials are indexed with push constants)
+        // The 2D plane has one DS for each screen (title, controls and endgame), chosen when recording
+        DescriptorSet DSglobal, DSscene, DSskyBox, DStwoDim[3], DSarrow;
 
         // Models: one for each type of object
         Model Mtaxi[TAXI_ELEMENTS], MskyBox, Mcars[CARS], Mpeople[PEOPLE], Mcity[MESH], MtwoDim, Marrow;
 
+        // Geometry of the taxi, of the NPCs, of the city and of the people, packed in one vertex and one index buffer
+        GeometryBuffer Gscene;
+
+        // Indirect draw commands of the city, of the people and of the NPCs, rewritten every frame
+        IndirectCommands ICscene;
+
         // Textures:
         Texture Tcity, TskyBox, Tpeople, Ttaxi, Ttitle, Tcontrols, Tendgame;
 
-        // Uniform Buffers: one for each type of object
-        UniformBufferObject uboTaxi[TAXI_ELEMENTS], uboSkyBox, uboCars[CARS], uboCity[MESH], uboPeople[PEOPLE], uboArrow;
+        // Uniform Buffers of the skybox and of the arrow
+        UniformBufferObject uboSkyBox, uboArrow;
 
         // Global Uniform Buffer Object (one for all the shaders)
         GlobalUniformBufferObject globalGUBO;
 
-        // Local Uniform Buffers: one for each type of object
-        LocalGUBO guboTaxi[TAXI_ELEMENTS], guboCars[CARS], guboCity[MESH], guboPeople[PEOPLE];
+        // Model and normal matrices of the objects that move (taxi, then NPCs), updated every frame
+        UniformBufferObject dynamicObjects[TAXI_ELEMENTS + CARS];
+
+        // Model and normal matrices of the objects that never move (city, then people), uploaded once
+        UniformBufferObject staticObjects[MESH + PEOPLE];
+
+        // Materials of the scene (uploaded once)
+        Material materials[MATERIAL_COUNT];
+
+        // Instance ids of the city and of the people grouped by mesh, and the draw call of each group
+        std::vector<uint32_t> sceneInstanceIds;
+        std::vector<InstanceBatch> cityBatches, peopleBatches;
+
+        // Ids of the instances drawn in this frame (visible ones, grouped by mesh and level of detail) and the draw commands
+        // of the city batches, then of the people batches (one for each level of detail of the mesh), then of the NPCs
+        uint32_t visibleInstanceIds[MESH + PEOPLE];
+        VkDrawIndexedIndirectCommand drawCommands[(MESH + PEOPLE) * MODEL_LODS + CARS];
+        uint32_t cityDraws = 0, peopleDraws = 0;    // Draw commands of the city and of the people batches
 
         // Local GUBO for the skybox shader
         SkyGUBO guboSkyBox;
@@ -153,6 +263,9 @@ class Application : public BaseProject {
         // Unique GUBO for the arrow shader
         ArrowGUBO guboArrow;
 
+        // Scene description of the city and of the people (parsed only once in localInit)
+        SceneInstance cityInstances[MESH], peopleInstances[PEOPLE];
+
         int currScene = -2; // Variables used for the scene management
         int lastSavedSceneValue;    // Variable used to save the last scene value
         int currentPoints[CARS] = {0,0,0,0,0,0,0,0,0};  // Variable for the NPC cars
@@ -166,6 +279,10 @@ class Application : public BaseProject {
         float money = 0.0f; // Variable used to store the money earned
         float wheelAndSteerAng = 0.0f;
         float openingDoorAngle = 0.0f;
+        float steeringAng = 0.0f;   // Steering angle of the taxi
+        float currentSpeed = 0.0f;  // Speed of the taxi (gradually reaches the one asked by the player)
+        float steeringAngCars[CARS] = {};   // Steering angles of the NPC cars
+        float cTime = 0.0f; // Time of the day in the game
         double pickupTime = 0.0;    // Variable used to time the pickup and dropoff
 
         // Boolean flag used in the code
@@ -177,6 +294,25 @@ class Application : public BaseProject {
         bool pickupPointSelected = false;   // True when the pickup point has been selected
         bool pickedPassenger = false;   // True when the passenger has been picked up
         bool inCollisionZone = false;   // True when the taxi is in the collision zone
+        bool gameOver = false;  // True when the last drive of the arcade game has been completed
+
+        // Fixed step simulation: the game advances SIMULATION_RATE times per second, the frames draw the
+        // state interpolated between the last two steps (on its own thread, inline in the benchmark)
+        bool simulationThreaded = true; // True when the steps run on the simulation thread
+        bool simulationStarted = false; // True when the simulation thread has been started
+        std::thread simulationThread;
+        std::mutex simulationMutex; // Guards the input and the published states
+        std::atomic<bool> simulationRunning{false};
+        SimulationInput simulationInput;    // Last inputs of the player
+        SimulationState previousState, currentState;    // States after the last two steps
+        std::chrono::steady_clock::time_point currentStateTime; // Time when the last state was published
+        float simulationTime = 0.0f;    // Time not yet simulated (inline simulation only)
+
+        // Headless benchmark: the camera follows a scripted path and the frame times of each run are written as JSON
+        std::string benchmarkDevice;    // Name of the device that renders the benchmark
+        int benchmarkRun = 0;   // Current run: graphics settings = run / 2, night in the odd runs
+        int benchmarkFrame = 0; // Frames rendered in the current run
+        std::vector<size_t> benchmarkFirstFrames;   // First measured frame of each run (index in the frame times)
 
         glm::vec3 camPos = glm::vec3(0.0, 1.5f, -5.0f); // Initial pos of camera
         glm::vec3 camPosInPhotoMode;
@@ -317,9 +453,35 @@ class Application : public BaseProject {
         // World matrices of the NPCs cars
         glm::mat4 mWorldCars[CARS];
 
-        // Hash map used to check what people we don't want to draw (it has been picked up)
+        // Bounding box of the city on the XZ plane (from the bounds of its instances)
+        glm::vec2 cityMin, cityMax;
+
+        // Lights of the current frame, binned in the clusters
+        LightClusters lightClusters;
+
+        // Street lights never move: their light data and the rectangle of clusters they touch are computed once
+        ClusterLight streetLights[STREET_LIGHT_COUNT];
+        glm::ivec4 streetLightRects[STREET_LIGHT_COUNT];
+
+        // People that can be picked up (index of the person in the city) and whether we draw them
         // Easy working ==> when a person has been picked up, we set the value to false
-        std::unordered_map<int, bool> drawPeople = {{3, true}, {7, true}, {35, true}, {37, true}, {44, true}};
+        const int pickupPeople[PICKUP_COUNT] = {3, 7, 35, 37, 44};
+        bool drawPeople[PICKUP_COUNT] = {true, true, true, true, true};
+
+        // Result of the frustum culling of the last frame (true = inside the view frustum)
+        std::vector<bool> cityVisible = std::vector<bool>(MESH, true);
+        std::vector<bool> peopleVisible = std::vector<bool>(PEOPLE, true);
+        std::vector<bool> carsVisible = std::vector<bool>(CARS, true);
+        int objectsDrawn = 0;   // Culled objects drawn in the last frame
+        int objectsCulled = 0;  // Culled objects skipped in the last frame
+        uint64_t trianglesDrawn = 0;    // Triangles of the culled objects drawn in the last frame
+
+        // Levels of detail: an object uses level l + 1 when its projected size (radius of the bounding sphere
+        // over the distance, in half screen heights) gets below lodScreenSizes[l]
+        const float lodScreenSizes[MODEL_LODS - 1] = {0.25f, 0.08f, 0.02f};
+        std::vector<uint32_t> cityLod = std::vector<uint32_t>(MESH, 0);
+        std::vector<uint32_t> peopleLod = std::vector<uint32_t>(PEOPLE, 0);
+        std::vector<uint32_t> carsLod = std::vector<uint32_t>(CARS, 0);
 
         // Collision box of the city (external collision box)
         const CollisionBox externalCollisionBox = {
@@ -378,14 +540,25 @@ class Application : public BaseProject {
             initialBackgroundColor = {0.0f, 0.005f, 0.01f, 1.0f};
 
             // Descriptor pool sizes:
-            // 2 uniforms (UBO and GUBO) for: taxi, city, NPCs, people, skybox and arrow, plus one Global GUBO
-            uniformBlocksInPool =  (2 * TAXI_ELEMENTS) + (2 * MESH) + (2 * CARS) + (2 * PEOPLE) + 2 + 2 + 1;
-            // One texture for each model (taxi, city, NPCs and people)
-            // Plus one for the skybox and three for the 2D plane
-            texturesInPool = TAXI_ELEMENTS + MESH + CARS + PEOPLE + 1 + 3;
-            // One set for each model (taxi, city, NPCs and people)
-            // Plus one for the skybox, one for the 2D plane, one for the arrow and one for the Global GUBO
-            setsInPool = TAXI_ELEMENTS + MESH + CARS + PEOPLE + 1 + 1 + 1 + 1;
+            // 2 uniforms (UBO and GUBO) for: skybox and arrow, plus one Global GUBO
+            uniformBlocksInPool = 2 + 2 + 1;
+            // The texture array of the scene, plus one for the skybox and three for the 2D plane
+            texturesInPool = SCENE_TEXTURES + 1 + 3;
+            // 4 storage buffers for the scene (static objects, visible instance ids, dynamic objects and materials)
+            // Plus one for the light clusters
+            storageBlocksInPool = 4 + 1;
+            // One set for the scene, one for the skybox, three for the 2D plane, one for the arrow and one for the Global GUBO
+            setsInPool = 1 + 1 + 3 + 1 + 1;
+            // Bytes of the uniform ring buffer for each swapchain image (the device is not known yet, so the worst alignment is used):
+            // each uniform block takes the largest UBO rounded up to MAX_UNIFORM_ALIGNMENT,
+            // plus the light clusters, the dynamic objects, the visible instance ids and the indirect draw commands, each padded
+            const size_t largestUniformBlock = std::max({sizeof(UniformBufferObject), sizeof(GlobalUniformBufferObject),
+                                                         sizeof(SkyGUBO), sizeof(ArrowGUBO)});
+            const size_t uniformBlockSize = (largestUniformBlock + MAX_UNIFORM_ALIGNMENT - 1) / MAX_UNIFORM_ALIGNMENT * MAX_UNIFORM_ALIGNMENT;
+            uniformBytesPerFrame = uniformBlocksInPool * uniformBlockSize + sizeof(LightClusters) + sizeof(dynamicObjects) +
+                                   sizeof(visibleInstanceIds) + sizeof(drawCommands) + 4 * MAX_UNIFORM_ALIGNMENT;
+            // Draw calls are recorded in parallel, one secondary command buffer for each bucket
+            commandBuckets = BUCKET_COUNT;
 
             Ar = (float)windowWidth / (float)windowHeight;
 
@@ -399,41 +572,45 @@ class Application : public BaseProject {
         // Initialization of Descriptor Set Layouts, Vertex Descriptors, Pipelines, Models and Textures
         void localInit() {
 
+            // The benchmark starts in the third person view (the camera is then moved along its path)
+            // and reports the name of the device
+            if(headless) {
+                currScene = 0;
+                drawTwoDimPlane = false;
+                VkPhysicalDeviceProperties properties{};
+                vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+                benchmarkDevice = properties.deviceName;
+                // The steps run inline so that every run renders the same frames
+                simulationThreaded = false;
+            }
+            previousState = currentState = captureState();
+
             // Initialization of Descriptor Set Layouts
-            DSLtaxi.init(this, {
-                    {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS}, // Uniform Buffer Object
-                    {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT}, // Texture
-                    {2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS} // Local GUBO
-            });
-            DSLcity.init(this, {
-                    {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS},   // UBO
-                    {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT},   // Texture
-                    {2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS}    // Local GUBO
+            // Uniforms updated every frame are dynamic (one set, offset chosen at bind time)
+            // All the objects of the scene share one set: static objects (city and people) and materials are
+            // uploaded once, the dynamic objects (taxi and NPCs) are rewritten every frame
+            DSLscene.init(this, {
+                    {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT},   // Static objects (city and people)
+                    {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, SCENE_TEXTURES},   // Texture array
+                    {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT},   // Visible instance ids
+                    {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT},   // Dynamic objects (taxi and NPCs)
+                    {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT}    // Materials
             });
             DSLskyBox.init(this, {
-                    {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS},   // UBO
+                    {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS},   // UBO
                     {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT},   // Texture
-                    {2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS}    // Local GUBO
-            });
-            DSLcars.init(this, {
-                    {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS},   // UBO
-                    {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT},   // Texture
-                    {2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS}    // Local GUBO
-            });
-            DSLpeople.init(this, {
-                    {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS},   // UBO
-                    {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT},   // Texture
-                    {2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS}    // Local GUBO
+                    {2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS}    // Local GUBO
             });
             DSLglobal.init(this, {
-                    {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS} // Global GUBO
+                    {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS}, // Global GUBO
+                    {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT} // Light clusters
             });
             DSLtwoDim.init(this, {
                 {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT} // Only texture
             });
             DSLarrow.init(this, {
-                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS}, // UBO
-                {1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS} // GUBO
+                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS}, // UBO
+                {1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS} // GUBO
             });
 
             // Initialization of Vertex Descriptors
@@ -457,44 +634,51 @@ class Application : public BaseProject {
             });
 
             // Initialization of Pipelines:
-            // Each pipeline, except for the SkyBox, 2D and Arrow ones, has two DSL: one for the global values and one for the local ones
-            Ptaxi.init(this, &VDthreeDim, "shaders/BaseVert.spv", "shaders/BaseFrag.spv", {&DSLtaxi, &DSLglobal});
-            Pcity.init(this, &VDthreeDim, "shaders/BaseVert.spv", "shaders/BaseFrag.spv", {&DSLcity, &DSLglobal});
-            Ppeople.init(this, &VDthreeDim, "shaders/BaseVert.spv", "shaders/BaseFrag.spv", {&DSLpeople, &DSLglobal});
-            Pcars.init(this, &VDthreeDim, "shaders/BaseVert.spv", "shaders/BaseFrag.spv", {&DSLcars, &DSLglobal});
-            PskyBox.init(this, &VDthreeDim, "shaders/BaseVert.spv", "shaders/SkyFrag.spv", {&DSLskyBox});
+            // The scene pipeline (taxi, NPCs, city and people) has two DSL: the one of the scene and the global one
+            // Each draw call selects its object and its material with push constants
+            // City and people are drawn with instancing (one draw call for each distinct mesh)
+            Pscene.init(this, &VDthreeDim, "shaders/SceneVert.spv", "shaders/BaseFrag.spv", {&DSLscene, &DSLglobal});
+            Pscene.setPushConstants(sizeof(ScenePushConstants));
+            // SkyBox and Arrow also use the Global DSL, because the vertex shader takes the view-projection matrix from there
+            PskyBox.init(this, &VDthreeDim, "shaders/BaseVert.spv", "shaders/SkyFrag.spv", {&DSLskyBox, &DSLglobal});
             // Deactivate culling for the sky pipeline (render the skybox from the inside)
             PskyBox.setAdvancedFeatures(VK_COMPARE_OP_LESS, VK_POLYGON_MODE_FILL, VK_CULL_MODE_FRONT_BIT, false);
             PtwoDim.init(this, &VDtwoDim, "shaders/TwoDimVert.spv", "shaders/TwoDimFrag.spv", {&DSLtwoDim});
             // Settings for 2D rendering pipeline
             PtwoDim.setAdvancedFeatures(VK_COMPARE_OP_LESS_OR_EQUAL, VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, false);
-            Parrow.init(this, &VDthreeDim, "shaders/BaseVert.spv", "shaders/ArrowFrag.spv", {&DSLarrow});
+            Parrow.init(this, &VDthreeDim, "shaders/BaseVert.spv", "shaders/ArrowFrag.spv", {&DSLarrow, &DSLglobal});
 
             std::cout << "[ LOADING ]: -------------------------------------------------" << std::endl;
-            std::cout << "[ LOADING ]: Loading models:\t\t[                    ]" << std::endl;
+
+            // Models and textures are read, parsed and decoded in parallel when the load batch ends,
+            // their data can be used only after endLoadBatch()
+            beginLoadBatch();
 
             // Initialization of Models
+            // The models of the scene pipeline are packed in the geometry buffer of the scene
+            Gscene.init(this, &VDthreeDim);
             // Initialization of the taxi model
-            Mtaxi[0].init(this, &VDthreeDim, "models/Car_Hatch_C_Door.obj", OBJ);
-            Mtaxi[1].init(this, &VDthreeDim, "models/Car_Hatch_C_Extern.obj", OBJ);
-            Mtaxi[2].init(this, &VDthreeDim, "models/Car_Hatch_C_Intern_no-steer.obj", OBJ);
-            Mtaxi[3].init(this, &VDthreeDim, "models/TruckBodySteeringWheelO.mgcg", MGCG);
-            Mtaxi[4].init(this, &VDthreeDim, "models/Car_Hatch_C_Wheel.obj", OBJ);
-            Mtaxi[5].init(this, &VDthreeDim, "models/Car_Hatch_C_Wheel.obj", OBJ);
-            Mtaxi[6].init(this, &VDthreeDim, "models/Car_Hatch_C_Wheel.obj", OBJ);
-			Mtaxi[7].init(this, &VDthreeDim, "models/Car_Hatch_C_Wheel.obj", OBJ);
+            Mtaxi[0].init(this, &VDthreeDim, "models/Car_Hatch_C_Door.obj", OBJ, &Gscene);
+            Mtaxi[1].init(this, &VDthreeDim, "models/Car_Hatch_C_Extern.obj", OBJ, &Gscene);
+            Mtaxi[2].init(this, &VDthreeDim, "models/Car_Hatch_C_Intern_no-steer.obj", OBJ, &Gscene);
+            Mtaxi[3].init(this, &VDthreeDim, "models/TruckBodySteeringWheelO.mgcg", MGCG, &Gscene);
+            Mtaxi[4].init(this, &VDthreeDim, "models/Car_Hatch_C_Wheel.obj", OBJ, &Gscene);
+            Mtaxi[5].init(this, &VDthreeDim, "models/Car_Hatch_C_Wheel.obj", OBJ, &Gscene);
+            Mtaxi[6].init(this, &VDthreeDim, "models/Car_Hatch_C_Wheel.obj", OBJ, &Gscene);
+			Mtaxi[7].init(this, &VDthreeDim, "models/Car_Hatch_C_Wheel.obj", OBJ, &Gscene);
             // Initialization of the skybox model (sphere)
             MskyBox.init(this, &VDthreeDim, "models/Sphere2.obj", OBJ);
             // Initialization of the NPC cars models
-            Mcars[0].init(this, &VDthreeDim, "models/transport_cool_001_transport_cool_001.001.mgcg", MGCG);
-            Mcars[1].init(this, &VDthreeDim, "models/transport_cool_003_transport_cool_003.001.mgcg", MGCG);
-            Mcars[2].init(this, &VDthreeDim, "models/transport_cool_004_transport_cool_004.001.mgcg", MGCG);
-            Mcars[3].init(this, &VDthreeDim, "models/transport_cool_010_transport_cool_010.001.mgcg", MGCG);
-            Mcars[4].init(this, &VDthreeDim, "models/transport_jeep_001_transport_jeep_001.001.mgcg", MGCG);
-            Mcars[5].init(this, &VDthreeDim, "models/transport_jeep_010_transport_jeep_010.001.mgcg", MGCG);
-            Mcars[6].init(this, &VDthreeDim, "models/transport_cool_001_transport_cool_001.001.mgcg", MGCG);
-            Mcars[7].init(this, &VDthreeDim, "models/transport_cool_004_transport_cool_004.001.mgcg", MGCG);
-            Mcars[8].init(this, &VDthreeDim, "models/transport_cool_010_transport_cool_010.001.mgcg", MGCG);
+            // The NPCs, the city and the people get levels of detail, chosen every frame by their size on screen
+            Mcars[0].init(this, &VDthreeDim, "models/transport_cool_001_transport_cool_001.001.mgcg", MGCG, &Gscene, MODEL_LODS);
+            Mcars[1].init(this, &VDthreeDim, "models/transport_cool_003_transport_cool_003.001.mgcg", MGCG, &Gscene, MODEL_LODS);
+            Mcars[2].init(this, &VDthreeDim, "models/transport_cool_004_transport_cool_004.001.mgcg", MGCG, &Gscene, MODEL_LODS);
+            Mcars[3].init(this, &VDthreeDim, "models/transport_cool_010_transport_cool_010.001.mgcg", MGCG, &Gscene, MODEL_LODS);
+            Mcars[4].init(this, &VDthreeDim, "models/transport_jeep_001_transport_jeep_001.001.mgcg", MGCG, &Gscene, MODEL_LODS);
+            Mcars[5].init(this, &VDthreeDim, "models/transport_jeep_010_transport_jeep_010.001.mgcg", MGCG, &Gscene, MODEL_LODS);
+            Mcars[6].init(this, &VDthreeDim, "models/transport_cool_001_transport_cool_001.001.mgcg", MGCG, &Gscene, MODEL_LODS);
+            Mcars[7].init(this, &VDthreeDim, "models/transport_cool_004_transport_cool_004.001.mgcg", MGCG, &Gscene, MODEL_LODS);
+            Mcars[8].init(this, &VDthreeDim, "models/transport_cool_010_transport_cool_010.001.mgcg", MGCG, &Gscene, MODEL_LODS);
 
             // Initialization of the 2D plane
             // Vector of TwoDimVertex, each element has the position and the UV coordinates
@@ -508,8 +692,6 @@ class Application : public BaseProject {
             MtwoDim.indices = {0, 1, 2, 1, 3, 2};
             MtwoDim.initMesh(this, &VDtwoDim);
 
-            std::cout << "[ LOADING ]: Loading models:\t\t[=====               ]" << std::endl;
-
             // Initialization of the models of the city (from json)
             nlohmann::json js;
             std::ifstream ifs("models/city.json");
@@ -526,15 +708,15 @@ class Application : public BaseProject {
                     std::string modelPath= j["models"][k]["model"]; // Get the path of the model
                     std::string format = j["models"][k]["format"];  // Get the format of the model
                     // Initialize the model
-                    Mcity[k].init(this, &VDthreeDim, modelPath, (format[0] == 'O') ? OBJ : ((format[0] == 'G') ? GLTF : MGCG));
+                    Mcity[k].init(this, &VDthreeDim, modelPath, (format[0] == 'O') ? OBJ : ((format[0] == 'G') ? GLTF : MGCG), &Gscene, MODEL_LODS);
+                    // Cache the world matrix and the normal matrix of the instance
+                    initSceneInstance(cityInstances[k], j["instances"][k]["transform"]);
                 }
             }catch (const nlohmann::json::exception& e) {
                 std::cout << "[ EXCEPTION ]: " << e.what() << std::endl;
                 exit(1);
             }
 
-            std::cout << "[ LOADING ]: Loading models:\t\t[==========          ]" << std::endl;
-
             // Initialization of people's models (from json)
             nlohmann::json js2;
             std::ifstream ifs2("models/people.json");
@@ -551,7 +733,9 @@ class Application : public BaseProject {
                     std::string modelPath= j2["models"][k]["model"];    // Get the path of the model
                     std::string format = j2["models"][k]["format"];    // Get the format of the model
                     // Initialize the model
-                    Mpeople[k].init(this, &VDthreeDim, modelPath, (format[0] == 'O') ? OBJ : ((format[0] == 'G') ? GLTF : MGCG));
+                    Mpeople[k].init(this, &VDthreeDim, modelPath, (format[0] == 'O') ? OBJ : ((format[0] == 'G') ? GLTF : MGCG), &Gscene, MODEL_LODS);
+                    // Cache the world matrix and the normal matrix of the instance
+                    initSceneInstance(peopleInstances[k], j2["instances"][k]["transform"]);
                 }
             }catch (const nlohmann::json::exception& e) {
                 std::cout << "[ EXCEPTION ]: " << e.what() << std::endl;
@@ -570,7 +754,55 @@ class Application : public BaseProject {
             Tcontrols.init(this, "textures/controls.jpg");  // Texture of the controls screen
             Tendgame.init(this, "textures/endgame.jpg");    // Texture of the endgame screen
 
-            std::cout << "[ LOADING ]: Loading models:\t\t[====================]" << std::endl;
+            // Load everything, then create the buffers and the images in the order of registration
+            endLoadBatch();
+
+            // Upload the packed geometry of the scene
+            Gscene.create();
+
+            // Bounds of the instances, from the bounds of their meshes
+            for(int k = 0; k < MESH; k++) {
+                initSceneBounds(cityInstances[k], Mcity[k]);
+            }
+            for(int k = 0; k < PEOPLE; k++) {
+                initSceneBounds(peopleInstances[k], Mpeople[k]);
+            }
+            cityMin = glm::vec2(cityInstances[0].bbMin.x, cityInstances[0].bbMin.z);
+            cityMax = glm::vec2(cityInstances[0].bbMax.x, cityInstances[0].bbMax.z);
+            for(int k = 1; k < MESH; k++) {
+                cityMin = glm::min(cityMin, glm::vec2(cityInstances[k].bbMin.x, cityInstances[k].bbMin.z));
+                cityMax = glm::max(cityMax, glm::vec2(cityInstances[k].bbMax.x, cityInstances[k].bbMax.z));
+            }
+
+            // The grid of light clusters covers the whole city, the street lights are placed in it once
+            initLightClusters();
+
+            // The city and the people never move: their instance data is computed here once
+            // and uploaded in device local memory when the Descriptor Sets are created
+            // (the people follow the city in the static objects)
+            initStaticUniforms(cityInstances, staticObjects, MESH);
+            initStaticUniforms(peopleInstances, staticObjects + MESH, PEOPLE);
+
+            // Group the instances of the city and of the people by the mesh they share
+            sceneInstanceIds.clear();
+            buildInstanceBatches(Mcity, MESH, 0, sceneInstanceIds, cityBatches);
+            buildInstanceBatches(Mpeople, PEOPLE, MESH, sceneInstanceIds, peopleBatches);
+            // One draw command for each level of detail of each batch
+            cityDraws = 0;
+            for(const InstanceBatch &batch : cityBatches) {
+                cityDraws += batch.mesh->lods();
+            }
+            peopleDraws = 0;
+            for(const InstanceBatch &batch : peopleBatches) {
+                peopleDraws += batch.mesh->lods();
+            }
+
+            // Materials of the scene: gamma, metallic and index in the texture array (city, people, taxi)
+            materials[MATERIAL_CITY] = {glm::vec4(128.0f, 0.1f, 0.0f, 0.0f), glm::uvec4(0)};
+            materials[MATERIAL_PEOPLE] = {glm::vec4(128.0f, 0.1f, 0.0f, 0.0f), glm::uvec4(1)};
+            materials[MATERIAL_TAXI] = {glm::vec4(128.0f, 1.0f, 0.0f, 0.0f), glm::uvec4(2)};
+            materials[MATERIAL_CARS] = {glm::vec4(128.0f, 1.0f, 0.0f, 0.0f), glm::uvec4(0)};   // NPCs use the texture of the city
+
             std::cout << "[ LOADING ]: Loading completed!" << std::endl;
 
         }
@@ -579,34 +811,28 @@ class Application : public BaseProject {
         void pipelinesAndDescriptorSetsInit() {
 
             // Creation of the Pipelines
-            Ptaxi.create();
-            Pcity.create();
-            Ppeople.create();
-            Pcars.create();
+            Pscene.create();
             PskyBox.create();
             PtwoDim.create();
             Parrow.create();
 
             // Initialization of the Descriptor Sets
             DSglobal.init(this, &DSLglobal, {
-                    {0, UNIFORM, sizeof(GlobalUniformBufferObject), nullptr} // Global GUBO
+                    {0, UNIFORM, sizeof(GlobalUniformBufferObject), nullptr}, // Global GUBO
+                    {1, STORAGE, sizeof(LightClusters), nullptr} // Light clusters (rewritten every frame)
             });
 
-            for(int i = 0; i < TAXI_ELEMENTS; i++){
-                DStaxi[i].init(this, &DSLtaxi, {
-                        {0, UNIFORM, sizeof(UniformBufferObject), nullptr}, // Uniform Buffer Object
-                        {1, TEXTURE, 0, &Ttaxi},    // Texture
-                        {2, UNIFORM, sizeof(LocalGUBO), nullptr}    // Local GUBO
-                });
-            }
+            // The scene set: static objects, instance ids and materials are uploaded only once
+            DSscene.init(this, &DSLscene, {
+                    {0, STATIC_STORAGE, sizeof(staticObjects), nullptr, staticObjects},   // Static objects
+                    {1, TEXTURE_ARRAY, 0, nullptr, nullptr, {&Tcity, &Tpeople, &Ttaxi}},    // Texture array
+                    {2, STORAGE, sizeof(visibleInstanceIds), nullptr},  // Visible instance ids (rewritten every frame)
+                    {3, STORAGE, sizeof(dynamicObjects), nullptr},  // Dynamic objects (rewritten every frame)
+                    {4, STATIC_STORAGE, sizeof(materials), nullptr, materials}  // Materials
+            });
 
-            for(int i = 0; i < MESH; i++) {
-                DScity[i].init(this, &DSLcity, {
-                        {0, UNIFORM, sizeof(UniformBufferObject), nullptr}, // Uniform Buffer Object
-                        {1, TEXTURE, 0, &Tcity},    // Texture
-                        {2, UNIFORM, sizeof(LocalGUBO), nullptr}    // Local GUBO
-                });
-            }
+            // Indirect draw commands of the city batches, of the people batches and of the NPCs
+            ICscene.init(this, cityDraws + peopleDraws + CARS);
 
             DSskyBox.init(this, &DSLskyBox, {
                     {0, UNIFORM, sizeof(UniformBufferObject), nullptr}, // Uniform Buffer Object
@@ -614,28 +840,14 @@ class Application : public BaseProject {
                     {2, UNIFORM, sizeof(SkyGUBO), nullptr}  // Local GUBO
             });
 
-            for(int i = 0; i < CARS; i++) {
-                DScars[i].init(this, &DSLcars, {
-                        {0, UNIFORM, sizeof(UniformBufferObject), nullptr}, // Uniform Buffer Object
-                        {1, TEXTURE, 0, &Tcity},    // Texture
-                        {2, UNIFORM, sizeof(LocalGUBO), nullptr}    // Local GUBO
+            // One Descriptor Set for each texture of the 2D plane, indexed by twoDimTexture (0 = title, 1 = controls, 2 = endgame)
+            Texture *twoDimTextures[3] = {&Ttitle, &Tcontrols, &Tendgame};
+            for(int i = 0; i < 3; i++) {
+                DStwoDim[i].init(this, &DSLtwoDim, {
+                    {0, TEXTURE, 0, twoDimTextures[i]}
                 });
             }
 
-            for(int i = 0; i < PEOPLE; i++) {
-                DSpeople[i].init(this, &DSLpeople, {
-                        {0, UNIFORM, sizeof(UniformBufferObject), nullptr}, // Uniform Buffer Object
-                        {1, TEXTURE, 0, &Tpeople},  // Texture
-                        {2, UNIFORM, sizeof(LocalGUBO), nullptr}    // Local GUBO
-                });
-            }
-
-            DStwoDim.init(this, &DSLtwoDim, {
-                // When initializing the Descriptor Set for the 2D plane, we need to pass the texture
-                // Check the value of twoDimTexture to know which texture to pass (0 = title, 1 = controls, 2 = endgame)
-                {0, TEXTURE, 0, (twoDimTexture == 0 ? &Ttitle : (twoDimTexture == 1 ? &Tcontrols : &Tendgame))}
-            });
-
             DSarrow.init(this, &DSLarrow, {
                 {0, UNIFORM, sizeof(UniformBufferObject), nullptr}, // UBO
                 {1, UNIFORM, sizeof(ArrowGUBO), nullptr}    // GUBO
@@ -646,36 +858,19 @@ class Application : public BaseProject {
         void pipelinesAndDescriptorSetsCleanup() {
 
             // Cleanup of the Pipelines
-            Ptaxi.cleanup();
-            Pcity.cleanup();
-            Ppeople.cleanup();
-            Pcars.cleanup();
+            Pscene.cleanup();
             PskyBox.cleanup();
             PtwoDim.cleanup();
             Parrow.cleanup();
 
             // Cleanup of the Descriptor Sets
             DSglobal.cleanup();
-
-            for(int i = 0; i < TAXI_ELEMENTS; i++) {
-                DStaxi[i].cleanup();
-            }
-
-            for(int i = 0; i < MESH; i++) {
-                DScity[i].cleanup();
-            }
-
+            DSscene.cleanup();
             DSskyBox.cleanup();
 
-            for(int i = 0; i < CARS; i++) {
-                DScars[i].cleanup();
-            }
-
-            for(int i = 0; i < PEOPLE; i++) {
-                DSpeople[i].cleanup();
+            for(int i = 0; i < 3; i++) {
+                DStwoDim[i].cleanup();
             }
-
-            DStwoDim.cleanup();
             DSarrow.cleanup();
 
         }
@@ -683,6 +878,9 @@ class Application : public BaseProject {
         // Cleanup of Textures, Models, Descruot Set Layouts and Pipelines
         void localCleanup() {
 
+            // Stop the simulation thread before releasing what it uses (sounds)
+            stopSimulation();
+
             // Cleanup of Textures
             Tcity.cleanup();
             TskyBox.cleanup();
@@ -711,144 +909,133 @@ class Application : public BaseProject {
             }
             MtwoDim.cleanup();
             Marrow.cleanup();
+            // The packed meshes are released with the geometry buffer
+            Gscene.cleanup();
 
             // Cleanup of Descriptor Set Layouts
             DSLglobal.cleanup();
-            DSLtaxi.cleanup();
-            DSLcity.cleanup();
+            DSLscene.cleanup();
             DSLskyBox.cleanup();
-            DSLcars.cleanup();
-            DSLpeople.cleanup();
             DSLtwoDim.cleanup();
             DSLarrow.cleanup();
 
             // Cleanup of Pipelines and Descriptor Sets
-            Ptaxi.destroy();
-            Pcity.destroy();
-            Ppeople.destroy();
-            Pcars.destroy();
+            Pscene.destroy();
             PskyBox.destroy();
             PtwoDim.destroy();
             Parrow.destroy();
 
-        }
-
-        // Binding of the Pipelines, Descriptor Sets and Models to the command buffer
-        void populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage) {
-
-            // If we are not drawing a 2D scene:
-            if(!drawTwoDimPlane) {
-
-                Ptaxi.bind(commandBuffer);  // Bind the taxi Pipeline
-
-                // Bind the Global Descriptor Set in the set = 1 of the taxi Pipeline (just the GUBO)
-                DSglobal.bind(commandBuffer, Ptaxi, 1, currentImage);
-                for(int i = 0; i < TAXI_ELEMENTS; i++){
-                    // Bind the "Local" Descriptor Sets in the set = 0 (UBO, texture and Local GUBO)
-                    DStaxi[i].bind(commandBuffer, Ptaxi, 0, currentImage);
-                    Mtaxi[i].bind(commandBuffer);
-                    vkCmdDrawIndexed(commandBuffer,
-                                    static_cast<uint32_t>(Mtaxi[i].indices.size()), 1, 0, 0, 0);
-                }
-
-                Pcity.bind(commandBuffer);  // Bind the city Pipeline
-
-                // Bind the Global Descriptor Set in the set = 1 of the city Pipeline (just the GUBO)
-                DSglobal.bind(commandBuffer, Pcity, 1, currentImage);
-                for(int i = 0; i < MESH; i++) {
-                    // Bind the "Local" Descriptor Sets in the set = 0 (UBO, texture and Local GUBO)
-                    DScity[i].bind(commandBuffer, Pcity, 0, currentImage);
-                    Mcity[i].bind(commandBuffer);
-                    vkCmdDrawIndexed(commandBuffer,
-                                    static_cast<uint32_t>(Mcity[i].indices.size()), 1, 0, 0, 0);
-                }
-
-                PskyBox.bind(commandBuffer);    // Bind the skybox Pipeline
-
-                // Bind the SkyBox Descriptor Set in the set = 0 of the skybox Pipeline (UBO, texture and Local GUBO)
-                DSskyBox.bind(commandBuffer, PskyBox, 0, currentImage);
-                MskyBox.bind(commandBuffer);
-                vkCmdDrawIndexed(commandBuffer,
-                                static_cast<uint32_t>(MskyBox.indices.size()), 1, 0, 0, 0);
+            // The benchmark has ended: write its frame times
+            if(headless) {
+                writeBenchmarkReport();
+            }
 
-                Pcars.bind(commandBuffer);  // Bind the cars Pipeline
+        }
 
-                // Bind the Global Descriptor Set in the set = 1 of the cars Pipeline (just the GUBO)
-                DSglobal.bind(commandBuffer, Pcars, 1, currentImage);
-                for(int i = 0; i < CARS; i++) {
-                    // Bind the "Local" Descriptor Sets in the set = 0 (UBO, texture and Local GUBO)
-                    DScars[i].bind(commandBuffer, Pcars, 0, currentImage);
-                    Mcars[i].bind(commandBuffer);
-                    vkCmdDrawIndexed(commandBuffer,
-                                    static_cast<uint32_t>(Mcars[i].indices.size()), 1, 0, 0, 0);
-                }
+        // Binding of the Pipelines, Descriptor Sets and Models to the command buffer of each bucket
+        // Buckets are recorded in parallel, so this function only reads the state of the application
+        void populateCommandBucket(VkCommandBuffer commandBuffer, int bucket, int currentImage) {
 
-                Ppeople.bind(commandBuffer);    // Bind the people Pipeline
+            // In a 2D scene only the 2D bucket is drawn, in the 3D scenes all the others
+            if(drawTwoDimPlane != (bucket == BUCKET_TWO_DIM)) {
+                return;
+            }
 
-                // Bind the Global Descriptor Set in the set = 1 of the people Pipeline (just the GUBO)
-                DSglobal.bind(commandBuffer, Ppeople, 1, currentImage);
-                for(int i = 0; i < PEOPLE; i++) {
-                    // Check for the person to not be drawn (picked up)
-                    if((i == 3 || i == 7 || i == 35 || i == 37 || i == 44) && !drawPeople[i]) {
-                        // do nothing ==> do not draw it
+            switch(bucket) {
+                case BUCKET_TAXI:
+                    bindScene(commandBuffer, currentImage);
+                    {
+                        ScenePushConstants pushConstants = {MATERIAL_TAXI, 0};
+                        Pscene.push(commandBuffer, &pushConstants);
                     }
-                    else {
-                        // Bind the "Local" Descriptor Sets in the set = 0 (UBO, texture and Local GUBO)
-                        DSpeople[i].bind(commandBuffer, Ppeople, 0, currentImage);
-                        Mpeople[i].bind(commandBuffer);
+                    for(int i = 0; i < TAXI_ELEMENTS; i++){
+                        // The taxi elements are always drawn: firstInstance selects their dynamic object
                         vkCmdDrawIndexed(commandBuffer,
-                                        static_cast<uint32_t>(Mpeople[i].indices.size()), 1, 0, 0, 0);
+                                        Mtaxi[i].indexCount(), 1, Mtaxi[i].firstIndex(), Mtaxi[i].vertexOffset(), i);
                     }
-                }
+                    break;
 
-                Parrow.bind(commandBuffer);   // Bind the arrow Pipeline
-                DSarrow.bind(commandBuffer, Parrow, 0, currentImage);   // For the arrow just bind his DS
-                Marrow.bind(commandBuffer);
-                vkCmdDrawIndexed(commandBuffer,
-                                static_cast<uint32_t>(Marrow.indices.size()), 1, 0, 0, 0);
+                case BUCKET_CITY:
+                    bindScene(commandBuffer, currentImage);
+                    {
+                        ScenePushConstants pushConstants = {MATERIAL_CITY, 1};
+                        Pscene.push(commandBuffer, &pushConstants);
+                    }
+                    // One indirect draw for all the batches (the visible instances are written every frame)
+                    ICscene.draw(commandBuffer, currentImage, 0, cityDraws);
+                    break;
+
+                case BUCKET_SKYBOX:
+                    PskyBox.bind(commandBuffer);    // Bind the skybox Pipeline
+
+                    // Bind the Global Descriptor Set in the set = 1 of the skybox Pipeline (just the GUBO)
+                    DSglobal.bind(commandBuffer, PskyBox, 1, currentImage);
+                    // Bind the SkyBox Descriptor Set in the set = 0 of the skybox Pipeline (UBO, texture and Local GUBO)
+                    DSskyBox.bind(commandBuffer, PskyBox, 0, currentImage);
+                    MskyBox.bind(commandBuffer);
+                    vkCmdDrawIndexed(commandBuffer,
+                                    MskyBox.indexCount(), 1, 0, 0, 0);
+                    break;
+
+                case BUCKET_CARS:
+                    bindScene(commandBuffer, currentImage);
+                    {
+                        ScenePushConstants pushConstants = {MATERIAL_CARS, 0};
+                        Pscene.push(commandBuffer, &pushConstants);
+                    }
+                    // One indirect draw for all the NPCs (the culled ones have no instances)
+                    ICscene.draw(commandBuffer, currentImage, cityDraws + peopleDraws, CARS);
+                    break;
+
+                case BUCKET_PEOPLE:
+                    bindScene(commandBuffer, currentImage);
+                    {
+                        ScenePushConstants pushConstants = {MATERIAL_PEOPLE, 1};
+                        Pscene.push(commandBuffer, &pushConstants);
+                    }
+                    // One indirect draw for all the batches (the picked up person is left out of the visible instances)
+                    ICscene.draw(commandBuffer, currentImage, cityDraws, peopleDraws);
+                    break;
+
+                case BUCKET_ARROW:
+                    Parrow.bind(commandBuffer);   // Bind the arrow Pipeline
+                    DSglobal.bind(commandBuffer, Parrow, 1, currentImage);  // Bind the Global Descriptor Set in the set = 1
+                    DSarrow.bind(commandBuffer, Parrow, 0, currentImage);   // For the arrow just bind his DS
+                    Marrow.bind(commandBuffer);
+                    vkCmdDrawIndexed(commandBuffer,
+                                    Marrow.indexCount(), 1, 0, 0, 0);
+                    break;
 
-            }
-            // Else bind the Pipeline, Descriptor Set and Model for the 2D scene
-            else {
-                PtwoDim.bind(commandBuffer);    // Bind the 2D Pipeline
-                DStwoDim.bind(commandBuffer, PtwoDim, 0, currentImage);   // Bind the 2D DS
-                MtwoDim.bind(commandBuffer);
-                vkCmdDrawIndexed(commandBuffer,
-                                static_cast<uint32_t>(MtwoDim.indices.size()), 1, 0, 0, 0);
+                case BUCKET_TWO_DIM:
+                    PtwoDim.bind(commandBuffer);    // Bind the 2D Pipeline
+                    DStwoDim[twoDimTexture].bind(commandBuffer, PtwoDim, 0, currentImage);   // Bind the 2D DS of the current screen
+                    MtwoDim.bind(commandBuffer);
+                    vkCmdDrawIndexed(commandBuffer,
+                                    MtwoDim.indexCount(), 1, 0, 0, 0);
+                    break;
             }
 
         }
 
         // Main application loop
+        // The game advances by fixed steps in simulationStep, each frame reads the inputs, moves the camera and
+        // renders the state interpolated between the last two steps
         void updateUniformBuffer(uint32_t currentImage) {
 
             static bool debounce = false;
             static int curDebounce = 0;
 
-            static bool autoTime = true;    // Boolean set to true to auto update the time
-            static float cTime = 0.0f;  // Current time
-            const float turnTime = 72.0f;   // Time to turn 360° (cyclic timer)
-            const float angTurnTimeFact = 2.0f * M_PI / turnTime;   // Factor to convert the time in angle
+            const float angTurnTimeFact = 2.0f * M_PI / DAY_LENGTH;   // Factor to convert the time in angle
             // Initial values for the camera (first person view)
             static float CamPitch = glm::radians(0.0f);
             static float CamYaw = M_PI;
             // Initial values for the camera (third person view)
             static float camOffsetAngle = 0.0f;
 
-            // Vector with all the directions of the cars
-            glm::vec3 directions[CARS];
-
-            // Computation of the direction for each car (point to reach - pos of the car)
-            for(int i = 0; i < CARS; i++) {
-                directions[i] = glm::normalize(wayPoints[i][currentPoints[i]] - carPositions[i]);
-            }
-
-            // Speed for NPC cars
-            float speedCar= 4.0f;
-            float speed = 0.0f;
-
-            // Standard procedure to quit when the ESC key is pressed
-            if (glfwGetKey(window, GLFW_KEY_ESCAPE)) {
+            // Standard procedure to quit when the ESC key is pressed (no keyboard in the headless benchmark)
+            if (!headless && glfwGetKey(window, GLFW_KEY_ESCAPE)) {
+                // Stop the simulation first: it also plays the sounds
+                stopSimulation();
                 // Check if a sound is playing and stop it, then uninitialize it
                 if(ma_sound_is_playing(&titleMusic)) ma_sound_stop(&titleMusic);
                 ma_sound_uninit(&titleMusic);
@@ -881,11 +1068,11 @@ class Application : public BaseProject {
             }
 
             // Check if the space key is pressed to change the scene
-            if(glfwGetKey(window, GLFW_KEY_SPACE) && currScene != 3) {
+            if(!headless && glfwGetKey(window, GLFW_KEY_SPACE) && currScene != 3) {
                 if(!debounce) {
                     debounce = true;
                     curDebounce = GLFW_KEY_SPACE;
-                    /* Increment the scene counter and rebuild the pipeline
+                    /* Increment the scene counter and record again the command buffers
                      * Scenes:
                      * -2: Title scene
                      * -1: Controls scene
@@ -919,7 +1106,7 @@ class Application : public BaseProject {
             }
 
             // Check if the P key is pressed to change the scene to photo mode
-            if (glfwGetKey(window, GLFW_KEY_P) && currScene != 3) {
+            if (!headless && glfwGetKey(window, GLFW_KEY_P) && currScene != 3) {
                 if (!debounce) {
                     debounce = true;
                     curDebounce = GLFW_KEY_P;
@@ -931,15 +1118,8 @@ class Application : public BaseProject {
                     else {
                         // Save the scene I am leaving
 						lastSavedSceneValue = currScene;
-                        // Enter in photo mode
+                        // Enter in photo mode (the simulation stops the sounds of the taxi)
 						currScene = 2;
-                        // Check if the sounds of the taxi are playing and stop them
-                        if(ma_sound_is_playing(&idleEngineSound)) {
-                            ma_sound_stop(&idleEngineSound);
-                        }
-                        if(ma_sound_is_playing(&accelerationEngineSound)) {
-                            ma_sound_stop(&accelerationEngineSound);
-                        }
                     }
                     RebuildPipeline();
                 }
@@ -955,36 +1135,34 @@ class Application : public BaseProject {
             float deltaT;
             glm::vec3 m = glm::vec3(0.0f), r = glm::vec3(0.0f);
             bool fire = false;
-            // Get user inputs
-            getSixAxis(deltaT, m, r, fire);
-
-            if (autoTime) {
-                cTime += deltaT;    // Update the time
-                // If the time is greater than the turn time, subtract the turn time (make it cyclic)
-                cTime = (cTime > turnTime) ? (cTime - turnTime) : cTime;    
+            // Get user inputs (the benchmark has none and advances by a fixed time step)
+            if(headless) {
+                deltaT = BENCHMARK_DELTA_T;
+                benchmarkStep();
+            }
+            else {
+                getSixAxis(deltaT, m, r, fire);
             }
 
-            static float steeringAngCars[CARS];
-            // Update the position of the NPC cars only if not in photo mode
-            if(currScene != 2) {
-                for(int i = 0; i < CARS; i++) {
-                    // Update the position of the NPC cars
-                    carPositions[i] += directions[i] * speedCar * deltaT;
-                    // If the distance between the car's current position and the current waypoint is less than 0.25
-                    // Update the current waypoint index to point to the next waypoint
-                    if (glm::distance(carPositions[i], wayPoints[i][currentPoints[i]]) < 0.25f) {
-                        currentPoints[i] = (currentPoints[i] + 1) % wayPoints[i].size();
-                    }
+            // Run the simulation steps due and get the state to render
+            SimulationState frame = advanceSimulation({m, currScene}, deltaT);
+            // The benchmark runs at noon (day runs) or at midnight (night runs)
+            if(headless) {
+                frame.cTime = (benchmarkRun % 2 == 0 ? 0.25f : 0.75f) * DAY_LENGTH;
+            }
 
-                    // Compute the steering angle towards the next waypoint
-                    float targetSteering = atan2(directions[i].x, directions[i].z);
-                    // Normalize the steering angle between -π and π
-                    steeringAngCars[i]= fmod(targetSteering + M_PI, 2.0f * M_PI) - M_PI;
-                }
+            // The last drive of the arcade game has been completed: show the end game scene
+            if(frame.gameOver && currScene != 3) {
+                currScene = 3;  // Set the scene to the end game scene
+                drawTwoDimPlane = true; // Set the flag to draw the 2D plane
+                twoDimTexture = 2;  // Set the texture index for the end game scene
+                RebuildPipeline();
+                // Print the final score
+                std::cout << "\n\n\n\t--------- FINAL SCORE ---------\n" << std::endl;
+                std::cout << "\tTotal earnings: " << frame.money << " $"<< std::endl;
+                std::cout << "\n\t--------- FINAL SCORE ---------" << std::endl;
             }
 
-            static float steeringAng = 0.0f;    // Steering angle of the taxi
-            float oldSteeringAng = steeringAng; // Old steering angle of the taxi (used to check if the user is steering)
             glm::mat4 mView;
 
             // If the scene is the title or control and the title muisc is not playing, start it
@@ -1000,92 +1178,6 @@ class Application : public BaseProject {
                 // If the scene is first/third person view
                 if(currScene == 0 || currScene == 1) {
                     alreadyInPhotoMode = false;
-                    // Third person view or first person
-                    const float steeringSpeed = glm::radians(45.0f);
-                    // Max speed of the taxi
-                    const float moveSpeed = 7.5f;
-
-                    static float currentSpeed = 0.0f;
-                    float targetSpeed = moveSpeed * -m.z;
-                    // Adjust this value to control the damping effect
-                    const float dampingFactor = 3.0f;
-                    float speedDifference = targetSpeed - currentSpeed;
-                    // If the difference between the targetSpeed and the current speed is small ==> current speed become equal to the targetSpeed
-                    if (fabs(speedDifference) < 0.01f) {
-                        currentSpeed = targetSpeed;
-                    } else {
-                        // Otherwise speed gradually change
-                        currentSpeed += speedDifference * dampingFactor * deltaT;
-                    }
-                    // If I am not opening/closing the door I update the speed
-                    if(!openDoor && !closeDoor) {
-                        speed = currentSpeed * deltaT;
-                    }
-                    wheelRoll -= currentSpeed;
-                    // If the speed is very small it is forced to 0
-                    speed = (abs(speed) < 0.01f) ? 0.0f : speed;
-                    // Store the current steering angle before updating it
-                    oldSteeringAng = steeringAng;
-                    // Adjust the steering angle based on player input
-                    steeringAng += (speed >= 0 ? -m.x : m.x) * steeringSpeed * deltaT;
-                    // If the steering angle has not changed, gradually reset the wheel alignment
-                    if (steeringAng == oldSteeringAng) {
-                        wheelAndSteerAng = (wheelAndSteerAng < 0.0f ? wheelAndSteerAng + 0.25f : (wheelAndSteerAng > 0.0f ? wheelAndSteerAng - 0.25f : wheelAndSteerAng));
-                    }
-                    else if (steeringAng > oldSteeringAng) {
-                        // If the new steering angle is greater than the old one, limit the wheel rotation
-                        wheelAndSteerAng = (wheelAndSteerAng > -1.5f ? wheelAndSteerAng - 0.25f : wheelAndSteerAng);
-                    }
-                    else {
-                        // If the new steering angle is smaller than the old one, limit the wheel rotation in the other direction
-                        wheelAndSteerAng = (wheelAndSteerAng < 1.5f ? wheelAndSteerAng + 0.25f : wheelAndSteerAng);
-                    }
-                    if (speed == 0.0f) {
-						steeringAng = oldSteeringAng;
-                    }
-                    
-                    // Set the four collision points of the taxi (four corners of the car)
-                    for(int i = 0; i < TAXI_COLL_PCOUNT; i++) {
-                        taxiCollisionPoints[i] = glm::translate(glm::rotate(glm::translate(glm::mat4(1.0f), taxiPos), steeringAng, glm::vec3(0.0f, 1.0f, 0.0f)), taxiCollPOffsets[i])[3];
-                    }
-
-                    // Boolean variable: set it to true if the taxi is in collision with the external collision box
-                    bool collisionCheck = checkCollision(taxiCollisionPoints, TAXI_COLL_PCOUNT, externalCollisionBox, true);
-                    for(int i = 0; i < COLLISION_BOXES_COUNT; i++) {
-                        // For each internal collision box, check if the taxi is in collision with it and do the logical AND
-                        collisionCheck = collisionCheck && checkCollision(taxiCollisionPoints, TAXI_COLL_PCOUNT, internalCollisionBoxes[i], false);
-                    }
-                    // If the taxi is not in collision, update the position
-                    if(collisionCheck) {
-                        taxiPos = taxiPos + glm::vec3(speed * sin(steeringAng), 0.0f, speed * cos(steeringAng));
-                    }
-
-                    // If the taxi is running
-                    if (speed != 0.0f) {
-                        // If the idle engine sound is playing, stop it and reset the acceleration engine sound
-                        if(ma_sound_is_playing(&idleEngineSound)) {
-                            ma_sound_stop(&idleEngineSound);
-                            ma_sound_seek_to_pcm_frame(&accelerationEngineSound, 0);
-                        }
-                        // Start the acceleration engine sound
-                        ma_sound_start(&accelerationEngineSound);
-                    }
-                    else {
-                        // Else check if the acceleration engine sound is playing, stop it and reset the idle engine sound
-                        if(ma_sound_is_playing(&accelerationEngineSound)) {
-                            ma_sound_stop(&accelerationEngineSound);
-                            ma_sound_seek_to_pcm_frame(&idleEngineSound, 0);
-                        }
-                        // Start the idle engine sound
-                        ma_sound_start(&idleEngineSound);
-                    }
-
-                    // Calculate how much the taxi has turned
-                    float actualTurn = steeringAng - oldSteeringAng;
-                    // If the rotation is not 0, update the front light direction
-                    if(actualTurn != 0.0f) {
-                        frontLightDirection = glm::vec4(glm::rotate(glm::mat4(1.0), actualTurn, glm::vec3(0.0f, 1.0f, 0.0f)) * frontLightDirection);
-                    }
 
                     // If we are in the third person view
                     if (currScene == 0) {
@@ -1101,11 +1193,11 @@ class Application : public BaseProject {
                         }
 
                         // Calculate the camera position around the taxi in a circular path with optional offset angle from the user
-                        x = -radius * sin(steeringAng + camOffsetAngle);
-                        y = -radius * cos(steeringAng + camOffsetAngle);
-                        camPos = glm::vec3(taxiPos.x + x, taxiPos.y + 1.5f, taxiPos.z + y);
+                        x = -radius * sin(frame.steeringAng + camOffsetAngle);
+                        y = -radius * cos(frame.steeringAng + camOffsetAngle);
+                        camPos = glm::vec3(frame.taxiPos.x + x, frame.taxiPos.y + 1.5f, frame.taxiPos.z + y);
                         mView = glm::lookAt(camPos,
-                            taxiPos,
+                            frame.taxiPos,
                             glm::vec3(0, 1, 0));
                     }
                     // Else if we are in the first person view
@@ -1126,14 +1218,14 @@ class Application : public BaseProject {
                         glm::vec3 camOffset(0.35f, 1.05f, 0.7f);
                         // Compute camera offset based on the steering angle
                         glm::vec3 rotatedCamOffset = glm::vec3(
-                            glm::rotate(glm::mat4(1.0), steeringAng, glm::vec3(0, 1, 0)) * glm::vec4(camOffset, 1.0)
+                            glm::rotate(glm::mat4(1.0), frame.steeringAng, glm::vec3(0, 1, 0)) * glm::vec4(camOffset, 1.0)
                         );
                         //Update the position of the camera
-                        camPos = taxiPos + rotatedCamOffset;
+                        camPos = frame.taxiPos + rotatedCamOffset;
                         // Build the final view matrix by applying rotations and translation:
                         mView=
                             glm::rotate(glm::mat4(1.0f), -CamPitch, glm::vec3(1, 0, 0)) *
-                            glm::rotate(glm::mat4(1.0f), -CamYaw - steeringAng, glm::vec3(0, 1, 0)) *
+                            glm::rotate(glm::mat4(1.0f), -CamYaw - frame.steeringAng, glm::vec3(0, 1, 0)) *
                             glm::translate(glm::mat4(1.0f), -camPos);
 
                     }
@@ -1175,6 +1267,11 @@ class Application : public BaseProject {
 
                 }
 
+                // In the benchmark the camera follows its scripted path instead of the taxi
+                if(headless) {
+                    benchmarkCamera(float(benchmarkFrame - BENCHMARK_WARMUP_FRAMES) / BENCHMARK_FRAMES, camPos, mView);
+                }
+
                 const float nearPlane = 0.1f;   // Near plane
                 const float farPlane = 375.0f;  // Far plane
                 glm::mat4 Prj = glm::perspective(glm::radians(45.0f), Ar, nearPlane, farPlane);
@@ -1182,49 +1279,26 @@ class Application : public BaseProject {
                 Prj[1][1] *= -1;
 
 
-                // World matrix for the city
-                glm::mat4 mWorld  = glm::translate(glm::mat4(1), glm::vec3(0, 0, 3)) * glm::rotate(glm::mat4(1), glm::radians(180.0f), glm::vec3(0, 1, 0));
-
                 // Set the center and the scale (radius) of the sky box sphere
                 glm::vec3 sphereCenter = glm::vec3(40.0f, 0.0f, -75.0f);
                 glm::vec3 sphereScale = glm::vec3(180.0f);
                 // Offset from the sky box sphere
                 float sunOffset = 10.0f;
                 // Set the sun position rotating around the X and Y axis, Z position is fixed
-                glm::vec3 sunPos = glm::vec3(sphereCenter.x + (sphereScale.x - sunOffset) * cos(cTime * angTurnTimeFact), // x
-                                            sphereCenter.y + (sphereScale.x - sunOffset) * sin(cTime * angTurnTimeFact), // y
+                glm::vec3 sunPos = glm::vec3(sphereCenter.x + (sphereScale.x - sunOffset) * cos(frame.cTime * angTurnTimeFact), // x
+                                            sphereCenter.y + (sphereScale.x - sunOffset) * sin(frame.cTime * angTurnTimeFact), // y
                                             sphereCenter.z);
 
                 // Check when the sun is below the horizon ==> set the night to true
                 isNight = (sunPos.y < 0.0f ? true : false);
 
-                // If we have to open the door
-                if(openDoor) {
-                    // Update the angle of the door
-                    openingDoorAngle += 5.0f;
-                    // Check when the door reaches the maximum angle
-                    if (openingDoorAngle >= 69.0f) {
-                        openDoor = false;
-                        // Start the animation to close the door
-                        closeDoor = true;
-                    }
-                }
-                // If we have to close the door ==> same as open but reverted
-                else {
-                    openingDoorAngle -= 5.0f;
-                    if (openingDoorAngle <= 0.0f) {
-                        openingDoorAngle = 0.0f;
-                        closeDoor = false;
-                    }
-                }
-                
                 // Taxi's world matrix (one for each model of the taxi)
                 glm::mat4 mWorldTaxi[8];
 
                 // Set the the matrixes of the intern and extern of the taxi model
                 mWorldTaxi[1] = mWorldTaxi[2] =
-                    glm::translate(glm::mat4(1.0), taxiPos) *
-                    glm::rotate(glm::mat4(1.0), steeringAng, glm::vec3(0, 1, 0));
+                    glm::translate(glm::mat4(1.0), frame.taxiPos) *
+                    glm::rotate(glm::mat4(1.0), frame.steeringAng, glm::vec3(0, 1, 0));
 
                 // Vector with the offsets of the other taxi's elements
 				glm::vec3 offsets[6] = {
@@ -1240,37 +1314,37 @@ class Application : public BaseProject {
                 glm::vec3 rotatedOffsets[TAXI_ELEMENTS_W_OFFSETS_C], finalWorldPos[TAXI_ELEMENTS_W_OFFSETS_C];
                 for (int i = 0; i < TAXI_ELEMENTS_W_OFFSETS_C; i++) {
                     // Rotate the offsets based on the steering angle
-					rotatedOffsets[i] = glm::vec3(glm::rotate(glm::mat4(1.0), steeringAng, glm::vec3(0, 1, 0)) * glm::vec4(offsets[i], 1.0));
+					rotatedOffsets[i] = glm::vec3(glm::rotate(glm::mat4(1.0), frame.steeringAng, glm::vec3(0, 1, 0)) * glm::vec4(offsets[i], 1.0));
                     // Compute the final position of the elements
-					finalWorldPos[i] = taxiPos + rotatedOffsets[i];
+					finalWorldPos[i] = frame.taxiPos + rotatedOffsets[i];
                 }
 
                 // Setting the world matrix for the other taxi's elements
 				mWorldTaxi[4] =  // Front right wheel
                     glm::translate(glm::mat4(1.0), finalWorldPos[0]) *
-                    glm::rotate(glm::mat4(1.0), steeringAng - glm::radians(wheelAndSteerAng*15), glm::vec3(0, 1, 0)) *
-					glm::rotate(glm::mat4(1.0), wheelRoll, glm::vec3(1, 0, 0)) * //when I accelerate the wheel should spin
+                    glm::rotate(glm::mat4(1.0), frame.steeringAng - glm::radians(frame.wheelAndSteerAng*15), glm::vec3(0, 1, 0)) *
+					glm::rotate(glm::mat4(1.0), frame.wheelRoll, glm::vec3(1, 0, 0)) * //when I accelerate the wheel should spin
                     glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 0, 1)); //the wheel was facing left
 				mWorldTaxi[5] =  // Front left wheel
                     glm::translate(glm::mat4(1.0), finalWorldPos[1]) *
-                    glm::rotate(glm::mat4(1.0), steeringAng - glm::radians(wheelAndSteerAng * 15), glm::vec3(0, 1, 0)) *
-                    glm::rotate(glm::mat4(1.0), wheelRoll, glm::vec3(1, 0, 0)); //when I accelerate the wheel should spin
+                    glm::rotate(glm::mat4(1.0), frame.steeringAng - glm::radians(frame.wheelAndSteerAng * 15), glm::vec3(0, 1, 0)) *
+                    glm::rotate(glm::mat4(1.0), frame.wheelRoll, glm::vec3(1, 0, 0)); //when I accelerate the wheel should spin
 				mWorldTaxi[6] = // Rear right wheel
                     glm::translate(glm::mat4(1.0), finalWorldPos[2]) *
-                    glm::rotate(glm::mat4(1.0), steeringAng, glm::vec3(0, 1, 0)) *
-                    glm::rotate(glm::mat4(1.0), wheelRoll, glm::vec3(1, 0, 0)) *
+                    glm::rotate(glm::mat4(1.0), frame.steeringAng, glm::vec3(0, 1, 0)) *
+                    glm::rotate(glm::mat4(1.0), frame.wheelRoll, glm::vec3(1, 0, 0)) *
                     glm::rotate(glm::mat4(1.0), glm::radians(180.0f), glm::vec3(0, 0, 1));
 				mWorldTaxi[7] = // Rear left wheel
                     glm::translate(glm::mat4(1.0), finalWorldPos[3]) *
-                    glm::rotate(glm::mat4(1.0), steeringAng, glm::vec3(0, 1, 0)) *
-                    glm::rotate(glm::mat4(1.0), wheelRoll, glm::vec3(1, 0, 0)); //when I accelerate the wheel should spin
+                    glm::rotate(glm::mat4(1.0), frame.steeringAng, glm::vec3(0, 1, 0)) *
+                    glm::rotate(glm::mat4(1.0), frame.wheelRoll, glm::vec3(1, 0, 0)); //when I accelerate the wheel should spin
 				mWorldTaxi[3] = // Steering wheel
                     glm::translate(glm::mat4(1.0), finalWorldPos[4]) *
-                    glm::rotate(glm::mat4(1.0), steeringAng, glm::vec3(0, 1, 0)) *
-                    glm::rotate(glm::mat4(1.0), wheelAndSteerAng, glm::vec3(0, 0, 1));
+                    glm::rotate(glm::mat4(1.0), frame.steeringAng, glm::vec3(0, 1, 0)) *
+                    glm::rotate(glm::mat4(1.0), frame.wheelAndSteerAng, glm::vec3(0, 0, 1));
 				mWorldTaxi[0] = // Door (rotating one)
 					glm::translate(glm::mat4(1.0), finalWorldPos[5]) *
-					glm::rotate(glm::mat4(1.0), steeringAng + glm::radians(openingDoorAngle), glm::vec3(0, 1, 0));
+					glm::rotate(glm::mat4(1.0), frame.steeringAng + glm::radians(frame.openingDoorAngle), glm::vec3(0, 1, 0));
                  
 
                 // Set the position where there will be the taxi lights (point for back, spot for front)
@@ -1282,331 +1356,798 @@ class Application : public BaseProject {
                 // If we are not in photo mode, update the position of the NPC cars
                 if(currScene != 2) {
                     for(int i = 0; i < CARS; i++) {
-                        mWorldCars[i] = glm::translate(glm::mat4(1.0), carPositions[i]) *
-                                        glm::rotate(glm::mat4(1.0), steeringAngCars[i], glm::vec3(0, 1, 0));
-                    }
-                }
-
-                // If we don't have already selected a random person to pick up
-                if(!pickupPointSelected) {
-                    // Randomly select an index for the pickup person point [0 - 4]
-                    random_index = rand() % PICKUP_COUNT;
-                    // Get the position of the randomly selected person
-                    pickupPoint = pickupPoints[random_index];
-                    // Ste the flag to true to not choose another one
-                    pickupPointSelected = true;
-                }
-
-                // If the taxi is close to the person to pick up, we have not already picked up the person and we are not moving
-                if(glm::distance(glm::vec3(pickupPoint), taxiPos) < MIN_DISTANCE_TO_PICKUP && !pickedPassenger && speed == 0.0f) {
-                    // Get the hash map index of the selected person
-                    int map_index = ((random_index == 0) ? 3 : ((random_index == 1) ? 7 : ((random_index == 2) ? 35 : ((random_index == 3) ? 37 : 44))));
-                    // Set the value in the hash map to false ==> when the pipeline is rebuilded, we will not draw it
-                    drawPeople[map_index] = false;
-                    // Set the flag to true and start the animation to open the door
-                    pickedPassenger = true;
-                    openDoor = true;
-                    // Rebuild the pipeline to not draw the picked up person
-                    RebuildPipeline();
-                    // Reset the sound of the pickup and start it
-                    if(ma_sound_at_end(&pickupSound)) ma_sound_seek_to_pcm_frame(&pickupSound, 0);
-                    ma_sound_start(&pickupSound);
-                    // Get the position of the point where to take the person
-                    dropoffPoint = dropoffPoints[random_index];
-                    // Save the time of the pickup to calculate the income at the end
-                    pickupTime = time(NULL);
-                }
-
-                // If the taxi is close to the dropoff point, we have already picked up the person and we are not moving
-                if(glm::distance(glm::vec3(dropoffPoint), taxiPos) < MIN_DISTANCE_TO_PICKUP && pickedPassenger && speed == 0.0f) {
-                    // Get the hash map index of the selected person
-                    int map_index = ((random_index == 0) ? 3 : ((random_index == 1) ? 7 : ((random_index == 2) ? 35 : ((random_index == 3) ? 37 : 44))));
-                    // Set the value in the hash map to true ==> when the pipeline is rebuilded, we will draw it
-                    drawPeople[map_index] = true;
-                    // Set the flag to false and start the animation to close the door
-                    pickedPassenger = false;
-                    openDoor = true;
-                    // Set to false the flag to say that we have to choose a new person to pick up
-                    pickupPointSelected = false;
-                    // Rebuild the pipeline to draw the dropped off person
-                    RebuildPipeline();
-                    // Reset the sound of the money and start it
-                    if(ma_sound_at_end(&moneySound)) ma_sound_seek_to_pcm_frame(&moneySound, 0);
-                    ma_sound_start(&moneySound);
-                    // Calculate the income of the drive: time passed multiplied by the rate that is higher if it is night
-                    money += (time(NULL) - pickupTime) * (isNight ? 7.9f : 4.1f);
-                    // If we are not in the endless game mode
-                    if(!endlessGameMode) {
-                        currScene = 3;  // Set the scene to the end game scene
-                        drawTwoDimPlane = true; // Set the flag to draw the 2D plane
-                        twoDimTexture = 2;  // Set the texture index for the end game scene
-                        RebuildPipeline();
-                        // Stop the taxi's sounds
-                        if(ma_sound_is_playing(&idleEngineSound)) {
-                            ma_sound_stop(&idleEngineSound);
-                        }
-                        if(ma_sound_is_playing(&accelerationEngineSound)) {
-                            ma_sound_stop(&accelerationEngineSound);
-                        }
-                        // Print the final score
-                        std::cout << "\n\n\n\t--------- FINAL SCORE ---------\n" << std::endl;
-                        std::cout << "\tTotal earnings: " << money << " $"<< std::endl;
-                        std::cout << "\n\t--------- FINAL SCORE ---------" << std::endl;
-                    }
-                    else {
-                        totDrivesCompleted++;   // Else if we are in the endless game mode, increment the number of drives completed
+                        mWorldCars[i] = glm::translate(glm::mat4(1.0), frame.carPositions[i]) *
+                                        glm::rotate(glm::mat4(1.0), frame.steeringAngCars[i], glm::vec3(0, 1, 0));
                     }
                 }
 
                 // SETTING OF THE PARAMETERS FOR THE GLOABL GUBO
+                globalGUBO.viewProjMat = Prj * mView;   // Set the view-projection matrix (the MVP is computed in the vertex shader)
+                // Cull the city, the people and the cars against the view frustum of this frame
+                // and choose their levels of detail (Prj[0][0] * Ar is the inverse of the tangent of half the vertical FOV,
+                // Prj[1][1] is not used since it has been flipped)
+                cullScene(globalGUBO.viewProjMat, camPos, Prj[0][0] * Ar);
+                writeDrawCommands(currentImage, frame.drawPeople);
                 globalGUBO.directLightPos = glm::vec4(sunPos, 1.0f);    // Set the sun position
-                for(int i = 0; i < TAXI_LIGHT_COUNT; i++) {
-                    globalGUBO.taxiLightPos[i] = taxiLightPos[i];   // Set the taxi lights positions
-                }
                 globalGUBO.directLightCol = sunCol; // Set the sun color
-                globalGUBO.rearLightCol = rearLightColor;   // Set the rear light color
-                globalGUBO.frontLightCol = frontLightColor; // Set the front light color
-                globalGUBO.frontLightDir = frontLightDirection; // Set the front light direction
-                globalGUBO.frontLightCosines = frontLightCosines;   // Set the front light cosines
-                globalGUBO.streetLightCol = streetLightCol; // Set the street light color
-                globalGUBO.streetLightDirection = streetLightDirection; // Set the street light direction
-                globalGUBO.streetLightCosines = streetLightCosines; // Set the street light cosines
                 // Set the pickup point position (if we have already picked up the person, set the dropoff point)
-                globalGUBO.pickupPointPos = (!pickedPassenger ? glm::vec4(pickupPoint.x, PICKUP_POINT_Y_OFFSET, pickupPoint.z, pickupPoint.w) : glm::vec4(dropoffPoint.x, PICKUP_POINT_Y_OFFSET, dropoffPoint.z, dropoffPoint.w));
+                globalGUBO.pickupPointPos = (!frame.pickedPassenger ? glm::vec4(frame.pickupPoint.x, PICKUP_POINT_Y_OFFSET, frame.pickupPoint.z, frame.pickupPoint.w) : glm::vec4(frame.dropoffPoint.x, PICKUP_POINT_Y_OFFSET, frame.dropoffPoint.z, frame.dropoffPoint.w));
                 globalGUBO.pickupPointCol = pickupPointColor;   // Set the pickup point color
                 globalGUBO.eyePos = glm::vec4(camPos, 1.0f);    // Set the camera position
                 globalGUBO.settingsAndNight = glm::vec4(float(graphicsSettings), (isNight ? 1.0f : 0.0f), 0.0f, 0.0f);  // Set the graphics settings and if it is night
                 DSglobal.map(currentImage, &globalGUBO, sizeof(globalGUBO), 0); // Map the global GUBO to the descriptor set
 
-                // Read the "city.json" file to configure and update the city's mesh instances
-                nlohmann::json js;
-                std::ifstream ifs2("models/city.json"); // Open the JSON file
-                if (!ifs2.is_open()) {
-                    std::cout << "[ ERROR ]: Scene file not found!" << std::endl;
-                    exit(-1);
+                // Bin the lights of this frame in the clusters and map them to the descriptor set
+                // (only the used part of the light indices is copied)
+                int lightIndexCount = updateLightClusters(taxiLightPos, frame.frontLightDirection);
+                DSglobal.map(currentImage, &lightClusters, offsetof(LightClusters, lightIndices) + lightIndexCount * sizeof(uint32_t), 1);
+
+                // For each mesh of the taxi
+                for(int i = 0; i < TAXI_ELEMENTS; i++){
+                    dynamicObjects[i].mMat = mWorldTaxi[i];    // Set the model matrix
+                    dynamicObjects[i].nMat = glm::inverse(glm::transpose(dynamicObjects[i].mMat));    // Set the normal matrix
                 }
-                try {
-                    json j;
-                    ifs2>>j;
 
-                    float TMj[16];
+                // For each NPC car (after the taxi in the dynamic objects)
+                for(int i = 0; i < CARS; i++) {
+                    dynamicObjects[TAXI_ELEMENTS + i].mMat = mWorldCars[i];    // Set the model matrix
+                    dynamicObjects[TAXI_ELEMENTS + i].nMat = glm::inverse(glm::transpose(mWorldCars[i]));    // Set the normal matrix
+                }
+                // Map all the dynamic objects to the scene descriptor set at once
+                DSscene.map(currentImage, dynamicObjects, sizeof(dynamicObjects), 3);
 
-                    for(int k = 0; k < MESH; k++) {
+                // Set the sky box's center and scale (translate and scale the sky box sphere)
+                glm::mat4 scaleMat = glm::translate(glm::mat4(1.0f), sphereCenter) * glm::scale(glm::mat4(1.0f), sphereScale);
+                uboSkyBox.mMat = scaleMat;  // Set the model matrix
+                uboSkyBox.nMat = glm::inverse(glm::transpose(uboSkyBox.mMat));  // Set the normal matrix
+                DSskyBox.map(currentImage, &uboSkyBox, sizeof(uboSkyBox), 0);   // Map the UBO to the descriptor set
+                guboSkyBox.directLightPos = glm::vec4(sunPos, 1.0f);    // Set the sun position
+                DSskyBox.map(currentImage, &guboSkyBox, sizeof(guboSkyBox), 2);  // Map the "Local" GUBO to the descriptor set
 
-                        nlohmann::json TMjson = j["instances"][k]["transform"];
-                        for(int l = 0; l < 16; l++) {
-                            TMj[l] = TMjson[l];
-                        }
-                        // Set the world matrix for the city element
-                        mWorld=glm::mat4(TMj[0],TMj[4],TMj[8],TMj[12],TMj[1],TMj[5],TMj[9],TMj[13],TMj[2],TMj[6],TMj[10],TMj[14],TMj[3],TMj[7],TMj[11],TMj[15]);
-                        uboCity[k].mMat = mWorld;   // Set the model matrix
-                        uboCity[k].nMat = glm::inverse(glm::transpose(uboCity[k].mMat));    // Set the normal matrix
-                        uboCity[k].mvpMat = Prj * mView * mWorld;   // Set the MVP matrix
-                        DScity[k].map(currentImage, &uboCity[k], sizeof(uboCity[k]), 0); 
-                        // Hash map used to take the 5 positions of the street lights closest to the city element 
-                        std::unordered_map<float, glm::vec3> distancesToPositions;
-                        std::vector<float> distances;   // Vector used to store the distances
-                        float dist = 0.0f;
-                        // For each street light:
-                        for(int i = 0; i < STREET_LIGHT_COUNT; i++) {
-                            // Calculate the distance between the city element and the street light
-                            dist = glm::distance(streetlightPos[i], glm::vec3(mWorld[3]));
-                            // Store the distance in the vector
-                            distances.push_back(dist);
-                            // Store the position of the street light in the hash map using the distance as key
-                            distancesToPositions[dist] = streetlightPos[i];
-                        }
-                        // Sort the distances vector in ascending order
-                        std::sort(distances.begin(), distances.end());
-                        // Set in the "Local" GUBO the positions of the 5 closest street lights using the distances as keys
-                        for(int i = 0; i < MAX_STREET_LIGHTS; i++) {
-                            guboCity[k].streetLightPos[i] = glm::vec4(distancesToPositions[distances[i]], 1.0f);
-                        }
-                        // Set the gamma and metallic values
-                        guboCity[k].gammaAndMetallic = glm::vec4(128.0f, 0.1f, 0.0f, 0.0f);
-                        // Map the "Local" GUBO to the descriptor set
-                        DScity[k].map(currentImage, &guboCity[k], sizeof(guboCity[k]), 2);
+                // Set the position of the arrow (if we have already picked up the person, set the dropoff point)
+                // The arrow will move up and down with a sinusoidal movement
+                glm::vec3 arrowPosition = (!frame.pickedPassenger ? glm::vec3(frame.pickupPoint.x, ARROW_Y_OFFSET + (glm::cos(frame.cTime) / 4.0f), frame.pickupPoint.z) : glm::vec3(frame.dropoffPoint.x, ARROW_Y_OFFSET + (glm::cos(frame.cTime) / 4.0f), frame.dropoffPoint.z));
+                // Set the world matrix for the arrow translating it to the position and rotating it around the Z axis
+                // The arrow will also rotate around the Y axis with a turn factor of 10 degrees per tick
+                glm::mat4 mWorldArrow = glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), arrowPosition), glm::radians(180.0f), glm::vec3(0.0f, 0.0f, 1.0f)), glm::radians(10.0f) * frame.cTime, glm::vec3(0.0f, 1.0f, 0.0f));
+                uboArrow.mMat = mWorldArrow;    // Set the model matrix
+                uboArrow.nMat = glm::inverse(glm::transpose(uboArrow.mMat));    // Set the normal matrix
+                DSarrow.map(currentImage, &uboArrow, sizeof(uboArrow), 0);  // Map the UBO to the descriptor set
+                // Set the position of the arrow's pickup point (if we have already picked up the person, set the dropoff point)
+                guboArrow.pickupPointPos = (!frame.pickedPassenger ? glm::vec4(frame.pickupPoint.x, PICKUP_POINT_Y_OFFSET, frame.pickupPoint.z, frame.pickupPoint.w) : glm::vec4(frame.dropoffPoint.x, PICKUP_POINT_Y_OFFSET, frame.dropoffPoint.z, frame.dropoffPoint.w));
+                guboArrow.pickupPointCol = pickupPointColor;    // Set the pickup point color (POINTLIGHT)
+                guboArrow.eyePos = glm::vec4(camPos, 1.0f); // Set the camera position
+                guboArrow.gammaAndMetallic = glm::vec4(128.0f, 1.0f, 0.0f, 0.0f);   // Set the gamma and metallic values
+                DSarrow.map(currentImage, &guboArrow, sizeof(guboArrow), 1);    // Map the GUBO to the descriptor set
+
+            }
+        }
+
+        // Run the simulation steps due in this frame and return the state to render, interpolated between the last two steps
+        // With the simulation thread the steps run there: the frame only hands over its inputs and reads the last two states
+        SimulationState advanceSimulation(const SimulationInput &input, float deltaT) {
+            const float stepTime = 1.0f / SIMULATION_RATE;
+            if(simulationThreaded) {
+                if(!simulationStarted) {
+                    startSimulation();
+                }
+                std::lock_guard<std::mutex> lock(simulationMutex);
+                simulationInput = input;
+                float alpha = std::chrono::duration<float>(std::chrono::steady_clock::now() - currentStateTime).count() * SIMULATION_RATE;
+                return interpolateStates(previousState, currentState, glm::clamp(alpha, 0.0f, 1.0f));
+            }
+
+            // Without the thread the steps due run here, at most MAX_SIMULATION_STEPS (then the game slows down)
+            simulationTime += deltaT;
+            int steps = 0;
+            while(simulationTime >= stepTime && steps < MAX_SIMULATION_STEPS) {
+                simulationStep(input, stepTime);
+                previousState = currentState;
+                currentState = captureState();
+                simulationTime -= stepTime;
+                steps++;
+            }
+            simulationTime = std::min(simulationTime, stepTime);
+            return interpolateStates(previousState, currentState, simulationTime * SIMULATION_RATE);
+        }
+
+        void startSimulation() {
+            simulationStarted = true;
+            simulationRunning = true;
+            currentStateTime = std::chrono::steady_clock::now();
+            simulationThread = std::thread([this]() { simulationLoop(); });
+        }
+
+        void stopSimulation() {
+            if(simulationThread.joinable()) {
+                simulationRunning = false;
+                simulationThread.join();
+            }
+        }
+
+        // Simulation thread: one step every 1 / SIMULATION_RATE seconds with the last inputs handed over by the frames
+        // After a stall of more than MAX_SIMULATION_STEPS steps the missed ones are dropped (the game slows down)
+        void simulationLoop() {
+            const auto stepDuration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                        std::chrono::duration<double>(1.0 / SIMULATION_RATE));
+            auto nextStep = std::chrono::steady_clock::now();
+            while(simulationRunning) {
+                SimulationInput input;
+                {
+                    std::lock_guard<std::mutex> lock(simulationMutex);
+                    input = simulationInput;
+                }
+                simulationStep(input, 1.0f / SIMULATION_RATE);
+                SimulationState state = captureState();
+                {
+                    std::lock_guard<std::mutex> lock(simulationMutex);
+                    previousState = std::move(currentState);
+                    currentState = std::move(state);
+                    currentStateTime = std::chrono::steady_clock::now();
+                }
+
+                nextStep += stepDuration;
+                auto now = std::chrono::steady_clock::now();
+                if(now - nextStep > MAX_SIMULATION_STEPS * stepDuration) {
+                    nextStep = now;
+                }
+                std::this_thread::sleep_until(nextStep);
+            }
+        }
+
+        // One step of the game: clock, NPC cars, taxi driven by the inputs, door animation, pickups and collisions
+        // The step only changes the state of the game (the frames read it through captureState)
+        void simulationStep(const SimulationInput &input, float dt) {
+            // After the last drive of the arcade game the taxi stays still
+            int scene = gameOver ? 3 : input.scene;
+            const glm::vec3 &m = input.m;
+
+            cTime += dt;    // Update the time
+            // If the time is greater than the length of the day, subtract it (make it cyclic)
+            cTime = (cTime > DAY_LENGTH) ? (cTime - DAY_LENGTH) : cTime;
+            // Night when the sun is below the horizon
+            bool night = sin(cTime * 2.0f * M_PI / DAY_LENGTH) < 0.0f;
+
+            // Speed for NPC cars
+            float speedCar= 4.0f;
+            float speed = 0.0f;
+
+            // Update the position of the NPC cars only if not in photo mode
+            if(scene != 2) {
+                for(int i = 0; i < CARS; i++) {
+                    // Direction of the car (point to reach - pos of the car)
+                    glm::vec3 direction = glm::normalize(wayPoints[i][currentPoints[i]] - carPositions[i]);
+                    // Update the position of the NPC cars
+                    carPositions[i] += direction * speedCar * dt;
+                    // If the distance between the car's current position and the current waypoint is less than 0.25
+                    // Update the current waypoint index to point to the next waypoint
+                    if (glm::distance(carPositions[i], wayPoints[i][currentPoints[i]]) < 0.25f) {
+                        currentPoints[i] = (currentPoints[i] + 1) % wayPoints[i].size();
                     }
 
+                    // Compute the steering angle towards the next waypoint
+                    float targetSteering = atan2(direction.x, direction.z);
+                    // Normalize the steering angle between -π and π
+                    steeringAngCars[i]= fmod(targetSteering + M_PI, 2.0f * M_PI) - M_PI;
                 }
-                catch (const nlohmann::json::exception& e) {
-                    std::cout << "[ EXCEPTION ]: " << e.what() << std::endl;
-                    exit(1);
+            }
+
+            // The taxi is driven in the first and third person views
+            if(scene == 0 || scene == 1) {
+                const float steeringSpeed = glm::radians(45.0f);
+                // Max speed of the taxi
+                const float moveSpeed = 7.5f;
+
+                float targetSpeed = moveSpeed * -m.z;
+                // Adjust this value to control the damping effect
+                const float dampingFactor = 3.0f;
+                float speedDifference = targetSpeed - currentSpeed;
+                // If the difference between the targetSpeed and the current speed is small ==> current speed become equal to the targetSpeed
+                if (fabs(speedDifference) < 0.01f) {
+                    currentSpeed = targetSpeed;
+                } else {
+                    // Otherwise speed gradually change
+                    currentSpeed += speedDifference * dampingFactor * dt;
+                }
+                // If I am not opening/closing the door and the taxi is not almost still, I update the position
+                if(!openDoor && !closeDoor && fabs(currentSpeed) >= MIN_TAXI_SPEED) {
+                    speed = currentSpeed * dt;
+                }
+                wheelRoll -= WHEEL_ROLL_RATE * currentSpeed * dt;
+                // Store the current steering angle before updating it
+                float oldSteeringAng = steeringAng;
+                // Adjust the steering angle based on player input
+                steeringAng += (speed >= 0 ? -m.x : m.x) * steeringSpeed * dt;
+                // The wheels turn towards the steering direction (up to 1.5), or back to the center when not steering
+                float wheelStep = WHEEL_STEER_RATE * dt;
+                if (steeringAng == oldSteeringAng) {
+                    wheelAndSteerAng = (wheelAndSteerAng < 0.0f ? std::min(wheelAndSteerAng + wheelStep, 0.0f) : std::max(wheelAndSteerAng - wheelStep, 0.0f));
+                }
+                else if (steeringAng > oldSteeringAng) {
+                    wheelAndSteerAng = std::max(wheelAndSteerAng - wheelStep, -1.5f);
+                }
+                else {
+                    wheelAndSteerAng = std::min(wheelAndSteerAng + wheelStep, 1.5f);
+                }
+                if (speed == 0.0f) {
+                    steeringAng = oldSteeringAng;
                 }
 
-                // For each mesh of the taxi
-                for(int i=0; i<8; i++){
-                    uboTaxi[i].mMat = mWorldTaxi[i];    // Set the model matrix
-                    uboTaxi[i].nMat = glm::inverse(glm::transpose(uboTaxi[i].mMat));    // Set the normal matrix
-                    uboTaxi[i].mvpMat = Prj * mView * uboTaxi[i].mMat;  // Set the MVP matrix
-                    DStaxi[i].map(currentImage, &uboTaxi[i], sizeof(uboTaxi[i]), 0);    // Map the UBO to the descriptor set
-                    // Hash map used to take the 5 positions of the street lights closest to the taxi element
-                    std::unordered_map<float, glm::vec3> distancesToPositions;
-                    std::vector<float> distances;   // Vector used to store the distances
-                    float dist = 0.0f;  // Distance variable
-                    // For each street light:
-                    for(int j = 0; j < STREET_LIGHT_COUNT; j++) {
-                        // Calculate the distance between the taxi element and the street light
-                        dist = glm::distance(streetlightPos[j], glm::vec3(mWorldTaxi[1][3]));
-                        // Store the distance in the vector
-                        distances.push_back(dist);
-                        // Store the position of the street light in the hash map using the distance as key
-                        distancesToPositions[dist] = streetlightPos[j];
+                // Set the four collision points of the taxi (four corners of the car)
+                for(int i = 0; i < TAXI_COLL_PCOUNT; i++) {
+                    taxiCollisionPoints[i] = glm::translate(glm::rotate(glm::translate(glm::mat4(1.0f), taxiPos), steeringAng, glm::vec3(0.0f, 1.0f, 0.0f)), taxiCollPOffsets[i])[3];
+                }
+
+                // Boolean variable: set it to true if the taxi is in collision with the external collision box
+                bool collisionCheck = checkCollision(taxiCollisionPoints, TAXI_COLL_PCOUNT, externalCollisionBox, true);
+                for(int i = 0; i < COLLISION_BOXES_COUNT; i++) {
+                    // For each internal collision box, check if the taxi is in collision with it and do the logical AND
+                    collisionCheck = collisionCheck && checkCollision(taxiCollisionPoints, TAXI_COLL_PCOUNT, internalCollisionBoxes[i], false);
+                }
+                // If the taxi is not in collision, update the position
+                if(collisionCheck) {
+                    taxiPos = taxiPos + glm::vec3(speed * sin(steeringAng), 0.0f, speed * cos(steeringAng));
+                }
+
+                // If the taxi is running
+                if (speed != 0.0f) {
+                    // If the idle engine sound is playing, stop it and reset the acceleration engine sound
+                    if(ma_sound_is_playing(&idleEngineSound)) {
+                        ma_sound_stop(&idleEngineSound);
+                        ma_sound_seek_to_pcm_frame(&accelerationEngineSound, 0);
                     }
-                    // Sort the distances vector in ascending order
-                    std::sort(distances.begin(), distances.end());
-                    // Set in the "Local" GUBO the positions of the 5 closest street lights using the distances as keys
-                    for(int j = 0; j < MAX_STREET_LIGHTS; j++) {
-                        guboTaxi[i].streetLightPos[j] = glm::vec4(distancesToPositions[distances[j]], 1.0f);
+                    // Start the acceleration engine sound
+                    ma_sound_start(&accelerationEngineSound);
+                }
+                else {
+                    // Else check if the acceleration engine sound is playing, stop it and reset the idle engine sound
+                    if(ma_sound_is_playing(&accelerationEngineSound)) {
+                        ma_sound_stop(&accelerationEngineSound);
+                        ma_sound_seek_to_pcm_frame(&idleEngineSound, 0);
                     }
-                    // Set the gamma and metallic values
-                    guboTaxi[i].gammaAndMetallic = glm::vec4(128.0f, 1.0f, 0.0f, 0.0f);
-                    // Map the "Local" GUBO to the descriptor set
-                    DStaxi[i].map(currentImage, &guboTaxi[i], sizeof(guboTaxi[i]), 2);
+                    // Start the idle engine sound
+                    ma_sound_start(&idleEngineSound);
                 }
 
-                // Set the position of the taxi's collision sphere center (used for collision with NPCs)
-                glm::vec4 taxiCollisionSphereCenter = glm::translate(mWorldTaxi[1], glm::vec3(0.0f, 0.0f, 1.0f))[3];
+                // Calculate how much the taxi has turned
+                float actualTurn = steeringAng - oldSteeringAng;
+                // If the rotation is not 0, update the front light direction
+                if(actualTurn != 0.0f) {
+                    frontLightDirection = glm::vec4(glm::rotate(glm::mat4(1.0), actualTurn, glm::vec3(0.0f, 1.0f, 0.0f)) * frontLightDirection);
+                }
+            }
+            // The engine sounds are started and stopped only here: outside the driving scenes they are silent
+            else {
+                if(ma_sound_is_playing(&idleEngineSound)) {
+                    ma_sound_stop(&idleEngineSound);
+                }
+                if(ma_sound_is_playing(&accelerationEngineSound)) {
+                    ma_sound_stop(&accelerationEngineSound);
+                }
+            }
 
-                // For each NPC car
-                for(int i = 0; i < CARS; i++) {
-                    uboCars[i].mvpMat = Prj * mView * mWorldCars[i];    // Set the MVP matrix
-                    uboCars[i].mMat = mWorldCars[i];    // Set the model matrix
-                    uboCars[i].nMat = glm::inverse(glm::transpose(uboCars[i].mMat));    // Set the normal matrix
-                    DScars[i].map(currentImage, &uboCars[i], sizeof(uboCars[i]), 0);    // Map the UBO to the descriptor set
-                    // Hash map used to take the 5 positions of the street lights closest to the NPC car element
-                    std::unordered_map<float, glm::vec3> distancesToPositions;
-                    std::vector<float> distances;   // Vector used to store the distances
-                    float dist = 0.0f;  // Distance variable
-                    // For each street light:
-                    for(int j = 0; j < STREET_LIGHT_COUNT; j++) {
-                        // Calculate the distance between the NPC car element and the street light
-                        dist = glm::distance(streetlightPos[j], glm::vec3(mWorldCars[i][3]));
-                        // Store the distance in the vector
-                        distances.push_back(dist);
-                        // Store the position of the street light in the hash map using the distance as key
-                        distancesToPositions[dist] = streetlightPos[j];
+            // If we have to open the door
+            if(openDoor) {
+                // Update the angle of the door
+                openingDoorAngle += DOOR_SPEED * dt;
+                // Check when the door reaches the maximum angle
+                if (openingDoorAngle >= 69.0f) {
+                    openDoor = false;
+                    // Start the animation to close the door
+                    closeDoor = true;
+                }
+            }
+            // If we have to close the door ==> same as open but reverted
+            else {
+                openingDoorAngle -= DOOR_SPEED * dt;
+                if (openingDoorAngle <= 0.0f) {
+                    openingDoorAngle = 0.0f;
+                    closeDoor = false;
+                }
+            }
+
+            // Pickups and collisions only in the game scenes
+            if(scene < 0) {
+                return;
+            }
+
+            // If we don't have already selected a random person to pick up
+            if(!pickupPointSelected) {
+                // Randomly select an index for the pickup person point [0 - 4]
+                random_index = rand() % PICKUP_COUNT;
+                // Get the position of the randomly selected person
+                pickupPoint = pickupPoints[random_index];
+                // Ste the flag to true to not choose another one
+                pickupPointSelected = true;
+            }
+
+            // If the taxi is close to the person to pick up, we have not already picked up the person and we are not moving
+            if(glm::distance(glm::vec3(pickupPoint), taxiPos) < MIN_DISTANCE_TO_PICKUP && !pickedPassenger && speed == 0.0f) {
+                // Set the value of the selected person to false ==> from the next draw commands, we will not draw it
+                drawPeople[random_index] = false;
+                // Set the flag to true and start the animation to open the door
+                pickedPassenger = true;
+                openDoor = true;
+                // Reset the sound of the pickup and start it
+                if(ma_sound_at_end(&pickupSound)) ma_sound_seek_to_pcm_frame(&pickupSound, 0);
+                ma_sound_start(&pickupSound);
+                // Get the position of the point where to take the person
+                dropoffPoint = dropoffPoints[random_index];
+                // Save the time of the pickup to calculate the income at the end
+                pickupTime = time(NULL);
+            }
+
+            // If the taxi is close to the dropoff point, we have already picked up the person and we are not moving
+            if(glm::distance(glm::vec3(dropoffPoint), taxiPos) < MIN_DISTANCE_TO_PICKUP && pickedPassenger && speed == 0.0f) {
+                // Set the value of the selected person to true ==> from the next draw commands, we will draw it
+                drawPeople[random_index] = true;
+                // Set the flag to false and start the animation to close the door
+                pickedPassenger = false;
+                openDoor = true;
+                // Set to false the flag to say that we have to choose a new person to pick up
+                pickupPointSelected = false;
+                // Reset the sound of the money and start it
+                if(ma_sound_at_end(&moneySound)) ma_sound_seek_to_pcm_frame(&moneySound, 0);
+                ma_sound_start(&moneySound);
+                // Calculate the income of the drive: time passed multiplied by the rate that is higher if it is night
+                money += (time(NULL) - pickupTime) * (night ? 7.9f : 4.1f);
+                // If we are not in the endless game mode, the frames show the end game scene
+                if(!endlessGameMode) {
+                    gameOver = true;
+                }
+                else {
+                    totDrivesCompleted++;   // Else if we are in the endless game mode, increment the number of drives completed
+                }
+            }
+
+            // Center of the taxi's collision sphere (used for collision with NPCs), in front of the taxi's origin
+            glm::vec3 taxiCollisionSphereCenter = taxiPos + glm::vec3(sin(steeringAng), 0.0f, cos(steeringAng));
+            // Counter to check on how many cars the taxi is colliding
+            collisionCounter = 0;
+            // For each NPC car
+            for(int i = 0; i < CARS; i++) {
+                // Check if the two collision spheres are colliding (dist < 2 * radius), the center of the NPC car's one is its position
+                if(glm::distance(taxiCollisionSphereCenter, carPositions[i]) < 2 * COLLISION_SPHERE_RADIUS) {
+                    // If so, increment the collision counter
+                    collisionCounter++;
+                }
+            }
+            // If the taxi is colliding with at least one NPC car and it wasn't already colliding
+            if(collisionCounter > 0 && !inCollisionZone) {
+                inCollisionZone = true; // Set the flag to true
+                money -= 100.0f;    // Decrement the money by 100
+                // Reset the sound of the clacson and start it
+                if(ma_sound_at_end(&clacsonSound)) ma_sound_seek_to_pcm_frame(&clacsonSound, 0);
+                ma_sound_start(&clacsonSound);
+            }
+            // Else if the taxi is not colliding with any NPC car and it was colliding
+            else if(collisionCounter == 0 && inCollisionZone) {
+                inCollisionZone = false;    // Set the flag to false
+            }
+        }
+
+        // State of the game after the last step, as published to the frames
+        SimulationState captureState() {
+            SimulationState state;
+            state.taxiPos = taxiPos;
+            state.steeringAng = steeringAng;
+            state.wheelRoll = wheelRoll;
+            state.wheelAndSteerAng = wheelAndSteerAng;
+            state.openingDoorAngle = openingDoorAngle;
+            state.frontLightDirection = frontLightDirection;
+            for(int i = 0; i < CARS; i++) {
+                state.carPositions[i] = carPositions[i];
+                state.steeringAngCars[i] = steeringAngCars[i];
+            }
+            state.cTime = cTime;
+            state.pickedPassenger = pickedPassenger;
+            state.pickupPoint = pickupPoint;
+            state.dropoffPoint = dropoffPoint;
+            std::copy(drawPeople, drawPeople + PICKUP_COUNT, state.drawPeople);
+            state.money = money;
+            state.gameOver = gameOver;
+            return state;
+        }
+
+        // State at the fraction t between two steps: positions, angles and clock are interpolated, the rest is the one of the last step
+        static SimulationState interpolateStates(const SimulationState &a, const SimulationState &b, float t) {
+            SimulationState state = b;
+            state.taxiPos = glm::mix(a.taxiPos, b.taxiPos, t);
+            state.steeringAng = glm::mix(a.steeringAng, b.steeringAng, t);
+            state.wheelRoll = glm::mix(a.wheelRoll, b.wheelRoll, t);
+            state.wheelAndSteerAng = glm::mix(a.wheelAndSteerAng, b.wheelAndSteerAng, t);
+            state.openingDoorAngle = glm::mix(a.openingDoorAngle, b.openingDoorAngle, t);
+            // The front lights turn with the taxi
+            state.frontLightDirection = glm::rotate(glm::mat4(1.0f), state.steeringAng - a.steeringAng, glm::vec3(0.0f, 1.0f, 0.0f)) * a.frontLightDirection;
+            for(int i = 0; i < CARS; i++) {
+                state.carPositions[i] = glm::mix(a.carPositions[i], b.carPositions[i], t);
+                // Shortest turn between the two angles (they are kept between -π and π)
+                float turn = b.steeringAngCars[i] - a.steeringAngCars[i];
+                turn -= 2.0f * M_PI * std::round(turn / (2.0f * M_PI));
+                state.steeringAngCars[i] = a.steeringAngCars[i] + turn * t;
+            }
+            // The clock can wrap around between the two steps
+            float elapsed = b.cTime - a.cTime;
+            elapsed += (elapsed < 0.0f) ? DAY_LENGTH : 0.0f;
+            state.cTime = fmod(a.cTime + elapsed * t, DAY_LENGTH);
+            return state;
+        }
+
+        // Bind the scene pipeline with its two sets and the geometry buffer (each bucket is a separate secondary command buffer)
+        void bindScene(VkCommandBuffer commandBuffer, int currentImage) {
+            Pscene.bind(commandBuffer);
+            Gscene.bind(commandBuffer);
+            // Bind the Global Descriptor Set in the set = 1 (GUBO and light clusters)
+            DSglobal.bind(commandBuffer, Pscene, 1, currentImage);
+            // Bind the scene Descriptor Set in the set = 0 (objects, texture array, instance ids and materials)
+            DSscene.bind(commandBuffer, Pscene, 0, currentImage);
+        }
+
+        // Helper function to compute the static UBO of the instances that never move (city and people)
+        void initStaticUniforms(SceneInstance SI[], UniformBufferObject data[], int count) {
+            for(int k = 0; k < count; k++) {
+                data[k].mMat = SI[k].mMat;   // Set the model matrix
+                data[k].nMat = SI[k].nMat;   // Set the normal matrix
+            }
+        }
+
+        // Build the grid of light clusters on the bounding box (XZ plane) of the city
+        void initLightClusters() {
+            // Square clusters, the grid covers the largest side of the city
+            float clusterSize = std::max(cityMax.x - cityMin.x, cityMax.y - cityMin.y) / CLUSTER_GRID;
+            lightClusters.gridOrigin = glm::vec4(cityMin.x, cityMin.y, clusterSize, 0.0f);
+            lightClusters.gridSize = glm::uvec4(CLUSTER_GRID, CLUSTER_GRID, 0, 0);
+
+            for(int i = 0; i < STREET_LIGHT_COUNT; i++) {
+                // Street lights: yellow SPOTLIGHTS towards the terrain
+                ClusterLight &light = streetLights[i];
+                light.posRange = glm::vec4(streetlightPos[i], 30.0f);
+                light.colorIntensity = glm::vec4(glm::vec3(streetLightCol), 10.0f);
+                light.direction = glm::vec4(glm::vec3(streetLightDirection), 1.0f);
+                light.cosines = streetLightCosines;
+                streetLightRects[i] = clusterRect(light.posRange);
+            }
+        }
+
+        // Rectangle of clusters (min X, min Z, max X, max Z) touched by the range of a light
+        glm::ivec4 clusterRect(const glm::vec4 &posRange) {
+            glm::vec2 rectMin = (glm::vec2(posRange.x, posRange.z) - posRange.w - glm::vec2(lightClusters.gridOrigin)) / lightClusters.gridOrigin.z;
+            glm::vec2 rectMax = (glm::vec2(posRange.x, posRange.z) + posRange.w - glm::vec2(lightClusters.gridOrigin)) / lightClusters.gridOrigin.z;
+            return glm::ivec4(glm::clamp(glm::ivec2(glm::floor(rectMin)), 0, CLUSTER_GRID - 1),
+                              glm::clamp(glm::ivec2(glm::floor(rectMax)), 0, CLUSTER_GRID - 1));
+        }
+
+        // Collect the active lights of the frame and bin them in the clusters touched by their range
+        // Taxi lights are used from the medium graphics settings, street lights in the high ones, both only at night
+        // Returns the number of light indices written
+        int updateLightClusters(const glm::vec4 taxiLightPos[], const glm::vec4 &frontLightDirection) {
+            // Rectangle of clusters touched by the range of each light
+            glm::ivec4 rects[MAX_CLUSTER_LIGHTS];
+            int lightCount = 0;
+            if(isNight && graphicsSettings >= 1) {
+                for(int i = 0; i < TAXI_LIGHT_COUNT; i++) {
+                    ClusterLight &light = lightClusters.lights[lightCount];
+                    if(i < 2) {
+                        // Rear lights: red POINT LIGHTS
+                        light.posRange = glm::vec4(glm::vec3(taxiLightPos[i]), 6.0f);
+                        light.colorIntensity = glm::vec4(glm::vec3(rearLightColor), 1.0f);
+                        light.direction = glm::vec4(0.0f);
+                        light.cosines = glm::vec4(0.0f);
                     }
-                    // Sort the distances vector in ascending order
-                    std::sort(distances.begin(), distances.end());
-                    // Set in the "Local" GUBO the positions of the 5 closest street lights using the distances as keys
-                    for(int j = 0; j < MAX_STREET_LIGHTS; j++) {
-                        guboCars[i].streetLightPos[j] = glm::vec4(distancesToPositions[distances[j]], 1.0f);
+                    else {
+                        // Front lights: yellow SPOTLIGHTS
+                        light.posRange = glm::vec4(glm::vec3(taxiLightPos[i]), 25.0f);
+                        light.colorIntensity = glm::vec4(glm::vec3(frontLightColor), 3.0f);
+                        light.direction = glm::vec4(glm::vec3(frontLightDirection), 1.0f);
+                        light.cosines = frontLightCosines;
                     }
-                    // Set the gamma and metallic values
-                    guboCars[i].gammaAndMetallic = glm::vec4(128.0f, 1.0f, 0.0f, 0.0f);
-                    // Map the "Local" GUBO to the descriptor set
-                    DScars[i].map(currentImage, &guboCars[i], sizeof(guboCars[i]), 2);
+                    rects[lightCount++] = clusterRect(light.posRange);
+                }
+            }
+            if(isNight && graphicsSettings >= 2) {
+                // Street lights are copied with the clusters computed at load
+                for(int i = 0; i < STREET_LIGHT_COUNT && lightCount < MAX_CLUSTER_LIGHTS; i++) {
+                    lightClusters.lights[lightCount] = streetLights[i];
+                    rects[lightCount++] = streetLightRects[i];
                 }
+            }
 
-                glm::vec4 carCollisionSphereCenter = glm::vec4(0.0f);
-                // Counter to check on how many cars the taxi is colliding
-                collisionCounter = 0;
-                // For each NPC car
-                for(int i = 0; i < CARS; i++) {
-                    // Set the center of the collision sphere for the NPC car as the center of the car model
-                    carCollisionSphereCenter = mWorldCars[i][3];
-                    // Check if the two collision spheres are colliding (dist < 2 * radius)
-                    if(glm::distance(glm::vec3(taxiCollisionSphereCenter), glm::vec3(carCollisionSphereCenter)) < 2 * COLLISION_SPHERE_RADIUS) {
-                        // If so, increment the collision counter
-                        collisionCounter++;
-                    }
+            int indexCount = 0;
+            for(int l = 0; l < lightCount; l++) {
+                int clustersTouched = (rects[l].z - rects[l].x + 1) * (rects[l].w - rects[l].y + 1);
+                if(indexCount + clustersTouched > MAX_CLUSTER_INDICES) {
+                    lightCount = l;     // The remaining lights do not fit in the clusters
+                    break;
                 }
-                // If the taxi is colliding with at least one NPC car and it wasn't already colliding
-                if(collisionCounter > 0 && !inCollisionZone) {
-                    inCollisionZone = true; // Set the flag to true
-                    money -= 100.0f;    // Decrement the money by 100
-                    // Reset the sound of the clacson and start it
-                    if(ma_sound_at_end(&clacsonSound)) ma_sound_seek_to_pcm_frame(&clacsonSound, 0);
-                    ma_sound_start(&clacsonSound);
+                indexCount += clustersTouched;
+            }
+            lightClusters.gridSize.z = lightCount;
+
+            // Counting sort of the light references by cluster
+            for(int c = 0; c < CLUSTER_GRID * CLUSTER_GRID; c++) {
+                lightClusters.clusters[c][1] = 0;
+            }
+            for(int l = 0; l < lightCount; l++) {
+                for(int z = rects[l].y; z <= rects[l].w; z++) {
+                    for(int x = rects[l].x; x <= rects[l].z; x++) {
+                        lightClusters.clusters[z * CLUSTER_GRID + x][1]++;
+                    }
                 }
-                // Else if the taxi is not colliding with any NPC car and it was colliding
-                else if(collisionCounter == 0 && inCollisionZone) {
-                    inCollisionZone = false;    // Set the flag to false
+            }
+            uint32_t first = 0;
+            for(int c = 0; c < CLUSTER_GRID * CLUSTER_GRID; c++) {
+                lightClusters.clusters[c][0] = first;
+                first += lightClusters.clusters[c][1];
+                lightClusters.clusters[c][1] = 0;   // Counted again while filling
+            }
+            for(int l = 0; l < lightCount; l++) {
+                for(int z = rects[l].y; z <= rects[l].w; z++) {
+                    for(int x = rects[l].x; x <= rects[l].z; x++) {
+                        uint32_t (&cluster)[2] = lightClusters.clusters[z * CLUSTER_GRID + x];
+                        lightClusters.lightIndices[cluster[0] + cluster[1]++] = l;
+                    }
                 }
+            }
+            return indexCount;
+        }
 
-                // Set the sky box's center and scale (translate and scale the sky box sphere)
-                glm::mat4 scaleMat = glm::translate(glm::mat4(1.0f), sphereCenter) * glm::scale(glm::mat4(1.0f), sphereScale);
-                uboSkyBox.mvpMat = Prj * mView * (scaleMat);    // Set the MVP matrix
-                uboSkyBox.mMat = scaleMat;  // Set the model matrix
-                uboSkyBox.nMat = glm::inverse(glm::transpose(uboSkyBox.mMat));  // Set the normal matrix
-                DSskyBox.map(currentImage, &uboSkyBox, sizeof(uboSkyBox), 0);   // Map the UBO to the descriptor set
-                guboSkyBox.directLightPos = glm::vec4(sunPos, 1.0f);    // Set the sun position
-                DSskyBox.map(currentImage, &guboSkyBox, sizeof(guboSkyBox), 2);  // Map the "Local" GUBO to the descriptor set
+        // Group the instances by the mesh they share
+        // The ids of each group are contiguous, so a group is drawn with a single instanced draw call
+        // The ids (firstObject + index of the instance) are appended to ids, after the ones of the previous groups
+        void buildInstanceBatches(Model M[], int count, uint32_t firstObject, std::vector<uint32_t> &ids, std::vector<InstanceBatch> &batches) {
+            std::vector<Model *> meshes;    // Distinct meshes, in order of first appearance
+            std::unordered_map<Model *, std::vector<uint32_t>> instancesOfMesh;
+            for(int k = 0; k < count; k++) {
+                Model *mesh = M[k].mesh();
+                if(instancesOfMesh.find(mesh) == instancesOfMesh.end()) {
+                    meshes.push_back(mesh);
+                }
+                instancesOfMesh[mesh].push_back(k);
+            }
 
-                // Read the "people.json" file to configure and update the people's mesh instances
-                nlohmann::json js3;
-                std::ifstream ifs3("models/people.json");
-                if (!ifs3.is_open()) {
-                    std::cout << "[ ERROR ]: Scene file not found!" << std::endl;
-                    exit(1);
+            batches.clear();
+            for(Model *mesh : meshes) {
+                const std::vector<uint32_t> &instances = instancesOfMesh[mesh];
+                batches.push_back({mesh, (uint32_t)ids.size(), (uint32_t)instances.size()});
+                for(uint32_t k : instances) {
+                    ids.push_back(firstObject + k);
                 }
-                try{
-                    json j3;
-                    ifs3>>j3;
-
-                    float TMj[16];
-
-                    for(int k = 0; k < PEOPLE; k++) {
-                        nlohmann::json TMjson = j3["instances"][k]["transform"];
-
-                        for(int l = 0; l < 16; l++) {TMj[l] = TMjson[l];}
-
-                        // Set the world matrix for the people element
-                        mWorld=glm::mat4(TMj[0],TMj[4],TMj[8],TMj[12],TMj[1],TMj[5],TMj[9],TMj[13],TMj[2],TMj[6],TMj[10],TMj[14],TMj[3],TMj[7],TMj[11],TMj[15]);
-                        uboPeople[k].mMat = mWorld; // Set the model matrix
-                        uboPeople[k].nMat = glm::inverse(glm::transpose(uboPeople[k].mMat));    // Set the normal matrix
-                        uboPeople[k].mvpMat = Prj * mView * mWorld;  // Set the MVP matrix
-                        DSpeople[k].map(currentImage, &uboPeople[k], sizeof(uboPeople[k]), 0);  // Map the UBO to the descriptor set
-                        // Hash map used to take the 5 positions of the street lights closest to the people element
-                        std::unordered_map<float, glm::vec3> distancesToPositions;
-                        std::vector<float> distances;   // Vector used to store the distances
-                        float dist = 0.0f;  // Distance variable
-                        // For each street light:
-                        for(int i = 0; i < STREET_LIGHT_COUNT; i++) {
-                            // Calculate the distance between the people element and the street light
-                            dist = glm::distance(streetlightPos[i], glm::vec3(mWorld[3]));
-                            // Store the distance in the vector
-                            distances.push_back(dist);
-                            // Store the position of the street light in the hash map using the distance as key
-                            distancesToPositions[dist] = streetlightPos[i];
+            }
+        }
+
+        // Write the indirect draw commands of each batch, one for each level of detail of its mesh, with their visible instances
+        // Culled instances and the ones set to false in drawFlags are left out: the visible ids of each command are
+        // written contiguously from idCount, so the number of draw commands never changes
+        // visible, lod and drawFlags are indexed by the instance within its group (id - firstObject)
+        void writeInstanceBatches(const std::vector<InstanceBatch> &batches, uint32_t firstObject,
+                                  const std::vector<bool> &visible, const std::vector<uint32_t> &lod,
+                                  const bool *drawFlags,
+                                  uint32_t &idCount, VkDrawIndexedIndirectCommand commands[]) {
+            for(const InstanceBatch &batch : batches) {
+                for(uint32_t l = 0; l < batch.mesh->lods(); l++) {
+                    uint32_t firstInstance = idCount;
+                    for(uint32_t i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; i++) {
+                        uint32_t k = sceneInstanceIds[i] - firstObject;
+                        bool hidden = !visible[k] || lod[k] != l;
+                        if(!hidden && drawFlags != nullptr) {
+                            hidden = !drawFlags[k];
                         }
-                        // Sort the distances vector in ascending order
-                        std::sort(distances.begin(), distances.end());
-                        // Set in the "Local" GUBO the positions of the 5 closest street lights using the distances as keys
-                        for(int i = 0; i < MAX_STREET_LIGHTS; i++) {
-                            guboPeople[k].streetLightPos[i] = glm::vec4(distancesToPositions[distances[i]], 1.0f);
+                        if(!hidden) {
+                            visibleInstanceIds[idCount++] = sceneInstanceIds[i];
                         }
-                        // Set the gamma and metallic values
-                        guboPeople[k].gammaAndMetallic = glm::vec4(128.0f, 0.1f, 0.0f, 0.0f);
-                        // Map the "Local" GUBO to the descriptor set
-                        DSpeople[k].map(currentImage, &guboPeople[k], sizeof(guboPeople[k]), 2);
                     }
+                    *commands = batch.mesh->drawCommand(idCount - firstInstance, firstInstance, l);
+                    trianglesDrawn += (uint64_t)commands->indexCount / 3 * commands->instanceCount;
+                    commands++;
+                }
+            }
+        }
+
+        // Write the visible instance ids and the indirect draw commands of this frame
+        // (the command buffers are not recorded again when the visibility changes)
+        void writeDrawCommands(int currentImage, const bool drawPeople[]) {
+            // Only the people that can be picked up are ever hidden
+            bool peopleDrawn[PEOPLE];
+            std::fill(peopleDrawn, peopleDrawn + PEOPLE, true);
+            for(int i = 0; i < PICKUP_COUNT; i++) {
+                peopleDrawn[pickupPeople[i]] = drawPeople[i];
+            }
+            uint32_t idCount = 0;
+            trianglesDrawn = 0;
+            VkDrawIndexedIndirectCommand *commands = drawCommands;
+            writeInstanceBatches(cityBatches, 0, cityVisible, cityLod, nullptr, idCount, commands);
+            commands += cityDraws;
+            writeInstanceBatches(peopleBatches, MESH, peopleVisible, peopleLod, peopleDrawn, idCount, commands);
+            commands += peopleDraws;
+            // The NPCs follow the taxi in the dynamic objects: firstInstance selects the object
+            for(int i = 0; i < CARS; i++) {
+                commands[i] = Mcars[i].drawCommand(carsVisible[i] ? 1 : 0, TAXI_ELEMENTS + i, carsLod[i]);
+                trianglesDrawn += (uint64_t)commands[i].indexCount / 3 * commands[i].instanceCount;
+            }
+
+            DSscene.map(currentImage, visibleInstanceIds, idCount * sizeof(uint32_t), 2);
+            ICscene.map(currentImage, drawCommands, cityDraws + peopleDraws + CARS);
+        }
+
+        // Helper function to build the matrices of a scene instance from its json transform
+        void initSceneInstance(SceneInstance &SI, const nlohmann::json &TMjson) {
+            float TMj[16];
+            for(int l = 0; l < 16; l++) {
+                TMj[l] = TMjson[l];
+            }
+            // The json stores the matrix by rows, while glm builds it by columns
+            SI.mMat = glm::mat4(TMj[0],TMj[4],TMj[8],TMj[12],TMj[1],TMj[5],TMj[9],TMj[13],TMj[2],TMj[6],TMj[10],TMj[14],TMj[3],TMj[7],TMj[11],TMj[15]);
+            SI.nMat = glm::inverse(glm::transpose(SI.mMat));    // Normal matrix
+        }
+
+        // Helper function to build the bounds of a scene instance from its matrix and its (loaded) model
+        void initSceneBounds(SceneInstance &SI, Model &M) {
+            // Bounding box of the model in local space (computed at load time, shared with the other instances of the same mesh)
+            glm::vec3 localMin = M.bounds().aabbMin, localMax = M.bounds().aabbMax;
+
+            // Transform the eight corners of the box to get the bounding box in world space
+            SI.bbMin = glm::vec3(std::numeric_limits<float>::max());
+            SI.bbMax = glm::vec3(-std::numeric_limits<float>::max());
+            for(int c = 0; c < 8; c++) {
+                glm::vec3 corner = glm::vec3((c & 1) ? localMax.x : localMin.x,
+                                            (c & 2) ? localMax.y : localMin.y,
+                                            (c & 4) ? localMax.z : localMin.z);
+                glm::vec3 worldCorner = glm::vec3(SI.mMat * glm::vec4(corner, 1.0f));
+                SI.bbMin = glm::min(SI.bbMin, worldCorner);
+                SI.bbMax = glm::max(SI.bbMax, worldCorner);
+            }
+            // Bounding sphere of the model moved and scaled to world space
+            SI.center = glm::vec3(SI.mMat * glm::vec4(M.bounds().center, 1.0f));
+            SI.radius = M.bounds().radius * std::max(glm::length(glm::vec3(SI.mMat[0])),
+                                                     std::max(glm::length(glm::vec3(SI.mMat[1])), glm::length(glm::vec3(SI.mMat[2]))));
+        }
+
+        // Level of detail of an object from the projected size of its bounding sphere
+        // Starting from the current level, the object moves to a finer or coarser one only when its size is
+        // beyond the threshold by LOD_HYSTERESIS, so it does not switch back and forth near a threshold
+        uint32_t selectLod(uint32_t current, uint32_t levels, const glm::vec3 &center, float radius,
+                           const glm::vec3 &eye, float projScale) {
+            float distance = glm::distance(center, eye);
+            float size = (distance > radius) ? radius * projScale / distance : std::numeric_limits<float>::max();
+            uint32_t lod = std::min(current, levels - 1);
+            while(lod > 0 && size > lodScreenSizes[lod - 1] * (1.0f + LOD_HYSTERESIS)) {
+                lod--;
+            }
+            while(lod + 1 < levels && size < lodScreenSizes[lod] * (1.0f - LOD_HYSTERESIS)) {
+                lod++;
+            }
+            return lod;
+        }
 
+        // Frustum culling of the objects that can leave the view (city, people and NPC cars), and their levels of detail
+        // The result is applied to the indirect draw commands of this frame
+        // projScale converts the radius over the distance of an object into its size in half screen heights
+        void cullScene(const glm::mat4 &ViewPrj, const glm::vec3 &eye, float projScale) {
+            Frustum frustum;
+            frustum.fromMatrix(ViewPrj);
+            objectsDrawn = 0;
+            objectsCulled = 0;
+
+            // Static instances: sphere test first, then the tighter box test
+            for(int k = 0; k < MESH; k++) {
+                bool visible = frustum.sphereVisible(cityInstances[k].center, cityInstances[k].radius) &&
+                               frustum.boxVisible(cityInstances[k].bbMin, cityInstances[k].bbMax);
+                cityVisible[k] = visible;
+                (visible ? objectsDrawn : objectsCulled)++;
+                if(visible) {
+                    cityLod[k] = selectLod(cityLod[k], Mcity[k].lods(), cityInstances[k].center, cityInstances[k].radius, eye, projScale);
                 }
-                catch (const nlohmann::json::exception& e) {
-                    std::cout << "[ EXCEPTION ]: " << e.what() << std::endl;
-                    exit(1);
+            }
+            for(int k = 0; k < PEOPLE; k++) {
+                bool visible = frustum.sphereVisible(peopleInstances[k].center, peopleInstances[k].radius) &&
+                               frustum.boxVisible(peopleInstances[k].bbMin, peopleInstances[k].bbMax);
+                peopleVisible[k] = visible;
+                (visible ? objectsDrawn : objectsCulled)++;
+                if(visible) {
+                    peopleLod[k] = selectLod(peopleLod[k], Mpeople[k].lods(), peopleInstances[k].center, peopleInstances[k].radius, eye, projScale);
                 }
+            }
 
-                // Set the position of the arrow (if we have already picked up the person, set the dropoff point)
-                // The arrow will move up and down with a sinusoidal movement
-                glm::vec3 arrowPosition = (!pickedPassenger ? glm::vec3(pickupPoint.x, ARROW_Y_OFFSET + (glm::cos(cTime) / 4.0f), pickupPoint.z) : glm::vec3(dropoffPoint.x, ARROW_Y_OFFSET + (glm::cos(cTime) / 4.0f), dropoffPoint.z));
-                // Set the world matrix for the arrow translating it to the position and rotating it around the Z axis
-                // The arrow will also rotate around the Y axis with a turn factor of 10 degrees per tick
-                glm::mat4 mWorldArrow = glm::rotate(glm::rotate(glm::translate(glm::mat4(1.0), arrowPosition), glm::radians(180.0f), glm::vec3(0.0f, 0.0f, 1.0f)), glm::radians(10.0f) * cTime, glm::vec3(0.0f, 1.0f, 0.0f));
-                uboArrow.mvpMat = Prj * mView * mWorldArrow;    // Set the MVP matrix
-                uboArrow.mMat = mWorldArrow;    // Set the model matrix
-                uboArrow.nMat = glm::inverse(glm::transpose(uboArrow.mMat));    // Set the normal matrix
-                DSarrow.map(currentImage, &uboArrow, sizeof(uboArrow), 0);  // Map the UBO to the descriptor set
-                // Set the position of the arrow's pickup point (if we have already picked up the person, set the dropoff point)
-                guboArrow.pickupPointPos = (!pickedPassenger ? glm::vec4(pickupPoint.x, PICKUP_POINT_Y_OFFSET, pickupPoint.z, pickupPoint.w) : glm::vec4(dropoffPoint.x, PICKUP_POINT_Y_OFFSET, dropoffPoint.z, dropoffPoint.w));
-                guboArrow.pickupPointCol = pickupPointColor;    // Set the pickup point color (POINTLIGHT)
-                guboArrow.eyePos = glm::vec4(camPos, 1.0f); // Set the camera position
-                guboArrow.gammaAndMetallic = glm::vec4(128.0f, 1.0f, 0.0f, 0.0f);   // Set the gamma and metallic values
-                DSarrow.map(currentImage, &guboArrow, sizeof(guboArrow), 1);    // Map the GUBO to the descriptor set
+            // Moving cars: the local bounding sphere is moved with the world matrix of the car
+            for(int i = 0; i < CARS; i++) {
+                const BoundingVolume &bounds = Mcars[i].bounds();
+                glm::vec3 center = glm::vec3(mWorldCars[i] * glm::vec4(bounds.center, 1.0f));
+                float scale = std::max(glm::length(glm::vec3(mWorldCars[i][0])),
+                                       std::max(glm::length(glm::vec3(mWorldCars[i][1])), glm::length(glm::vec3(mWorldCars[i][2]))));
+                bool visible = frustum.sphereVisible(center, bounds.radius * scale);
+                carsVisible[i] = visible;
+                (visible ? objectsDrawn : objectsCulled)++;
+                if(visible) {
+                    carsLod[i] = selectLod(carsLod[i], Mcars[i].lods(), center, bounds.radius * scale, eye, projScale);
+                }
+            }
+        }
+
+        // Advance the benchmark by one frame: each run starts with the warm-up frames, then BENCHMARK_FRAMES are measured
+        // The graphics settings change with the run, the benchmark ends after the last run
+        void benchmarkStep() {
+            if(benchmarkFrame == BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES) {
+                benchmarkRun++;
+                benchmarkFrame = 0;
+            }
+            if(benchmarkRun == BENCHMARK_RUNS) {
+                headlessDone = true;    // This last frame is not measured
+                return;
+            }
+            graphicsSettings = benchmarkRun / 2;
+            // The frame times are appended when the frame is submitted: this frame is the next one
+            if(benchmarkFrame == BENCHMARK_WARMUP_FRAMES) {
+                benchmarkFirstFrames.push_back(frameCpuTimes.size());
+            }
+            benchmarkFrame++;
+        }
+
+        // Camera of the benchmark at the fraction u of its path: a lap around the center of the city that
+        // goes down to the street level twice and up over the roofs twice, looking ahead and towards the center
+        void benchmarkCamera(float u, glm::vec3 &eye, glm::mat4 &view) {
+            float angle = 2.0f * M_PI * u;
+            // The path circles the center of the city, its size follows the largest side of the city
+            float halfSide = 0.5f * std::max(cityMax.x - cityMin.x, cityMax.y - cityMin.y);
+            glm::vec3 center = glm::vec3(0.5f * (cityMin.x + cityMax.x), 0.0f, 0.5f * (cityMin.y + cityMax.y));
+            float radius = 0.4f * halfSide;
+            float height = 2.0f + 9.0f * (1.0f - cos(2.0f * angle));
+            eye = center + glm::vec3(radius * cos(angle), height, radius * sin(angle));
+            glm::vec3 ahead = glm::vec3(-sin(angle), 0.0f, cos(angle));
+            glm::vec3 target = glm::mix(eye + 10.0f * ahead, center, 0.25f);
+            view = glm::lookAt(eye, target, glm::vec3(0, 1, 0));
+        }
 
+        // Write the frame times of the benchmark runs as JSON: mean, percentiles and maximum in ms of the CPU time
+        // (from the start of the frame to its submission) and of the GPU time (timestamps of the command buffer)
+        void writeBenchmarkReport() {
+            std::ofstream file(benchmarkFile);
+            if(!file.is_open()) {
+                std::cout << "[ ERROR ]: Cannot write " << benchmarkFile << std::endl;
+                return;
             }
+            const char* settingNames[GRAPHICS_SETTINGS_COUNT] = {"low", "medium", "high"};
+            file << std::fixed << std::setprecision(3);
+            file << "{\n  \"device\": \"" << benchmarkDevice << "\",\n";
+            file << "  \"width\": " << windowWidth << ",\n  \"height\": " << windowHeight << ",\n";
+            file << "  \"frames\": " << BENCHMARK_FRAMES << ",\n  \"runs\": [\n";
+            for(size_t run = 0; run < benchmarkFirstFrames.size(); run++) {
+                size_t first = benchmarkFirstFrames[run];
+                std::vector<float> cpuTimes(frameCpuTimes.begin() + first, frameCpuTimes.begin() + first + BENCHMARK_FRAMES);
+                std::vector<float> gpuTimes;
+                for(size_t i = first; i < first + BENCHMARK_FRAMES; i++) {
+                    if(frameGpuTimes[i] >= 0.0f) {
+                        gpuTimes.push_back(frameGpuTimes[i]);
+                    }
+                }
+                file << "    {\"graphicsSettings\": \"" << settingNames[run / 2] << "\", \"night\": " << (run % 2 ? "true" : "false");
+                file << ",\n     \"cpu\": ";
+                writeFrameTimes(file, cpuTimes);
+                file << ",\n     \"gpu\": ";
+                writeFrameTimes(file, gpuTimes);
+                file << "}" << (run + 1 < benchmarkFirstFrames.size() ? "," : "") << "\n";
+            }
+            file << "  ]\n}\n";
+            std::cout << "[ STATS ]: Benchmark of " << benchmarkFirstFrames.size() << " runs written to " << benchmarkFile << std::endl;
+        }
+
+        // Frame times as a JSON object (null when there are none): percentiles by nearest rank
+        static void writeFrameTimes(std::ofstream &file, std::vector<float> times) {
+            if(times.empty()) {
+                file << "null";
+                return;
+            }
+            std::sort(times.begin(), times.end());
+            float mean = std::accumulate(times.begin(), times.end(), 0.0f) / times.size();
+            auto percentile = [&times](float p) {
+                return times[std::min(times.size() - 1, (size_t)std::ceil(p / 100.0f * times.size()) - 1)];
+            };
+            file << "{\"mean\": " << mean << ", \"p50\": " << percentile(50.0f) << ", \"p90\": " << percentile(90.0f)
+                 << ", \"p95\": " << percentile(95.0f) << ", \"p99\": " << percentile(99.0f) << ", \"max\": " << times.back() << "}";
+        }
+
+        void printApplicationStats() {
+            std::cout << "[ STATS ]: Frustum culling: " << objectsDrawn << " objects drawn, "
+                      << objectsCulled << " culled, " << trianglesDrawn << " triangles with the levels of detail" << std::endl;
         }
 
         // Helper function to check if a vector of points is inside a collision box
@@ -1638,6 +2179,26 @@ int main(int argc, char* argv[]) {
 
     Application app;    // Create the application object
 
+    // Optional command line flags: --stats prints some frame statistics, --bake writes the baked models and textures,
+    // --benchmark [file] renders the benchmark runs without window and writes their frame times to file (benchmark.json)
+    for(int i = 1; i < argc; i++) {
+        if(std::string(argv[i]) == "--stats") {
+            app.printStats = true;
+        }
+        // A baked binary copy of every model and a block-compressed DDS copy of every texture loaded from their source files
+        // are loaded instead of them from then on
+        if(std::string(argv[i]) == "--bake") {
+            app.bakeAssets = true;
+        }
+        // Headless benchmark: no window, no menu and no audio device (it also runs on a software Vulkan device)
+        if(std::string(argv[i]) == "--benchmark") {
+            app.headless = true;
+            if(i + 1 < argc && argv[i + 1][0] != '-') {
+                app.benchmarkFile = argv[++i];
+            }
+        }
+    }
+
     int choose = 0;
     int oldChoose = 0;
     int gameMode = 0;
@@ -1647,80 +2208,88 @@ int main(int argc, char* argv[]) {
     float musicVolume = 25.0f;
     float soundVolume = 100.0f;
     
-    std::ifstream f("files/logo.txt");  // Load the file with the logo for the CLI
-    if (f.is_open()) {
-        std::cout << f.rdbuf(); // Print the logo
-    }
-    // Print the main menu
-    do {
-        std::cout << "--------- MAIN MENU ---------\n" << std::endl;
-        std::cout << "1 - Start the game" << std::endl;
-        std::cout << "2 - Settings" << std::endl;
-        std::cout << "3 - Exit" << std::endl;
-        std::cout << "\nChoosing: ";
-        std::cin >> choose; // Get the user's choice
-        switch(choose) {
-            case 2: {   // If the user chooses the settings
-                oldChoose = choose; // Save the choice
-                // Print the settings menu
-                do {
-                    std::cout << std::fixed;
-                    std::cout << std::setprecision(2);
-                    std::cout << "\n--------- SETTINGS ---------\n" << std::endl;
-                    std::cout << "1 - Game mode:          " << "\t< " << gameModes[gameMode] << " >" << std::endl;
-                    std::cout << "2 - Graphics settings:  " << "\t< " << gSettings[graphicSetting]  << " > " << std::endl;
-                    std::cout << "3 - Music volume:       " << "\t< " << musicVolume << " >" << std::endl;
-                    std::cout << "4 - Sound and FX volume:" << "\t< " << soundVolume << " >" << std::endl;
-                    std::cout << "5 - Back" << std::endl;
-                    std::cout << "\nChoosing: ";
-                    std::cin >> choose; // Get the user's choice
-                    switch(choose) {
-                        case 1: {   // If the user chooses the game mode
-                            gameMode = (gameMode + 1) % GAMEMODE_COUNT; // Change the game mode from arcade to endless and vice versa
-                            break;
-                        }
-                        case 2: {   // If the user chooses the graphic settings
-                            graphicSetting = (graphicSetting + 1) % GRAPHICS_SETTINGS_COUNT;    // Change the graphic settings (low, medium, high)
-                            break;
-                        }
-                        case 3: {   // If the user chooses the music volume
-                            do {
-                                std::cout << "Enter the music volume [0.0 - 100.0]: ";
-                                std::cin >> musicVolume;    // Get the music volume
-                            } while(musicVolume < 0.0f || musicVolume > 100.0f);    
-                            break;
-                        }
-                        case 4: {   // If the user chooses the sound and FX volume
-                            do {
-                                std::cout << "Enter the sound and FX volume [0.0 - 100.0]: ";
-                                std::cin >> soundVolume;    // Get the sound and FX volume
-                            } while(soundVolume < 0.0f || soundVolume > 100.0f);
-                            break;
+    // The menu is skipped by the benchmark
+    if(!app.headless) {
+        std::ifstream f("files/logo.txt");  // Load the file with the logo for the CLI
+        if (f.is_open()) {
+            std::cout << f.rdbuf(); // Print the logo
+        }
+        // Print the main menu
+        do {
+            std::cout << "--------- MAIN MENU ---------\n" << std::endl;
+            std::cout << "1 - Start the game" << std::endl;
+            std::cout << "2 - Settings" << std::endl;
+            std::cout << "3 - Exit" << std::endl;
+            std::cout << "\nChoosing: ";
+            std::cin >> choose; // Get the user's choice
+            switch(choose) {
+                case 2: {   // If the user chooses the settings
+                    oldChoose = choose; // Save the choice
+                    // Print the settings menu
+                    do {
+                        std::cout << std::fixed;
+                        std::cout << std::setprecision(2);
+                        std::cout << "\n--------- SETTINGS ---------\n" << std::endl;
+                        std::cout << "1 - Game mode:          " << "\t< " << gameModes[gameMode] << " >" << std::endl;
+                        std::cout << "2 - Graphics settings:  " << "\t< " << gSettings[graphicSetting]  << " > " << std::endl;
+                        std::cout << "3 - Music volume:       " << "\t< " << musicVolume << " >" << std::endl;
+                        std::cout << "4 - Sound and FX volume:" << "\t< " << soundVolume << " >" << std::endl;
+                        std::cout << "5 - Back" << std::endl;
+                        std::cout << "\nChoosing: ";
+                        std::cin >> choose; // Get the user's choice
+                        switch(choose) {
+                            case 1: {   // If the user chooses the game mode
+                                gameMode = (gameMode + 1) % GAMEMODE_COUNT; // Change the game mode from arcade to endless and vice versa
+                                break;
+                            }
+                            case 2: {   // If the user chooses the graphic settings
+                                graphicSetting = (graphicSetting + 1) % GRAPHICS_SETTINGS_COUNT;    // Change the graphic settings (low, medium, high)
+                                break;
+                            }
+                            case 3: {   // If the user chooses the music volume
+                                do {
+                                    std::cout << "Enter the music volume [0.0 - 100.0]: ";
+                                    std::cin >> musicVolume;    // Get the music volume
+                                } while(musicVolume < 0.0f || musicVolume > 100.0f);    
+                                break;
+                            }
+                            case 4: {   // If the user chooses the sound and FX volume
+                                do {
+                                    std::cout << "Enter the sound and FX volume [0.0 - 100.0]: ";
+                                    std::cin >> soundVolume;    // Get the sound and FX volume
+                                } while(soundVolume < 0.0f || soundVolume > 100.0f);
+                                break;
+                            }
+                            case 5:
+                                break;
+                            default: 
+                                break;
                         }
-                        case 5:
-                            break;
-                        default: 
-                            break;
-                    }
-                } while(choose != 5);
-                choose = oldChoose; // Go back to the main menu
-                break;
-            }
-            case 3: {   // If the user chooses to exit
-                std::cout << "Closing the sofware..." << std::endl;
-                return EXIT_SUCCESS;
+                    } while(choose != 5);
+                    choose = oldChoose; // Go back to the main menu
+                    break;
+                }
+                case 3: {   // If the user chooses to exit
+                    std::cout << "Closing the sofware..." << std::endl;
+                    return EXIT_SUCCESS;
+                }
+                default:
+                    break;
             }
-            default:
-                break;
-        }
-    } while(choose == 2);   // If the user chooses the settings, go back to the main menu
+        } while(choose == 2);   // If the user chooses the settings, go back to the main menu
+    }
 
     app.graphicsSettings = graphicSetting;  // Set the graphic settings
     app.endlessGameMode = (gameMode == 1);  // Set the game mode (arcade or endless)
 
     std::cout << "[ LOADING ]: Loading sound resources:\t[                    ]" << std::endl;
     // Initialize the miniaudio engine (used for the sound)
-    ma_result result = ma_engine_init(NULL, &app.engine);
+    // The benchmark mixes the sounds without an output device, so it runs on machines without audio
+    ma_engine_config engineConfig = ma_engine_config_init();
+    engineConfig.noDevice = MA_TRUE;
+    engineConfig.channels = 2;
+    engineConfig.sampleRate = 48000;
+    ma_result result = ma_engine_init(app.headless ? &engineConfig : NULL, &app.engine);
     if(result != MA_SUCCESS) {
         throw std::runtime_error("[ ERROR ]: Failed to initialize miniaudio engine!");
     }
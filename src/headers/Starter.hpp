@@ -7,10 +7,15 @@
 #include <cstring>
 #include <optional>
 #include <set>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <queue>
 #include <cstdint>
 #include <algorithm>
 #include <fstream>
 #include <array>
+#include <limits>
 #include <cmath>
 #include <math.h>
 
@@ -23,6 +28,19 @@
 #include <glm/gtx/transform2.hpp>
 
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <filesystem>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
@@ -62,6 +80,8 @@
 
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
+// Offscreen images that replace the swapchain in headless mode
+const uint32_t HEADLESS_IMAGE_COUNT = 3;
 
 const std::vector<const char*> validationLayers = {
 	"VK_LAYER_KHRONOS_validation"
@@ -74,6 +94,8 @@ const std::vector<const char*> validationLayers = {
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	// Only set when the device has a family dedicated to copies
+	std::optional<uint32_t> transferFamily;
 
 	bool isComplete() {
 		return graphicsFamily.has_value() &&
@@ -177,6 +199,692 @@ std::vector<char> readFile(const std::string& filename) {
 	return buffer;
 }
 
+// Hardware accelerated AES-128 CBC decryption of the encoded models, chosen at run time:
+// VAES (two blocks per instruction), AES-NI, or the portable plusaes code on the other CPUs
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AES_HW_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AES_TARGET(t)
+#else
+#include <cpuid.h>
+#define AES_TARGET(t) __attribute__((target(t)))
+#endif
+#endif
+
+enum AesPath {AES_PORTABLE, AES_NI, AES_VAES};
+
+inline AesPath detectAesPath() {
+#ifdef AES_HW_X86
+	bool aes = false, osxsave = false, avx2 = false, vaes = false;
+	unsigned long long xcr0 = 0;
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuid(r, 1);
+	aes = (r[2] >> 25) & 1;
+	osxsave = (r[2] >> 27) & 1;
+	__cpuidex(r, 7, 0);
+	avx2 = (r[1] >> 5) & 1;
+	vaes = (r[2] >> 9) & 1;
+	if(osxsave) {
+		xcr0 = _xgetbv(0);
+	}
+#else
+	unsigned int a, b, c, d;
+	if(__get_cpuid(1, &a, &b, &c, &d)) {
+		aes = (c >> 25) & 1;
+		osxsave = (c >> 27) & 1;
+	}
+	if(__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+		avx2 = (b >> 5) & 1;
+		vaes = (c >> 9) & 1;
+	}
+	if(osxsave) {
+		unsigned int lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		xcr0 = ((unsigned long long)hi << 32) | lo;
+	}
+#endif
+	// 256 bit registers also need the OS to save the YMM state
+	if(aes && vaes && avx2 && (xcr0 & 6) == 6) {
+		return AES_VAES;
+	}
+	if(aes) {
+		return AES_NI;
+	}
+#endif
+	return AES_PORTABLE;
+}
+
+#ifdef AES_HW_X86
+AES_TARGET("sse2")
+inline __m128i aesExpandStep(__m128i key, __m128i assist) {
+	assist = _mm_shuffle_epi32(assist, 0xff);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, assist);
+}
+
+// Round keys of the equivalent inverse cipher (decryption order)
+AES_TARGET("aes,sse2")
+inline void aesDecryptionKeys128(const unsigned char key[16], __m128i dk[11]) {
+	__m128i ek[11];
+	ek[0] = _mm_loadu_si128((const __m128i *)key);
+	ek[1] = aesExpandStep(ek[0], _mm_aeskeygenassist_si128(ek[0], 0x01));
+	ek[2] = aesExpandStep(ek[1], _mm_aeskeygenassist_si128(ek[1], 0x02));
+	ek[3] = aesExpandStep(ek[2], _mm_aeskeygenassist_si128(ek[2], 0x04));
+	ek[4] = aesExpandStep(ek[3], _mm_aeskeygenassist_si128(ek[3], 0x08));
+	ek[5] = aesExpandStep(ek[4], _mm_aeskeygenassist_si128(ek[4], 0x10));
+	ek[6] = aesExpandStep(ek[5], _mm_aeskeygenassist_si128(ek[5], 0x20));
+	ek[7] = aesExpandStep(ek[6], _mm_aeskeygenassist_si128(ek[6], 0x40));
+	ek[8] = aesExpandStep(ek[7], _mm_aeskeygenassist_si128(ek[7], 0x80));
+	ek[9] = aesExpandStep(ek[8], _mm_aeskeygenassist_si128(ek[8], 0x1b));
+	ek[10] = aesExpandStep(ek[9], _mm_aeskeygenassist_si128(ek[9], 0x36));
+	dk[0] = ek[10];
+	for(int r = 1; r < 10; r++) {
+		dk[r] = _mm_aesimc_si128(ek[10 - r]);
+	}
+	dk[10] = ek[0];
+}
+
+// CBC decryption has no chain between the blocks: eight of them are kept in flight
+AES_TARGET("aes,sse2")
+inline void aesniDecryptCBC(const __m128i dk[11], const unsigned char iv[16],
+							const unsigned char *in, unsigned char *out, size_t blocks) {
+	__m128i prev = _mm_loadu_si128((const __m128i *)iv);
+	size_t i = 0;
+	for(; i + 8 <= blocks; i += 8) {
+		__m128i c[8], x[8];
+		for(int j = 0; j < 8; j++) {
+			c[j] = _mm_loadu_si128((const __m128i *)(in + 16 * (i + j)));
+			x[j] = _mm_xor_si128(c[j], dk[0]);
+		}
+		for(int r = 1; r < 10; r++) {
+			for(int j = 0; j < 8; j++) {
+				x[j] = _mm_aesdec_si128(x[j], dk[r]);
+			}
+		}
+		for(int j = 0; j < 8; j++) {
+			x[j] = _mm_xor_si128(_mm_aesdeclast_si128(x[j], dk[10]), (j == 0) ? prev : c[j - 1]);
+			_mm_storeu_si128((__m128i *)(out + 16 * (i + j)), x[j]);
+		}
+		prev = c[7];
+	}
+	for(; i < blocks; i++) {
+		__m128i c = _mm_loadu_si128((const __m128i *)(in + 16 * i));
+		__m128i x = _mm_xor_si128(c, dk[0]);
+		for(int r = 1; r < 10; r++) {
+			x = _mm_aesdec_si128(x, dk[r]);
+		}
+		_mm_storeu_si128((__m128i *)(out + 16 * i), _mm_xor_si128(_mm_aesdeclast_si128(x, dk[10]), prev));
+		prev = c;
+	}
+}
+
+// Same as aesniDecryptCBC, with two blocks in each 256 bit register
+AES_TARGET("vaes,avx2,aes")
+inline void vaesDecryptCBC(const __m128i dk[11], const unsigned char iv[16],
+						   const unsigned char *in, unsigned char *out, size_t blocks) {
+	__m256i k[11];
+	for(int r = 0; r < 11; r++) {
+		k[r] = _mm256_broadcastsi128_si256(dk[r]);
+	}
+	size_t i = 0;
+	for(; i + 8 <= blocks; i += 8) {
+		__m256i c[4], p[4], x[4];
+		for(int j = 0; j < 4; j++) {
+			c[j] = _mm256_loadu_si256((const __m256i *)(in + 16 * (i + 2 * j)));
+			x[j] = _mm256_xor_si256(c[j], k[0]);
+		}
+		// Previous ciphertext of each block (the IV for the first one)
+		p[0] = (i == 0) ? _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)iv)),
+												  _mm256_castsi256_si128(c[0]), 1)
+						: _mm256_loadu_si256((const __m256i *)(in + 16 * i - 16));
+		for(int j = 1; j < 4; j++) {
+			p[j] = _mm256_loadu_si256((const __m256i *)(in + 16 * (i + 2 * j) - 16));
+		}
+		for(int r = 1; r < 10; r++) {
+			for(int j = 0; j < 4; j++) {
+				x[j] = _mm256_aesdec_epi128(x[j], k[r]);
+			}
+		}
+		for(int j = 0; j < 4; j++) {
+			x[j] = _mm256_xor_si256(_mm256_aesdeclast_epi128(x[j], k[10]), p[j]);
+			_mm256_storeu_si256((__m256i *)(out + 16 * (i + 2 * j)), x[j]);
+		}
+	}
+	// The last blocks, chained to the ciphertext before them
+	if(i < blocks) {
+		aesniDecryptCBC(dk, (i == 0) ? iv : in + 16 * i - 16, in + 16 * i, out + 16 * i, blocks - i);
+	}
+}
+#endif
+
+// Decrypts size bytes (a multiple of 16) in out, which must not overlap in
+// The PKCS#7 padding of the last block is cleared, as plusaes::decrypt_cbc does
+inline void decryptCBC(const unsigned char *in, size_t size, const std::vector<unsigned char> &key,
+					   const unsigned char iv[16], unsigned char *out) {
+	static const AesPath path = detectAesPath();
+#ifdef AES_HW_X86
+	if(path != AES_PORTABLE && key.size() == 16 && size > 0 && size % 16 == 0) {
+		__m128i dk[11];
+		aesDecryptionKeys128(key.data(), dk);
+		if(path == AES_VAES) {
+			vaesDecryptCBC(dk, iv, in, out, size / 16);
+		} else {
+			aesniDecryptCBC(dk, iv, in, out, size / 16);
+		}
+		unsigned char pad = out[size - 1];
+		if(pad >= 1 && pad <= 16) {
+			memset(out + size - pad, 0, pad);
+		}
+		return;
+	}
+#endif
+	unsigned long paddedSize = 0;
+	plusaes::decrypt_cbc(in, size, key.data(), key.size(), (const unsigned char (*)[16])iv,
+						 out, size, &paddedSize);
+}
+
+// FNV-1a of the whole content, used as the name of the decoded files in the cache
+inline uint64_t contentHash(const std::vector<char> &data) {
+	uint64_t hash = 14695981039346656037ull;
+	for(char c : data) {
+		hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+	}
+	return hash ^ data.size();
+}
+
+// Block compression of the baked textures, in blocks of 4x4 texels: BC1 stores two RGB565
+// endpoints and a 2 bit index per texel, BC3 adds two 8 bit alpha endpoints and 3 bit indices.
+// The encoder takes the endpoints from the inset bounding box of the block colors
+enum TextureCompression {BC_NONE, BC1, BC3, BC7};
+
+inline size_t compressedImageSize(int width, int height, TextureCompression compression) {
+	size_t blocks = static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4);
+	return blocks * (compression == BC1 ? 8 : 16);
+}
+
+inline uint16_t packRGB565(const unsigned char c[4]) {
+	return static_cast<uint16_t>(((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3));
+}
+
+inline void unpackRGB565(uint16_t v, unsigned char c[4]) {
+	int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = static_cast<unsigned char>((r << 3) | (r >> 2));
+	c[1] = static_cast<unsigned char>((g << 2) | (g >> 4));
+	c[2] = static_cast<unsigned char>((b << 3) | (b >> 2));
+	c[3] = 255;
+}
+
+// texels: 16 RGBA values, row by row
+inline void encodeBC1Block(const unsigned char texels[64], unsigned char out[8]) {
+	unsigned char minColor[4] = {255, 255, 255, 255}, maxColor[4] = {0, 0, 0, 255};
+	for(int i = 0; i < 16; i++) {
+		for(int c = 0; c < 3; c++) {
+			minColor[c] = std::min(minColor[c], texels[i * 4 + c]);
+			maxColor[c] = std::max(maxColor[c], texels[i * 4 + c]);
+		}
+	}
+	for(int c = 0; c < 3; c++) {
+		int inset = (maxColor[c] - minColor[c]) >> 4;
+		minColor[c] += inset;
+		maxColor[c] -= inset;
+	}
+	
+	// color0 >= color1 since every channel of maxColor is >= the one of minColor:
+	// with color0 > color1 the block uses four colors, if they are equal all the indices are 0
+	uint16_t color0 = packRGB565(maxColor), color1 = packRGB565(minColor);
+	unsigned char palette[4][4];
+	unpackRGB565(color0, palette[0]);
+	unpackRGB565(color1, palette[1]);
+	for(int c = 0; c < 3; c++) {
+		palette[2][c] = static_cast<unsigned char>((2 * palette[0][c] + palette[1][c]) / 3);
+		palette[3][c] = static_cast<unsigned char>((palette[0][c] + 2 * palette[1][c]) / 3);
+	}
+	
+	uint32_t indices = 0;
+	if(color0 > color1) {
+		for(int i = 0; i < 16; i++) {
+			int best = 0, bestDistance = std::numeric_limits<int>::max();
+			for(int p = 0; p < 4; p++) {
+				int distance = 0;
+				for(int c = 0; c < 3; c++) {
+					int d = texels[i * 4 + c] - palette[p][c];
+					distance += d * d;
+				}
+				if(distance < bestDistance) {
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices |= static_cast<uint32_t>(best) << (2 * i);
+		}
+	}
+	out[0] = color0 & 0xff;
+	out[1] = color0 >> 8;
+	out[2] = color1 & 0xff;
+	out[3] = color1 >> 8;
+	for(int b = 0; b < 4; b++) {
+		out[4 + b] = (indices >> (8 * b)) & 0xff;
+	}
+}
+
+inline void encodeBC3AlphaBlock(const unsigned char texels[64], unsigned char out[8]) {
+	unsigned char minAlpha = 255, maxAlpha = 0;
+	for(int i = 0; i < 16; i++) {
+		minAlpha = std::min(minAlpha, texels[i * 4 + 3]);
+		maxAlpha = std::max(maxAlpha, texels[i * 4 + 3]);
+	}
+	out[0] = maxAlpha;
+	out[1] = minAlpha;
+	
+	// alpha0 > alpha1: eight alpha values interpolated between the endpoints
+	uint64_t indices = 0;
+	if(maxAlpha > minAlpha) {
+		int palette[8] = {maxAlpha, minAlpha};
+		for(int p = 2; p < 8; p++) {
+			palette[p] = ((8 - p) * maxAlpha + (p - 1) * minAlpha) / 7;
+		}
+		for(int i = 0; i < 16; i++) {
+			int best = 0, bestDistance = std::numeric_limits<int>::max();
+			for(int p = 0; p < 8; p++) {
+				int distance = std::abs(texels[i * 4 + 3] - palette[p]);
+				if(distance < bestDistance) {
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices |= static_cast<uint64_t>(best) << (3 * i);
+		}
+	}
+	for(int b = 0; b < 6; b++) {
+		out[2 + b] = (indices >> (8 * b)) & 0xff;
+	}
+}
+
+// In BC3 the color block always uses four colors, whatever the order of the endpoints
+inline void decodeBC1Block(const unsigned char in[8], unsigned char texels[64], bool fourColors) {
+	uint16_t color0 = in[0] | (in[1] << 8), color1 = in[2] | (in[3] << 8);
+	unsigned char palette[4][4];
+	unpackRGB565(color0, palette[0]);
+	unpackRGB565(color1, palette[1]);
+	for(int c = 0; c < 3; c++) {
+		if(fourColors || color0 > color1) {
+			palette[2][c] = static_cast<unsigned char>((2 * palette[0][c] + palette[1][c]) / 3);
+			palette[3][c] = static_cast<unsigned char>((palette[0][c] + 2 * palette[1][c]) / 3);
+		} else {
+			palette[2][c] = static_cast<unsigned char>((palette[0][c] + palette[1][c]) / 2);
+			palette[3][c] = 0;
+		}
+	}
+	palette[2][3] = 255;
+	palette[3][3] = (fourColors || color0 > color1) ? 255 : 0;
+	
+	uint32_t indices = in[4] | (in[5] << 8) | (in[6] << 16) | (static_cast<uint32_t>(in[7]) << 24);
+	for(int i = 0; i < 16; i++) {
+		memcpy(texels + i * 4, palette[(indices >> (2 * i)) & 3], 4);
+	}
+}
+
+inline void decodeBC3AlphaBlock(const unsigned char in[8], unsigned char texels[64]) {
+	int palette[8] = {in[0], in[1]};
+	if(in[0] > in[1]) {
+		for(int p = 2; p < 8; p++) {
+			palette[p] = ((8 - p) * in[0] + (p - 1) * in[1]) / 7;
+		}
+	} else {
+		for(int p = 2; p < 6; p++) {
+			palette[p] = ((6 - p) * in[0] + (p - 1) * in[1]) / 5;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	uint64_t indices = 0;
+	for(int b = 0; b < 6; b++) {
+		indices |= static_cast<uint64_t>(in[2 + b]) << (8 * b);
+	}
+	for(int i = 0; i < 16; i++) {
+		texels[i * 4 + 3] = static_cast<unsigned char>(palette[(indices >> (3 * i)) & 7]);
+	}
+}
+
+// The blocks on the right and bottom edges repeat the last column and row of the image
+inline void compressImageBC(const unsigned char *rgba, int width, int height,
+							TextureCompression compression, unsigned char *out) {
+	unsigned char texels[64];
+	for(int by = 0; by < height; by += 4) {
+		for(int bx = 0; bx < width; bx += 4) {
+			for(int i = 0; i < 16; i++) {
+				int x = std::min(bx + (i & 3), width - 1);
+				int y = std::min(by + (i >> 2), height - 1);
+				memcpy(texels + i * 4, rgba + (static_cast<size_t>(y) * width + x) * 4, 4);
+			}
+			if(compression == BC3) {
+				encodeBC3AlphaBlock(texels, out);
+				out += 8;
+			}
+			encodeBC1Block(texels, out);
+			out += 8;
+		}
+	}
+}
+
+inline void decompressImageBC(const unsigned char *in, int width, int height,
+							  TextureCompression compression, unsigned char *rgba) {
+	unsigned char texels[64];
+	for(int by = 0; by < height; by += 4) {
+		for(int bx = 0; bx < width; bx += 4) {
+			if(compression == BC3) {
+				decodeBC1Block(in + 8, texels, true);
+				decodeBC3AlphaBlock(in, texels);
+				in += 16;
+			} else {
+				decodeBC1Block(in, texels, false);
+				in += 8;
+			}
+			for(int i = 0; i < 16; i++) {
+				int x = bx + (i & 3), y = by + (i >> 2);
+				if(x < width && y < height) {
+					memcpy(rgba + (static_cast<size_t>(y) * width + x) * 4, texels + i * 4, 4);
+				}
+			}
+		}
+	}
+}
+
+// Next level of the mip chain with a 2x2 box filter (averaged in linear space for sRGB images)
+inline void downsampleRGBA(const unsigned char *src, int width, int height, bool srgb,
+						   std::vector<unsigned char> &dst) {
+	static float toLinear[256];
+	static bool tableReady = []() {
+		for(int v = 0; v < 256; v++) {
+			float c = v / 255.0f;
+			toLinear[v] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return true;
+	}();
+	(void)tableReady;
+	
+	int dstWidth = std::max(1, width / 2), dstHeight = std::max(1, height / 2);
+	dst.resize(static_cast<size_t>(dstWidth) * dstHeight * 4);
+	for(int y = 0; y < dstHeight; y++) {
+		for(int x = 0; x < dstWidth; x++) {
+			int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+			int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+			const unsigned char *p[4] = {src + (static_cast<size_t>(y0) * width + x0) * 4,
+										 src + (static_cast<size_t>(y0) * width + x1) * 4,
+										 src + (static_cast<size_t>(y1) * width + x0) * 4,
+										 src + (static_cast<size_t>(y1) * width + x1) * 4};
+			unsigned char *d = &dst[(static_cast<size_t>(y) * dstWidth + x) * 4];
+			for(int c = 0; c < 4; c++) {
+				if(srgb && c < 3) {
+					float l = (toLinear[p[0][c]] + toLinear[p[1][c]] + toLinear[p[2][c]] + toLinear[p[3][c]]) / 4.0f;
+					float s = (l <= 0.0031308f) ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+					d[c] = static_cast<unsigned char>(std::min(255.0f, s * 255.0f + 0.5f));
+				} else {
+					d[c] = static_cast<unsigned char>((p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4);
+				}
+			}
+		}
+	}
+}
+
+// Levels of detail by quadric error edge collapse (Garland and Heckbert, "Surface Simplification
+// Using Quadric Error Metrics", 1997). Vertices only collapse onto other existing vertices, so every
+// level indexes the same vertex data. Vertices sharing a position (UV seams) collapse together,
+// then each corner takes the copy at its new position whose UV is the closest to its original one.
+// levelTriangles holds the target triangle count of each level after the first (the full mesh):
+// a level is dropped when the mesh cannot be reduced enough to get to it
+inline std::vector<std::vector<uint32_t>> simplifyMesh(const std::vector<glm::vec3> &positions,
+													   const std::vector<glm::vec2> &uvs,
+													   const std::vector<uint32_t> &indices,
+													   const std::vector<size_t> &levelTriangles) {
+	std::vector<std::vector<uint32_t>> levels;
+	size_t vertexCount = positions.size();
+	size_t triangleCount = indices.size() / 3;
+	
+	// Vertices with the same position form a group: the collapses move whole groups
+	std::vector<uint32_t> sorted(vertexCount);
+	for(uint32_t v = 0; v < vertexCount; v++) {
+		sorted[v] = v;
+	}
+	std::sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) {
+		const glm::vec3 &pa = positions[a], &pb = positions[b];
+		return (pa.x != pb.x) ? pa.x < pb.x : ((pa.y != pb.y) ? pa.y < pb.y : pa.z < pb.z);
+	});
+	std::vector<uint32_t> groupOf(vertexCount);
+	std::vector<std::vector<uint32_t>> groupVertices;
+	for(size_t i = 0; i < vertexCount; i++) {
+		if(i == 0 || positions[sorted[i]] != positions[sorted[i - 1]]) {
+			groupVertices.emplace_back();
+		}
+		groupOf[sorted[i]] = static_cast<uint32_t>(groupVertices.size() - 1);
+		groupVertices.back().push_back(sorted[i]);
+	}
+	size_t groupCount = groupVertices.size();
+	std::vector<glm::vec3> groupPosition(groupCount);
+	for(size_t g = 0; g < groupCount; g++) {
+		groupPosition[g] = positions[groupVertices[g][0]];
+	}
+	
+	// Triangles on the groups: the ones already degenerate are dropped
+	std::vector<std::array<uint32_t, 3>> corners(triangleCount);
+	std::vector<bool> triangleAlive(triangleCount);
+	size_t liveTriangles = 0;
+	for(size_t t = 0; t < triangleCount; t++) {
+		for(int k = 0; k < 3; k++) {
+			corners[t][k] = groupOf[indices[3 * t + k]];
+		}
+		triangleAlive[t] = corners[t][0] != corners[t][1] && corners[t][1] != corners[t][2] &&
+						   corners[t][2] != corners[t][0];
+		liveTriangles += triangleAlive[t];
+	}
+	
+	// Quadrics (upper half of the symmetric 4x4 matrix) of the planes of the triangles, weighted by area.
+	// Open edges add a plane perpendicular to their triangle, so that the borders keep their shape
+	typedef std::array<double, 10> Quadric;
+	std::vector<Quadric> quadric(groupCount, Quadric{});
+	auto addPlane = [&](Quadric &q, glm::dvec3 n, double d, double weight) {
+		double p[4] = {n.x, n.y, n.z, d};
+		int e = 0;
+		for(int r = 0; r < 4; r++) {
+			for(int c = r; c < 4; c++) {
+				q[e++] += weight * p[r] * p[c];
+			}
+		}
+	};
+	auto error = [](const Quadric &q, const glm::vec3 &v) {
+		double p[4] = {v.x, v.y, v.z, 1.0};
+		double sum = 0.0;
+		int e = 0;
+		for(int r = 0; r < 4; r++) {
+			for(int c = r; c < 4; c++) {
+				sum += (r == c ? 1.0 : 2.0) * q[e++] * p[r] * p[c];
+			}
+		}
+		return sum;
+	};
+	
+	std::vector<std::vector<uint32_t>> groupTriangles(groupCount);
+	std::unordered_map<uint64_t, int> edgeUses;
+	auto edgeKey = [](uint32_t a, uint32_t b) {
+		return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+	};
+	for(size_t t = 0; t < triangleCount; t++) {
+		if(!triangleAlive[t]) {
+			continue;
+		}
+		glm::dvec3 p0 = groupPosition[corners[t][0]], p1 = groupPosition[corners[t][1]], p2 = groupPosition[corners[t][2]];
+		glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+		double length = glm::length(n);
+		if(length > 0.0) {
+			n /= length;
+			for(int k = 0; k < 3; k++) {
+				addPlane(quadric[corners[t][k]], n, -glm::dot(n, p0), 0.5 * length);
+			}
+		}
+		for(int k = 0; k < 3; k++) {
+			groupTriangles[corners[t][k]].push_back(static_cast<uint32_t>(t));
+			edgeUses[edgeKey(corners[t][k], corners[t][(k + 1) % 3])]++;
+		}
+	}
+	for(size_t t = 0; t < triangleCount; t++) {
+		if(!triangleAlive[t]) {
+			continue;
+		}
+		glm::dvec3 p0 = groupPosition[corners[t][0]], p1 = groupPosition[corners[t][1]], p2 = groupPosition[corners[t][2]];
+		glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+		for(int k = 0; k < 3; k++) {
+			uint32_t a = corners[t][k], b = corners[t][(k + 1) % 3];
+			if(edgeUses[edgeKey(a, b)] != 1) {
+				continue;
+			}
+			glm::dvec3 pa = groupPosition[a], pb = groupPosition[b];
+			glm::dvec3 side = glm::cross(pb - pa, n);
+			double length = glm::length(side);
+			if(length > 0.0) {
+				side /= length;
+				double weight = 10.0 * glm::dot(pb - pa, pb - pa);
+				addPlane(quadric[a], side, -glm::dot(side, pa), weight);
+				addPlane(quadric[b], side, -glm::dot(side, pa), weight);
+			}
+		}
+	}
+	
+	// Candidate collapses, cheapest first: an entry is stale when one of its groups changed since
+	struct Collapse {
+		double cost;
+		uint32_t from, to;
+		uint32_t fromStamp, toStamp;
+		bool operator>(const Collapse &other) const { return cost > other.cost; }
+	};
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> candidates;
+	std::vector<uint32_t> stamp(groupCount, 0);
+	std::vector<bool> groupAlive(groupCount, true);
+	auto pushEdge = [&](uint32_t a, uint32_t b) {
+		Quadric q;
+		for(int e = 0; e < 10; e++) {
+			q[e] = quadric[a][e] + quadric[b][e];
+		}
+		double toB = error(q, groupPosition[b]), toA = error(q, groupPosition[a]);
+		if(toB <= toA) {
+			candidates.push({toB, a, b, stamp[a], stamp[b]});
+		} else {
+			candidates.push({toA, b, a, stamp[b], stamp[a]});
+		}
+	};
+	for(auto &edge : edgeUses) {
+		pushEdge(static_cast<uint32_t>(edge.first >> 32), static_cast<uint32_t>(edge.first & 0xffffffffu));
+	}
+	
+	// Corners of the surviving triangles, on the vertex of their group closest in UV to the original one
+	auto snapshot = [&]() {
+		std::vector<uint32_t> level;
+		for(size_t t = 0; t < triangleCount; t++) {
+			if(!triangleAlive[t]) {
+				continue;
+			}
+			for(int k = 0; k < 3; k++) {
+				uint32_t original = indices[3 * t + k];
+				uint32_t best = original;
+				if(groupOf[original] != corners[t][k]) {
+					float bestDistance = std::numeric_limits<float>::max();
+					for(uint32_t v : groupVertices[corners[t][k]]) {
+						glm::vec2 d = uvs[v] - uvs[original];
+						if(glm::dot(d, d) < bestDistance) {
+							bestDistance = glm::dot(d, d);
+							best = v;
+						}
+					}
+				}
+				level.push_back(best);
+			}
+		}
+		return level;
+	};
+	
+	size_t previousTriangles = liveTriangles;
+	for(size_t target : levelTriangles) {
+		while(liveTriangles > target && !candidates.empty()) {
+			Collapse c = candidates.top();
+			candidates.pop();
+			if(!groupAlive[c.from] || !groupAlive[c.to] ||
+			   stamp[c.from] != c.fromStamp || stamp[c.to] != c.toStamp) {
+				continue;
+			}
+			
+			// No triangle around the moved group may flip or collapse to a line
+			bool valid = true;
+			for(uint32_t t : groupTriangles[c.from]) {
+				if(!triangleAlive[t] ||
+				   corners[t][0] == c.to || corners[t][1] == c.to || corners[t][2] == c.to) {
+					continue;
+				}
+				glm::vec3 p[3], q[3];
+				for(int k = 0; k < 3; k++) {
+					p[k] = groupPosition[corners[t][k]];
+					q[k] = (corners[t][k] == c.from) ? groupPosition[c.to] : p[k];
+				}
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				if(glm::dot(before, after) <= 0.0f ||
+				   glm::dot(after, after) < 1e-6f * glm::dot(before, before)) {
+					valid = false;
+					break;
+				}
+			}
+			if(!valid) {
+				continue;
+			}
+			
+			groupAlive[c.from] = false;
+			stamp[c.to]++;
+			for(int e = 0; e < 10; e++) {
+				quadric[c.to][e] += quadric[c.from][e];
+			}
+			for(uint32_t t : groupTriangles[c.from]) {
+				if(!triangleAlive[t]) {
+					continue;
+				}
+				if(corners[t][0] == c.to || corners[t][1] == c.to || corners[t][2] == c.to) {
+					triangleAlive[t] = false;
+					liveTriangles--;
+					continue;
+				}
+				for(int k = 0; k < 3; k++) {
+					if(corners[t][k] == c.from) {
+						corners[t][k] = c.to;
+					}
+				}
+				groupTriangles[c.to].push_back(t);
+			}
+			groupTriangles[c.from].clear();
+			
+			std::vector<uint32_t> &around = groupTriangles[c.to];
+			around.erase(std::remove_if(around.begin(), around.end(),
+										[&](uint32_t t) { return !triangleAlive[t]; }), around.end());
+			for(uint32_t t : around) {
+				for(int k = 0; k < 3; k++) {
+					if(corners[t][k] != c.to) {
+						pushEdge(c.to, corners[t][k]);
+					}
+				}
+			}
+		}
+		
+		// Not worth a level if the mesh could not be reduced much further
+		if(liveTriangles == 0 || liveTriangles > previousTriangles * 4 / 5) {
+			break;
+		}
+		levels.push_back(snapshot());
+		previousTriangles = liveTriangles;
+	}
+	return levels;
+}
+
 class BaseProject;
 
 struct VertexBindingDescriptorElement {
@@ -221,26 +929,187 @@ struct VertexDescriptor {
 						getAttributeDescriptions();
 };
 
-enum ModelType {OBJ, GLTF, MGCG};
+enum ModelType {OBJ, GLTF, MGCG, BAKED};
+
+// Baked mesh file: this header, the vertices already in the layout of the VertexDescriptor, then the indices
+// (of all the levels of detail). A bake is used only if version, vertex layout and source file
+// (size and write time) still match
+#define BAKED_MESH_VERSION 2
+
+// Maximum number of levels of detail of a mesh (the full mesh included): each level has
+// about a quarter of the triangles of the previous one
+#define MODEL_LODS 4
+
+struct BakedMeshHeader {
+	char magic[4];	// "MBAK"
+	uint32_t version;
+	uint32_t stride;
+	uint32_t layoutHash;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	uint64_t vertexBytes;
+	uint64_t indexCount;
+	float bounds[10];	// aabbMin, aabbMax, center, radius
+	uint32_t lodCount;
+	uint32_t lodOffsets[MODEL_LODS + 1];
+};
+
+// Baked texture file (texture file + ".dds"): DDS with the whole mip chain, in BC1 (opaque images)
+// or BC3 (with alpha). BC7 files written by other tools are read through the DX10 header
+#define DDS_MAGIC 0x20534444u	// "DDS "
+#define DDS_FOURCC_DXT1 0x31545844u
+#define DDS_FOURCC_DXT5 0x35545844u
+#define DDS_FOURCC_DX10 0x30315844u
+
+struct DDSPixelFormat {
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourCC;
+	uint32_t rgbBitCount;
+	uint32_t bitMasks[4];
+};
+
+struct DDSHeader {
+	uint32_t magic;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t linearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	uint32_t reserved1[11];
+	DDSPixelFormat pixelFormat;
+	uint32_t caps[4];
+	uint32_t reserved2;
+};
+
+struct DDSHeaderDX10 {
+	uint32_t dxgiFormat;	// 71-72 BC1, 77-78 BC3, 98-99 BC7
+	uint32_t resourceDimension;
+	uint32_t miscFlag;
+	uint32_t arraySize;
+	uint32_t miscFlags2;
+};
+
+// Read only view of a whole file: memory mapped where available, read in memory otherwise
+struct MappedFile {
+	const unsigned char *data = nullptr;
+	size_t size = 0;
+	std::vector<unsigned char> buffer;
+	
+	bool open(const std::string &file);
+	void close();
+	~MappedFile() { close(); }
+};
+
+struct MemoryAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	int block = -1;
+	unsigned char *mapped = nullptr;
+};
+
+// Bounds of a mesh in local space
+struct BoundingVolume {
+	glm::vec3 aabbMin = glm::vec3(0.0f);
+	glm::vec3 aabbMax = glm::vec3(0.0f);
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+};
+
+// View frustum planes, stored four at a time (one plane per lane) so that
+// each test evaluates four planes with a single vec4 expression
+struct Frustum {
+	glm::vec4 a[2], b[2], c[2], d[2];
+	
+	void fromMatrix(const glm::mat4 &ViewPrj);
+	bool sphereVisible(glm::vec3 center, float radius) const;
+	bool boxVisible(glm::vec3 bbMin, glm::vec3 bbMax) const;
+};
+
+class Model;
+
+// Meshes packed in one vertex buffer and one index buffer: the models added before create()
+// are bound once and drawn with their own firstIndex and vertexOffset
+struct GeometryBuffer {
+	BaseProject *BP;
+	VertexDescriptor *VD;
+	
+	VkBuffer vertexBuffer;
+	MemoryAllocation vertexBufferMemory;
+	VkBuffer indexBuffer;
+	MemoryAllocation indexBufferMemory;
+	
+	std::vector<Model *> meshes;
+	VkDeviceSize vertexBytes;
+	uint32_t indexCount;
+	bool created;
+	
+	void init(BaseProject *bp, VertexDescriptor *vd);
+	void add(Model *M);
+	void create();
+	void bind(VkCommandBuffer commandBuffer);
+	void cleanup();
+};
 
 class Model {
+	friend struct GeometryBuffer;
 	BaseProject *BP;
 	
 	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
+	MemoryAllocation vertexBufferMemory;
 	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
+	MemoryAllocation indexBufferMemory;
 	VertexDescriptor *VD;
+	
+	// Model that owns the mesh data and the buffers (this one, unless loaded from the cache)
+	Model *source;
+	int users;
+	BoundingVolume localBounds;
+	void computeBounds();
+	
+	// Geometry buffer holding the mesh (nullptr if the mesh has its own buffers)
+	GeometryBuffer *geometry;
+	uint32_t geometryFirstIndex;
+	int32_t geometryVertexOffset;
+	
+	// Levels of detail requested, and the range of each one in indices (empty: only the full mesh)
+	int lodLevels;
+	std::vector<uint32_t> lodOffsets;
 
 	public:
 	std::vector<unsigned char> vertices{};
 	std::vector<uint32_t> indices{};
+	const std::vector<unsigned char> &vertexData() { return source->vertices; }
+	uint32_t lods() { return source->lodOffsets.empty() ? 1 : static_cast<uint32_t>(source->lodOffsets.size() - 1); }
+	uint32_t indexCount(uint32_t lod = 0) {
+		return source->lodOffsets.empty() ? static_cast<uint32_t>(source->indices.size()) :
+				source->lodOffsets[lod + 1] - source->lodOffsets[lod];
+	}
+	Model *mesh() { return source; }
+	const BoundingVolume &bounds() { return source->localBounds; }
+	uint32_t firstIndex(uint32_t lod = 0) {
+		return source->geometryFirstIndex + (source->lodOffsets.empty() ? 0 : source->lodOffsets[lod]);
+	}
+	int32_t vertexOffset() { return source->geometryVertexOffset; }
+	VkDrawIndexedIndirectCommand drawCommand(uint32_t instanceCount, uint32_t firstInstance, uint32_t lod = 0);
+	void generateLods(std::string file);
 	void loadModelOBJ(std::string file);
 	void loadModelGLTF(std::string file, bool encoded);
+	bool loadModelBaked(std::string file, const std::string &sourceFile);
+	void saveModelBaked(std::string file, const std::string &sourceFile);
+	uint32_t vertexLayoutHash();
 	void createIndexBuffer();
 	void createVertexBuffer();
+	void optimizeVertexCache();
+	float ACMR(int cacheSize);
 
-	void init(BaseProject *bp, VertexDescriptor *VD, std::string file, ModelType MT);
+	void init(BaseProject *bp, VertexDescriptor *VD, std::string file, ModelType MT,
+			  GeometryBuffer *geometry = nullptr, int lodLevels = 1);
+	void loadMeshData(std::string file, ModelType MT);
+	void createBuffers(GeometryBuffer *geometry);
 	void initMesh(BaseProject *bp, VertexDescriptor *VD);
 	void cleanup();
   	void bind(VkCommandBuffer commandBuffer);
@@ -250,13 +1119,25 @@ struct Texture {
 	BaseProject *BP;
 	uint32_t mipLevels;
 	VkImage textureImage;
-	VkDeviceMemory textureImageMemory;
+	MemoryAllocation textureImageMemory;
 	VkImageView textureImageView;
 	VkSampler textureSampler;
 	int imgs;
 	static const int maxImgs = 6;
 	
-	void createTextureImage(std::string files[], VkFormat Fmt);
+	// Decoded images, kept until the Vulkan image is created
+	stbi_uc *pixels[maxImgs];
+	int texWidth, texHeight;
+	// Mip chain read from a baked texture: block compressed, or RGBA8 if decoded on the CPU
+	TextureCompression compression = BC_NONE;
+	std::vector<unsigned char> mipData;
+	std::vector<VkDeviceSize> mipOffsets;
+	
+	void loadTextureImages(std::vector<std::string> files, VkFormat Fmt);
+	bool loadTextureBaked(std::string file, const std::string &sourceFile);
+	void saveTextureBaked(std::string file, bool srgb);
+	VkFormat imageFormat(VkFormat Fmt);
+	void createTextureImage(VkFormat Fmt);
 	void createTextureImageView(VkFormat Fmt);
 	void createTextureSampler(VkFilter magFilter,
 							 VkFilter minFilter,
@@ -277,6 +1158,7 @@ struct DescriptorSetLayoutBinding {
 	uint32_t binding;
 	VkDescriptorType type;
 	VkShaderStageFlags flags;
+	uint32_t count = 1;
 };
 
 
@@ -303,37 +1185,45 @@ struct Pipeline {
  	bool transp;
 	
 	VertexDescriptor *VD;
+	
+	uint32_t pushConstantSize;
   	
   	void init(BaseProject *bp, VertexDescriptor *vd,
 			  const std::string& VertShader, const std::string& FragShader,
   			  std::vector<DescriptorSetLayout *> D);
   	void setAdvancedFeatures(VkCompareOp _compareOp, VkPolygonMode _polyModel,
  						VkCullModeFlagBits _CM, bool _transp);
+  	void setPushConstants(uint32_t size);
   	void create();
   	void destroy();
   	void bind(VkCommandBuffer commandBuffer);
+  	void push(VkCommandBuffer commandBuffer, const void *data);
   	
-  	VkShaderModule createShaderModule(const std::vector<char>& code);
 	void cleanup();
 };
 
-enum DescriptorSetElementType {UNIFORM, TEXTURE};
+enum DescriptorSetElementType {UNIFORM, TEXTURE, STATIC_UNIFORM, STATIC_STORAGE, STORAGE, TEXTURE_ARRAY};
 
 struct DescriptorSetElement {
 	int binding;
 	DescriptorSetElementType type;
 	int size;
 	Texture *tex;
+	void *data = nullptr;
+	std::vector<Texture *> textures = {};
 };
 
 struct DescriptorSet {
 	BaseProject *BP;
 
 	std::vector<std::vector<VkBuffer>> uniformBuffers;
-	std::vector<std::vector<VkDeviceMemory>> uniformBuffersMemory;
+	std::vector<std::vector<MemoryAllocation>> uniformBuffersMemory;
 	std::vector<VkDescriptorSet> descriptorSets;
 	
 	std::vector<bool> toFree;
+	std::vector<DescriptorSetElementType> types;
+	std::vector<VkDeviceSize> uniformOffsets;
+	std::vector<int> dynamicBindings;
 
 	void init(BaseProject *bp, DescriptorSetLayout *L,
 		std::vector<DescriptorSetElement> E);
@@ -344,6 +1234,122 @@ struct DescriptorSet {
 
 
 // MAIN ! 
+// Persistent threads used to run a group of jobs in parallel (run() waits for all of them,
+// start() returns at once and wait() is called later)
+struct WorkerPool {
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable workDone;
+	std::vector<std::function<void()>> jobs;
+	size_t nextJob = 0;
+	int runningJobs = 0;
+	bool stopping = false;
+	std::exception_ptr error;
+
+	void init(int threadCount);
+	void run(std::vector<std::function<void()>> &newJobs);
+	void start(std::vector<std::function<void()>> &newJobs);
+	void wait();
+	void workerLoop();
+	void cleanup();
+};
+
+struct BufferUpload {
+	VkBuffer buffer;
+	const void *src;
+	VkDeviceSize size;
+	VkDeviceSize dstOffset;
+};
+
+// Transfers submitted together: with a dedicated transfer queue the copies run in
+// transferCommandBuffer, the ownership acquires and the mip blits in graphicsCommandBuffer.
+// The staging buffers are released when the fence signals
+struct UploadSubmission {
+	VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+	VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+	VkSemaphore transferDone = VK_NULL_HANDLE;
+	VkFence fence = VK_NULL_HANDLE;
+	std::vector<std::pair<VkBuffer, MemoryAllocation>> staging;
+	VkDeviceSize bytes = 0;
+};
+
+struct UniformAllocation {
+	void *data;
+	VkDeviceSize offset;
+};
+
+struct MemoryBlock {
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	uint32_t memoryType;
+	bool linear;
+	bool dedicated;
+	unsigned char *mapped;
+	int allocations;
+	// Free ranges (offset, size), sorted by offset and never adjacent
+	std::vector<std::pair<VkDeviceSize, VkDeviceSize>> freeRanges;
+};
+
+struct MemoryAllocator {
+	BaseProject *BP;
+	VkPhysicalDeviceMemoryProperties memProperties;
+	VkDeviceSize blockSize;
+	std::vector<MemoryBlock> blocks;
+
+	int deviceAllocations;
+	int liveAllocations;
+	VkDeviceSize bytesUsed;
+
+	void init(BaseProject *bp, VkDeviceSize size);
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+	MemoryAllocation allocate(VkMemoryRequirements memRequirements,
+							  VkMemoryPropertyFlags properties, bool linear);
+	bool allocateFromBlock(int b, VkMemoryRequirements memRequirements, MemoryAllocation &A);
+	int createBlock(VkDeviceSize size, uint32_t memoryType, bool linear);
+	void free(MemoryAllocation &A);
+	void printStats();
+	void cleanup();
+};
+
+struct UniformRing {
+	BaseProject *BP;
+	VkBuffer buffer;
+	MemoryAllocation bufferMemory;
+	unsigned char *mapped;
+
+	VkDeviceSize alignment;
+	VkDeviceSize frameSize;
+	int frames;
+
+	VkDeviceSize reserved;
+	VkDeviceSize frameOffset;
+	int currentImage;
+
+	VkDeviceSize bytesWritten;
+	VkDeviceSize lastFrameBytes;
+
+	void init(BaseProject *bp, VkDeviceSize size, int frameCount);
+	VkDeviceSize alignUp(VkDeviceSize size);
+	VkDeviceSize reserve(VkDeviceSize size);
+	UniformAllocation allocate(VkDeviceSize size);
+	VkDeviceSize descriptorOffset(int currentImage, VkDeviceSize offset);
+	void write(int currentImage, VkDeviceSize offset, const void *src, VkDeviceSize size);
+	void beginFrame(int currentImage);
+	void cleanup();
+};
+
+// Indexed indirect draw commands rewritten every frame in the uniform ring
+struct IndirectCommands {
+	BaseProject *BP;
+	VkDeviceSize offset;
+	uint32_t maxDraws;
+	
+	void init(BaseProject *bp, uint32_t draws);
+	void map(int currentImage, const VkDrawIndexedIndirectCommand *commands, uint32_t count);
+	void draw(VkCommandBuffer commandBuffer, int currentImage, uint32_t first, uint32_t count);
+};
+
 class BaseProject {
 	friend class VertexDescriptor;
 	friend class Model;
@@ -351,13 +1357,29 @@ class BaseProject {
 	friend class Pipeline;
 	friend class DescriptorSetLayout;
 	friend class DescriptorSet;
+	friend class UniformRing;
+	friend class MemoryAllocator;
+	friend struct GeometryBuffer;
+	friend struct IndirectCommands;
 public:
+	bool printStats = false;
+	// Models and textures loaded from their source formats are also written baked
+	// (meshes in file + ".bake", block compressed textures with their mips in file + ".dds")
+	bool bakeAssets = false;
+	// Encoded models (MGCG) are decrypted and inflated once: the glTF text is kept here, named by content hash
+	std::string decodedCacheDir = "cache";
+	// No window and no swapchain: frames are rendered to offscreen images until headlessDone is set
+	// (benchmarks on machines without a display, also with a software device)
+	bool headless = false;
+
 	virtual void setWindowParameters() = 0;
     void run() {
     	windowResizable = GLFW_FALSE;
 
     	setWindowParameters();
-        initWindow();
+    	if(!headless) {
+        	initWindow();
+    	}
         initVulkan();
         mainLoop();
         cleanup();
@@ -372,6 +1394,9 @@ protected:
 	int uniformBlocksInPool;
 	int texturesInPool;
 	int setsInPool;
+	int storageBlocksInPool;
+	int commandBuckets = 0;
+	VkDeviceSize uniformBytesPerFrame;
 
     GLFWwindow* window;
     VkInstance instance;
@@ -381,8 +1406,16 @@ protected:
     VkDevice device;
     VkQueue graphicsQueue;
     VkQueue presentQueue;
+	bool textureCompressionBC = false;
+	bool multiDrawIndirect = false;
 	VkCommandPool commandPool;
 	std::vector<VkCommandBuffer> commandBuffers;
+	
+	// Secondary command buffers: [bucket][swapchain image], each bucket has its own pool
+	std::vector<VkCommandPool> bucketCommandPools;
+	std::vector<std::vector<VkCommandBuffer>> bucketCommandBuffers;
+	std::vector<std::vector<bool>> bucketsOutdated;
+	WorkerPool workerPool;
 
     VkSwapchainKHR swapChain;
     std::vector<VkImage> swapChainImages;
@@ -393,27 +1426,80 @@ protected:
 	VkRenderPass renderPass;
 	
  	VkDescriptorPool descriptorPool;
+	UniformRing uniformRing;
+	MemoryAllocator memoryAllocator;
+	std::map<std::tuple<std::string, VertexDescriptor *, int>, Model *> meshCache;
+	
+	// Shader modules shared by all the pipelines that use the same file
+	std::map<std::string, VkShaderModule> shaderModuleCache;
+	// Pipelines compiled in the previous runs are loaded from pipelineCacheFile
+	VkPipelineCache pipelineCache;
+	std::string pipelineCacheFile = "pipeline_cache.bin";
+	bool pipelineCacheLoaded = false;
+	float pipelineCreateTime = 0.0f;
+	
+	bool uploadBatchOpen = false;
+	std::vector<BufferUpload> pendingUploads;
+	
+	// Upload context: transfers are recorded in upload and submitted with a fence.
+	// transferQueue is graphicsQueue when the device has no dedicated transfer family
+	uint32_t graphicsQueueFamily;
+	uint32_t transferQueueFamily;
+	VkQueue transferQueue;
+	VkCommandPool transferCommandPool;
+	UploadSubmission upload;
+	bool uploadRecording = false;
+	std::vector<UploadSubmission> uploadsInFlight;
+	VkDeviceSize uploadFlushBytes = 32 * 1024 * 1024;
+	int uploadSubmissions = 0;
+	VkDeviceSize uploadedBytes = 0;
+	
+	// Loading registered between beginLoadBatch() and endLoadBatch():
+	// the jobs (file reads, parsing, decoding) run on the worker pool,
+	// the finishers (Vulkan resources) run in order on the main thread
+	bool loadBatchOpen = false;
+	std::vector<std::function<void()>> loadJobs;
+	std::vector<std::function<void()>> loadFinishers;
+	std::atomic<int> loadJobsDone{0};
+	std::mutex loadJobMutex;
+	std::condition_variable loadJobReady;
+	std::mutex loadProgressMutex;
+	int loadProgressPrinted = 0;
 
 	VkDebugUtilsMessengerEXT debugMessenger;
 	
 	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
+	MemoryAllocation depthImageMemory;
 	VkImageView depthImageView;
 
 	VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 	VkImage colorImage;
-	VkDeviceMemory colorImageMemory;
+	MemoryAllocation colorImageMemory;
 	VkImageView colorImageView;
 
 	std::vector<VkFramebuffer> swapChainFramebuffers;
 	size_t currentFrame = 0;
 	bool framebufferResized = false;
+	std::vector<bool> commandBuffersOutdated;
 
 	std::vector<VkSemaphore> imageAvailableSemaphores;
 	std::vector<VkSemaphore> renderFinishedSemaphores;
 	std::vector<VkFence> inFlightFences;
 	std::vector<VkFence> imagesInFlight;
 	
+	// Headless mode: the offscreen images take the place of swapChainImages
+	std::vector<MemoryAllocation> offscreenImagesMemory;
+	bool headlessDone = false;
+	// Frame times in headless mode, in ms, one element for each frame: CPU time from the start of the frame
+	// to its submission, GPU time between the timestamps at the start and at the end of its command buffer
+	// (negative when the device has no timestamps)
+	std::vector<float> frameCpuTimes;
+	std::vector<float> frameGpuTimes;
+	VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+	float timestampPeriod;
+	uint64_t timestampMask;
+	std::vector<int64_t> imageFrames;
+	
     void initWindow() {
         glfwInit();
 
@@ -443,9 +1529,13 @@ protected:
     void initVulkan() {
 		createInstance();				
 		setupDebugMessenger();			
-		createSurface();				
+		if(!headless) {
+			createSurface();
+		}
 		pickPhysicalDevice();			
 		createLogicalDevice();			
+		createPipelineCache();
+		memoryAllocator.init(this, 64 * 1024 * 1024);
 		createSwapChain();				
 		createImageViews();				
 		createRenderPass();			
@@ -454,13 +1544,102 @@ protected:
 		createDepthResources();			
 		createFramebuffers();			
 		createDescriptorPool();			
+		uniformRing.init(this, uniformBytesPerFrame, swapChainImages.size());
 
+		auto startTime = std::chrono::high_resolution_clock::now();
+		beginUploadBatch();
 		localInit();
 		pipelinesAndDescriptorSetsInit();
+		endUploadBatch();
 
+		if(headless) {
+			createTimestampQueries();
+		}
 		createCommandBuffers();			
 		createSyncObjects();			 
+		
+		if(printStats) {
+			auto endTime = std::chrono::high_resolution_clock::now();
+			std::cout << "[ STATS ]: Startup (" << (pipelineCacheLoaded ? "warm" : "cold") << " pipeline cache): "
+					  << std::chrono::duration<float, std::chrono::milliseconds::period>(endTime - startTime).count()
+					  << " ms, pipelines " << pipelineCreateTime << " ms" << std::endl;
+		}
     }
+	
+	// The cache file is used only if it was written by the same device and driver
+	void createPipelineCache() {
+		std::vector<char> data;
+		std::ifstream file(pipelineCacheFile, std::ios::ate | std::ios::binary);
+		if(file.is_open()) {
+			data.resize((size_t)file.tellg());
+			file.seekg(0);
+			file.read(data.data(), data.size());
+		}
+		
+		VkPhysicalDeviceProperties properties{};
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		// Header: size, version, vendor id, device id and pipeline cache UUID
+		const size_t headerSize = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+		pipelineCacheLoaded = false;
+		if(data.size() >= headerSize) {
+			uint32_t header[4];
+			memcpy(header, data.data(), sizeof(header));
+			pipelineCacheLoaded = header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+								  header[2] == properties.vendorID && header[3] == properties.deviceID &&
+								  memcmp(data.data() + sizeof(header), properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+		}
+		
+		VkPipelineCacheCreateInfo cacheInfo{};
+		cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cacheInfo.initialDataSize = pipelineCacheLoaded ? data.size() : 0;
+		cacheInfo.pInitialData = pipelineCacheLoaded ? data.data() : nullptr;
+		
+		VkResult result = vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create pipeline cache!");
+		}
+	}
+	
+	void savePipelineCache() {
+		size_t size = 0;
+		if(vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) != VK_SUCCESS || size == 0) {
+			return;
+		}
+		std::vector<char> data(size);
+		if(vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) != VK_SUCCESS) {
+			return;
+		}
+		std::ofstream file(pipelineCacheFile, std::ios::out | std::ios::binary | std::ios::trunc);
+		if(!file.is_open()) {
+			std::cout << "[ ERROR ]: Cannot write " << pipelineCacheFile << std::endl;
+			return;
+		}
+		file.write(data.data(), size);
+	}
+	
+	// Each shader file is read and turned into a module only once
+	VkShaderModule shaderModule(const std::string &file) {
+		auto cached = shaderModuleCache.find(file);
+		if(cached != shaderModuleCache.end()) {
+			return cached->second;
+		}
+		
+		auto code = readFile(file);
+		VkShaderModuleCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = code.size();
+		createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+		
+		VkShaderModule module;
+		VkResult result = vkCreateShaderModule(device, &createInfo, nullptr, &module);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create shader module!");
+		}
+		shaderModuleCache[file] = module;
+		return module;
+	}
 
     void createInstance() {
     	VkApplicationInfo appInfo{};
@@ -513,13 +1692,15 @@ protected:
     }
     
     std::vector<const char*> getRequiredExtensions() {
-		uint32_t glfwExtensionCount = 0;
-		const char** glfwExtensions;
-		glfwExtensions =
-			glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-		std::vector<const char*> extensions(glfwExtensions,
-			glfwExtensions + glfwExtensionCount);
+		std::vector<const char*> extensions;
+		// The surface extensions are not needed without a window
+		if(!headless) {
+			uint32_t glfwExtensionCount = 0;
+			const char** glfwExtensions;
+			glfwExtensions =
+				glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+			extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+		}
 			
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);		
 		
@@ -646,6 +1827,8 @@ protected:
 			bool swapChainPresentModeSupport;
 			bool completeQueueFamily;
 			bool anisotropySupport;
+			bool dynamicIndexingSupport;
+			bool firstInstanceSupport;
 			bool extensionsSupported;
 			std::set<std::string> requiredExtensions;
 			
@@ -655,6 +1838,8 @@ protected:
 				std::cout << "swapChainPresentModeSupport: " << swapChainPresentModeSupport <<"\n";
 				std::cout << "completeQueueFamily: " << completeQueueFamily <<"\n";
 				std::cout << "anisotropySupport: " << anisotropySupport <<"\n";
+				std::cout << "dynamicIndexingSupport: " << dynamicIndexingSupport <<"\n";
+				std::cout << "firstInstanceSupport: " << firstInstanceSupport <<"\n";
 				std::cout << "extensionsSupported: " << extensionsSupported <<"\n";
 				
 				for (const auto& ext : requiredExtensions) {
@@ -675,6 +1860,13 @@ protected:
 		std::vector<VkPhysicalDevice> devices(deviceCount);
 		vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
+		// Nothing is presented in headless mode: the swapchain extension is neither required nor enabled
+		if (headless) {
+			deviceExtensions.erase(std::remove_if(deviceExtensions.begin(), deviceExtensions.end(),
+								   [](const char *ext) { return strcmp(ext, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0; }),
+								   deviceExtensions.end());
+		}
+
 		
 		for (const auto& device : devices) {
 			if(checkIfItHasDeviceExtension(device, "VK_KHR_portability_subset")) {
@@ -702,8 +1894,8 @@ protected:
 
 		devRep.extensionsSupported = checkDeviceExtensionSupport(device, devRep);
 
-		devRep.swapChainAdequate = false;
-		if (devRep.extensionsSupported) {
+		devRep.swapChainAdequate = headless;
+		if (devRep.extensionsSupported && !headless) {
 			SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
 			devRep.swapChainFormatSupport = swapChainSupport.formats.empty();
 			devRep.swapChainPresentModeSupport = swapChainSupport.presentModes.empty();
@@ -716,9 +1908,13 @@ protected:
 		
 		devRep.completeQueueFamily = indices.isComplete();
 		devRep.anisotropySupport = supportedFeatures.samplerAnisotropy;
+		// The scene shaders index their texture array with a per-object value
+		devRep.dynamicIndexingSupport = supportedFeatures.shaderSampledImageArrayDynamicIndexing;
+		// The indirect commands select their objects with firstInstance
+		devRep.firstInstanceSupport = supportedFeatures.drawIndirectFirstInstance;
 		
 		return devRep.completeQueueFamily && devRep.extensionsSupported && devRep.swapChainAdequate &&
-						devRep.anisotropySupport;
+						devRep.anisotropySupport && devRep.dynamicIndexingSupport && devRep.firstInstanceSupport;
 	}
     
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
@@ -739,8 +1935,13 @@ protected:
 			}
 				
 			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
-												 &presentSupport);
+			if (headless) {
+				// Nothing is presented: the graphics family is enough
+				presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+			} else {
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+													 &presentSupport);
+			}
 			if (presentSupport) {
 			 	indices.presentFamily = i;
 			}
@@ -750,6 +1951,19 @@ protected:
 			}			
 			i++;
 		}
+		
+		// A transfer-only family (the copy engine) runs the uploads next to the graphics queue.
+		// Its image copies must not be restricted to a coarser granularity than a texel
+		for (uint32_t j = 0; j < queueFamilyCount; j++) {
+			VkQueueFlags flags = queueFamilies[j].queueFlags;
+			VkExtent3D granularity = queueFamilies[j].minImageTransferGranularity;
+			if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+				!(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+				granularity.width == 1 && granularity.height == 1 && granularity.depth == 1) {
+				indices.transferFamily = j;
+				break;
+			}
+		}
 
 		return indices;
 	}
@@ -825,8 +2039,11 @@ protected:
 		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 		
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+		graphicsQueueFamily = indices.graphicsFamily.value();
+		transferQueueFamily = indices.transferFamily.value_or(graphicsQueueFamily);
 		std::set<uint32_t> uniqueQueueFamilies =
-				{indices.graphicsFamily.value(), indices.presentFamily.value()};
+				{indices.graphicsFamily.value(), indices.presentFamily.value(),
+				 transferQueueFamily};
 		
 		float queuePriority = 1.0f;
 		for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -843,6 +2060,18 @@ protected:
 		deviceFeatures.sampleRateShading = VK_TRUE;
 		deviceFeatures.fillModeNonSolid  = VK_TRUE;
 		
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+		// Checked in isDeviceSuitable
+		deviceFeatures.shaderSampledImageArrayDynamicIndexing = supportedFeatures.shaderSampledImageArrayDynamicIndexing;
+		deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+		// Without it the indirect commands are drawn one at a time
+		multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+		// Baked textures stay block compressed in memory where the device samples BC formats
+		textureCompressionBC = supportedFeatures.textureCompressionBC;
+		deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+		
 		VkDeviceCreateInfo createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 		
@@ -868,9 +2097,15 @@ protected:
 		
 		vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
 		vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+		vkGetDeviceQueue(device, transferQueueFamily, 0, &transferQueue);
 	}
 	
 	void createSwapChain() {
+		if(headless) {
+			createOffscreenImages();
+			return;
+		}
+		
 		SwapChainSupportDetails swapChainSupport =
 				querySwapChainSupport(physicalDevice);
 		VkSurfaceFormatKHR surfaceFormat =
@@ -930,6 +2165,22 @@ protected:
 		swapChainImageFormat = surfaceFormat.format;
 		swapChainExtent = extent;
 	}
+	
+	// Headless mode: images with the size of the window, in the format preferred for the swapchain
+	void createOffscreenImages() {
+		swapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+		swapChainExtent = {windowWidth, windowHeight};
+		swapChainImages.resize(HEADLESS_IMAGE_COUNT);
+		offscreenImagesMemory.resize(HEADLESS_IMAGE_COUNT);
+		for (uint32_t i = 0; i < HEADLESS_IMAGE_COUNT; i++) {
+			createImage(swapChainExtent.width, swapChainExtent.height, 1, 1,
+						VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+						VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+						VK_IMAGE_USAGE_TRANSFER_SRC_BIT, 0,
+						VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+						swapChainImages[i], offscreenImagesMemory[i]);
+		}
+	}
 
 	VkSurfaceFormatKHR chooseSwapSurfaceFormat(
 				const std::vector<VkSurfaceFormatKHR>& availableFormats)
@@ -1018,7 +2269,8 @@ protected:
 		colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		colorAttachmentResolve.finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL :
+														VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 		VkAttachmentReference colorAttachmentResolveRef{};
 		colorAttachmentResolveRef.attachment = 2;
@@ -1128,13 +2380,41 @@ protected:
 		VkCommandPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-		poolInfo.flags = 0; // Optional
+		// Command buffers are re-recorded when the scene changes
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 		
 		VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
 		if (result != VK_SUCCESS) {
 		 	PrintVkError(result);
 			throw std::runtime_error("failed to create command pool!");
 		}
+		
+		transferCommandPool = commandPool;
+		if(hasTransferQueue()) {
+			VkCommandPoolCreateInfo transferPoolInfo{};
+			transferPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			transferPoolInfo.queueFamilyIndex = transferQueueFamily;
+			transferPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			result = vkCreateCommandPool(device, &transferPoolInfo, nullptr, &transferCommandPool);
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to create transfer command pool!");
+			}
+		}
+		
+		// Buckets are recorded by different threads: each one needs its own pool
+		bucketCommandPools.resize(commandBuckets);
+		for(int b = 0; b < commandBuckets; b++) {
+			result = vkCreateCommandPool(device, &poolInfo, nullptr, &bucketCommandPools[b]);
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to create command pool!");
+			}
+		}
+		if(commandBuckets > 0) {
+			workerPool.init(std::min<int>(commandBuckets,
+							std::max<int>(1, std::thread::hardware_concurrency() - 1)));
+		}
 	}
 
 	void createColorResources() {
@@ -1204,7 +2484,7 @@ protected:
 				 	 VkImageTiling tiling, VkImageUsageFlags usage,
 				 	 VkImageCreateFlags cflags,
 				 	 VkMemoryPropertyFlags properties, VkImage& image,
-				 	 VkDeviceMemory& imageMemory) {		
+				 	 MemoryAllocation& imageMemory) {		
 		VkImageCreateInfo imageInfo{};
 		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 		imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -1230,22 +2510,24 @@ protected:
 		VkMemoryRequirements memRequirements;
 		vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits,
-											properties);
-		if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) !=
-								VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate image memory!");
-		}
+		imageMemory = memoryAllocator.allocate(memRequirements, properties,
+											tiling == VK_IMAGE_TILING_LINEAR);
 
-		vkBindImageMemory(device, image, imageMemory, 0);
+		vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
 	}
 
 	void generateMipmaps(VkImage image, VkFormat imageFormat,
 						 int32_t texWidth, int32_t texHeight,
 						 uint32_t mipLevels, int layerCount) {
+		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+		generateMipmaps(commandBuffer, image, imageFormat, texWidth, texHeight,
+						mipLevels, layerCount);
+		endSingleTimeCommands(commandBuffer);
+	}
+	
+	void generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat,
+						 int32_t texWidth, int32_t texHeight,
+						 uint32_t mipLevels, int layerCount) {
 		VkFormatProperties formatProperties;
 		vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat,
 							&formatProperties);
@@ -1255,8 +2537,6 @@ protected:
 			throw std::runtime_error("texture image format does not support linear blitting!");
 		}
 
-		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-		
 		VkImageMemoryBarrier barrier{};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 		barrier.image = image;
@@ -1327,15 +2607,20 @@ protected:
 							 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
 							 0, nullptr, 0, nullptr,
 							 1, &barrier);
-
-		endSingleTimeCommands(commandBuffer);
 	}
 	
 	void transitionImageLayout(VkImage image, VkFormat format,
 					VkImageLayout oldLayout, VkImageLayout newLayout,
 					uint32_t mipLevels, int layersCount) {
 		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
+		transitionImageLayout(commandBuffer, image, format, oldLayout, newLayout,
+							  mipLevels, layersCount);
+		endSingleTimeCommands(commandBuffer);
+	}
+	
+	void transitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format,
+					VkImageLayout oldLayout, VkImageLayout newLayout,
+					uint32_t mipLevels, int layersCount) {
 		VkImageMemoryBarrier barrier{};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 		barrier.oldLayout = oldLayout;
@@ -1387,14 +2672,17 @@ protected:
 		vkCmdPipelineBarrier(commandBuffer,
 								sourceStage, destinationStage, 0,
 								0, nullptr, 0, nullptr, 1, &barrier);
-
-		endSingleTimeCommands(commandBuffer);
 	}
 	
 	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t
 						   width, uint32_t height, int layerCount) {
 		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-		
+		copyBufferToImage(commandBuffer, buffer, image, width, height, layerCount);
+		endSingleTimeCommands(commandBuffer);
+	}
+	
+	void copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image,
+						   uint32_t width, uint32_t height, int layerCount) {
 		VkBufferImageCopy region{};
 		region.bufferOffset = 0;
 		region.bufferRowLength = 0;
@@ -1408,75 +2696,484 @@ protected:
 		
 		vkCmdCopyBufferToImage(commandBuffer, buffer, image,
 				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	}
+	
+	VkCommandBuffer beginSingleTimeCommands() { 
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = commandPool;
+		allocInfo.commandBufferCount = 1;
+		
+		VkCommandBuffer commandBuffer;
+		vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+		
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		
+		return commandBuffer;
+	}
+	
+	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size,
+					VkDeviceSize dstOffset = 0) {
+		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset = 0;
+		copyRegion.dstOffset = dstOffset;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
 		endSingleTimeCommands(commandBuffer);
 	}
+
+	void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+		vkEndCommandBuffer(commandBuffer);
+		
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		
+		// Waits for this submission only, not for the whole queue
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		VkFence fence;
+		vkCreateFence(device, &fenceInfo, nullptr, &fence);
+		vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence);
+		vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+		vkDestroyFence(device, fence, nullptr);
+		
+		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+	}
+	
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+					  VkMemoryPropertyFlags properties,
+					  VkBuffer& buffer, MemoryAllocation& bufferMemory) {
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = size;
+		bufferInfo.usage = usage;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		
+		VkResult result =
+				vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create vertex buffer!");
+		}
+		
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+		
+		bufferMemory = memoryAllocator.allocate(memRequirements, properties, true);
+		
+		vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);	
+	}
+	
+	void createDeviceLocalBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+					  const void *src, VkBuffer& buffer, MemoryAllocation& bufferMemory) {
+		createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					 buffer, bufferMemory);
+		uploadBuffer(buffer, src, size);
+	}
+	
+	void beginLoadBatch() {
+		loadBatchOpen = true;
+		loadJobs.clear();
+		loadFinishers.clear();
+	}
+	
+	// Models and textures call this to load directly, or in the open load batch
+	void queueLoad(std::function<void()> job, std::function<void()> finisher) {
+		if(!loadBatchOpen) {
+			job();
+			finisher();
+			return;
+		}
+		loadJobs.push_back(job);
+		loadFinishers.push_back(finisher);
+	}
+	
+	// Runs the jobs in parallel, printing the real progress, then creates the resources in order
+	void endLoadBatch() {
+		loadBatchOpen = false;
+		auto startTime = std::chrono::high_resolution_clock::now();
+		int total = static_cast<int>(loadJobs.size());
+		loadJobsDone = 0;
+		loadProgressPrinted = -1;
+		printLoadProgress(0, total);
+		
+		// Each finisher runs as soon as its job is done: the transfers it records
+		// reach the GPU while the workers are still decoding the next assets
+		std::vector<bool> jobDone(total, false);
+		bool jobFailed = false;
+		std::vector<std::function<void()>> jobs;
+		for(int i = 0; i < total; i++) {
+			jobs.push_back([this, job = loadJobs[i], total, i, &jobDone, &jobFailed]() {
+				try {
+					job();
+				} catch(...) {
+					std::lock_guard<std::mutex> lock(loadJobMutex);
+					jobFailed = true;
+					loadJobReady.notify_all();
+					throw;
+				}
+				{
+					std::lock_guard<std::mutex> lock(loadJobMutex);
+					jobDone[i] = true;
+				}
+				loadJobReady.notify_all();
+				printLoadProgress(++loadJobsDone, total);
+			});
+		}
+		workerPool.start(jobs);
+		
+		try {
+			for(int i = 0; i < total; i++) {
+				{
+					std::unique_lock<std::mutex> lock(loadJobMutex);
+					loadJobReady.wait(lock, [&]() { return jobDone[i] || jobFailed; });
+					if(jobFailed) {
+						break;
+					}
+				}
+				loadFinishers[i]();
+			}
+		} catch(...) {
+			// The jobs refer to jobDone: they must be over before leaving
+			try {
+				workerPool.wait();
+			} catch(...) {
+			}
+			throw;
+		}
+		workerPool.wait();
+		if(printStats) {
+			auto endTime = std::chrono::high_resolution_clock::now();
+			std::cout << "[ STATS ]: Loaded " << total << " assets on " << std::max<size_t>(1, workerPool.threads.size())
+					  << " threads in " << std::chrono::duration<float, std::chrono::milliseconds::period>
+							(endTime - startTime).count() << " ms" << std::endl;
+		}
+		loadJobs.clear();
+		loadFinishers.clear();
+	}
+	
+	void printLoadProgress(int done, int total) {
+		std::lock_guard<std::mutex> lock(loadProgressMutex);
+		int bars = (total > 0) ? done * 20 / total : 20;
+		if(bars == loadProgressPrinted) {
+			return;
+		}
+		loadProgressPrinted = bars;
+		std::cout << "[ LOADING ]: Loading assets:\t\t[" << std::string(bars, '=') << std::string(20 - bars, ' ')
+				  << "] " << done << "/" << total << std::endl;
+	}
+	
+	bool hasTransferQueue() {
+		return transferQueueFamily != graphicsQueueFamily;
+	}
+	
+	// Between beginUploadBatch() and endUploadBatch() the buffer uploads are only queued:
+	// src must stay valid until the batch is submitted. Textures are recorded right away
+	// in the upload context, which is submitted (without waiting) every uploadFlushBytes
+	void beginUploadBatch() {
+		uploadBatchOpen = true;
+		pendingUploads.clear();
+		uploadSubmissions = 0;
+		uploadedBytes = 0;
+		beginUploadSubmission();
+	}
+	
+	void uploadBuffer(VkBuffer buffer, const void *src, VkDeviceSize size,
+					  VkDeviceSize dstOffset = 0) {
+		if(uploadBatchOpen) {
+			pendingUploads.push_back({buffer, src, size, dstOffset});
+			return;
+		}
+		
+		VkBuffer stagingBuffer;
+		MemoryAllocation stagingBufferMemory;
+		createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+					 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					 stagingBuffer, stagingBufferMemory);
+
+		memcpy(stagingBufferMemory.mapped, src, static_cast<size_t>(size));
+		beginUploadSubmission();
+		recordBufferUpload(stagingBuffer, 0, buffer, dstOffset, size);
+		keepStagingBuffer(stagingBuffer, stagingBufferMemory, size);
+		flushUploadSubmission();
+		waitUploads();
+	}
+	
+	// Copy, ownership transfer, mip chain and final layout of a texture.
+	// With mipOffsets every level is copied from the staging buffer, otherwise the mips are blitted.
+	// The staging buffer now belongs to the upload context
+	void uploadImage(VkBuffer stagingBuffer, MemoryAllocation stagingBufferMemory,
+					 VkDeviceSize size, VkImage image, VkFormat format,
+					 int32_t width, int32_t height, uint32_t mipLevels, int layerCount,
+					 const std::vector<VkDeviceSize> &mipOffsets = {}) {
+		bool singleUpload = !uploadRecording;
+		if(singleUpload) {
+			beginUploadSubmission();
+		}
+		bool precomputedMips = !mipOffsets.empty();
+		
+		transitionImageLayout(upload.transferCommandBuffer, image, format,
+				VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, layerCount);
+		if(precomputedMips) {
+			std::vector<VkBufferImageCopy> regions(mipLevels);
+			for(uint32_t level = 0; level < mipLevels; level++) {
+				regions[level].bufferOffset = mipOffsets[level];
+				regions[level].imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0,
+												   static_cast<uint32_t>(layerCount)};
+				regions[level].imageExtent = {static_cast<uint32_t>(std::max(1, width >> level)),
+											  static_cast<uint32_t>(std::max(1, height >> level)), 1};
+			}
+			vkCmdCopyBufferToImage(upload.transferCommandBuffer, stagingBuffer, image,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, regions.data());
+		} else {
+			copyBufferToImage(upload.transferCommandBuffer, stagingBuffer, image,
+					static_cast<uint32_t>(width), static_cast<uint32_t>(height), layerCount);
+		}
+		
+		if(hasTransferQueue()) {
+			// The complete mip chain goes straight to its final layout in the ownership transfer
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = precomputedMips ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL :
+												  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcQueueFamilyIndex = transferQueueFamily;
+			barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+			barrier.image = image;
+			barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels,
+										0, static_cast<uint32_t>(layerCount)};
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = 0;
+			vkCmdPipelineBarrier(upload.transferCommandBuffer,
+								 VK_PIPELINE_STAGE_TRANSFER_BIT,
+								 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+								 0, nullptr, 0, nullptr, 1, &barrier);
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = precomputedMips ? VK_ACCESS_SHADER_READ_BIT :
+							VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(upload.graphicsCommandBuffer,
+								 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+								 precomputedMips ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT :
+												   VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+								 0, nullptr, 0, nullptr, 1, &barrier);
+		} else if(precomputedMips) {
+			transitionImageLayout(upload.graphicsCommandBuffer, image, format,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					mipLevels, layerCount);
+		}
+		
+		// Blits need a graphics queue
+		if(!precomputedMips) {
+			generateMipmaps(upload.graphicsCommandBuffer, image, format,
+							width, height, mipLevels, layerCount);
+		}
+		keepStagingBuffer(stagingBuffer, stagingBufferMemory, size);
+		
+		if(singleUpload) {
+			flushUploadSubmission();
+			waitUploads();
+		}
+	}
+	
+	void recordBufferUpload(VkBuffer stagingBuffer, VkDeviceSize srcOffset,
+							VkBuffer buffer, VkDeviceSize dstOffset, VkDeviceSize size) {
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset = srcOffset;
+		copyRegion.dstOffset = dstOffset;
+		copyRegion.size = size;
+		vkCmdCopyBuffer(upload.transferCommandBuffer, stagingBuffer, buffer, 1, &copyRegion);
+		
+		if(hasTransferQueue()) {
+			VkBufferMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcQueueFamilyIndex = transferQueueFamily;
+			barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+			barrier.buffer = buffer;
+			barrier.offset = dstOffset;
+			barrier.size = size;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = 0;
+			vkCmdPipelineBarrier(upload.transferCommandBuffer,
+								 VK_PIPELINE_STAGE_TRANSFER_BIT,
+								 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+								 0, nullptr, 1, &barrier, 0, nullptr);
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			vkCmdPipelineBarrier(upload.graphicsCommandBuffer,
+								 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+								 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+								 0, nullptr, 1, &barrier, 0, nullptr);
+		}
+	}
+	
+	// In a batch, once enough data is recorded the submission goes to the GPU
+	// and a new one is started: the copies overlap the rest of the loading
+	void keepStagingBuffer(VkBuffer stagingBuffer, MemoryAllocation stagingBufferMemory,
+						   VkDeviceSize size) {
+		upload.staging.push_back({stagingBuffer, stagingBufferMemory});
+		upload.bytes += size;
+		if(uploadBatchOpen && upload.bytes >= uploadFlushBytes) {
+			flushUploadSubmission();
+			beginUploadSubmission();
+		}
+	}
 	
-	VkCommandBuffer beginSingleTimeCommands() { 
+	void beginUploadSubmission() {
+		upload = UploadSubmission{};
+		
 		VkCommandBufferAllocateInfo allocInfo{};
 		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 		allocInfo.commandPool = commandPool;
 		allocInfo.commandBufferCount = 1;
 		
-		VkCommandBuffer commandBuffer;
-		vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-		
 		VkCommandBufferBeginInfo beginInfo{};
 		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 		
-		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		vkAllocateCommandBuffers(device, &allocInfo, &upload.graphicsCommandBuffer);
+		vkBeginCommandBuffer(upload.graphicsCommandBuffer, &beginInfo);
+		upload.transferCommandBuffer = upload.graphicsCommandBuffer;
 		
-		return commandBuffer;
+		if(hasTransferQueue()) {
+			allocInfo.commandPool = transferCommandPool;
+			vkAllocateCommandBuffers(device, &allocInfo, &upload.transferCommandBuffer);
+			vkBeginCommandBuffer(upload.transferCommandBuffer, &beginInfo);
+			
+			VkSemaphoreCreateInfo semaphoreInfo{};
+			semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &upload.transferDone);
+		}
+		
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		vkCreateFence(device, &fenceInfo, nullptr, &upload.fence);
+		uploadRecording = true;
 	}
 	
-	void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-		vkEndCommandBuffer(commandBuffer);
+	// Submits the recorded transfers without waiting for them
+	void flushUploadSubmission() {
+		uploadRecording = false;
+		
+		// The copied data is visible to everything submitted afterwards
+		VkMemoryBarrier memoryBarrier{};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		vkCmdPipelineBarrier(upload.graphicsCommandBuffer,
+							 VK_PIPELINE_STAGE_TRANSFER_BIT,
+							 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+							 1, &memoryBarrier, 0, nullptr, 0, nullptr);
 		
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &commandBuffer;
-		vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(graphicsQueue);
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkResult result;
 		
-		vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-	}
-	
-	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-					  VkMemoryPropertyFlags properties,
-					  VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-		VkBufferCreateInfo bufferInfo{};
-		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferInfo.size = size;
-		bufferInfo.usage = usage;
-		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if(hasTransferQueue()) {
+			vkEndCommandBuffer(upload.transferCommandBuffer);
+			submitInfo.pCommandBuffers = &upload.transferCommandBuffer;
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &upload.transferDone;
+			result = vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to submit upload command buffer!");
+			}
+			
+			// The acquires and the mip blits wait for the copies on the graphics queue
+			submitInfo.signalSemaphoreCount = 0;
+			submitInfo.pSignalSemaphores = nullptr;
+			submitInfo.waitSemaphoreCount = 1;
+			submitInfo.pWaitSemaphores = &upload.transferDone;
+			submitInfo.pWaitDstStageMask = &waitStage;
+		}
 		
-		VkResult result =
-				vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+		vkEndCommandBuffer(upload.graphicsCommandBuffer);
+		submitInfo.pCommandBuffers = &upload.graphicsCommandBuffer;
+		result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, upload.fence);
 		if (result != VK_SUCCESS) {
 		 	PrintVkError(result);
-			throw std::runtime_error("failed to create vertex buffer!");
+			throw std::runtime_error("failed to submit upload command buffer!");
 		}
 		
-		VkMemoryRequirements memRequirements;
-		vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+		uploadSubmissions++;
+		uploadedBytes += upload.bytes;
+		uploadsInFlight.push_back(upload);
+		upload = UploadSubmission{};
+	}
+	
+	// Waits for the submitted transfers, then releases their staging buffers
+	void waitUploads() {
+		for(UploadSubmission &submission : uploadsInFlight) {
+			vkWaitForFences(device, 1, &submission.fence, VK_TRUE, UINT64_MAX);
+			vkDestroyFence(device, submission.fence, nullptr);
+			vkFreeCommandBuffers(device, commandPool, 1, &submission.graphicsCommandBuffer);
+			if(hasTransferQueue()) {
+				vkFreeCommandBuffers(device, transferCommandPool, 1, &submission.transferCommandBuffer);
+				vkDestroySemaphore(device, submission.transferDone, nullptr);
+			}
+			for(auto &staging : submission.staging) {
+				vkDestroyBuffer(device, staging.first, nullptr);
+				memoryAllocator.free(staging.second);
+			}
+		}
+		uploadsInFlight.clear();
+	}
+	
+	// The queued buffers share one staging buffer, recorded in the last submission
+	void endUploadBatch() {
+		uploadBatchOpen = false;
+		auto startTime = std::chrono::high_resolution_clock::now();
 		
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex =
-				findMemoryType(memRequirements.memoryTypeBits, properties);
-
-		result = vkAllocateMemory(device, &allocInfo, nullptr,
-				&bufferMemory);
-		if (result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to allocate vertex buffer memory!");
+		std::vector<VkDeviceSize> offsets(pendingUploads.size());
+		VkDeviceSize totalSize = 0;
+		for(size_t i = 0; i < pendingUploads.size(); i++) {
+			offsets[i] = totalSize;
+			totalSize += (pendingUploads[i].size + 15) / 16 * 16;
+		}
+		
+		if(totalSize > 0) {
+			VkBuffer stagingBuffer;
+			MemoryAllocation stagingBufferMemory;
+			createBuffer(totalSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+						 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+						 stagingBuffer, stagingBufferMemory);
+			
+			for(size_t i = 0; i < pendingUploads.size(); i++) {
+				memcpy(stagingBufferMemory.mapped + offsets[i], pendingUploads[i].src,
+					   static_cast<size_t>(pendingUploads[i].size));
+				recordBufferUpload(stagingBuffer, offsets[i], pendingUploads[i].buffer,
+								   pendingUploads[i].dstOffset, pendingUploads[i].size);
+			}
+			keepStagingBuffer(stagingBuffer, stagingBufferMemory, totalSize);
 		}
+		flushUploadSubmission();
+		waitUploads();
 		
-		vkBindBufferMemory(device, buffer, bufferMemory, 0);	
+		if(printStats && uploadedBytes > 0) {
+			auto endTime = std::chrono::high_resolution_clock::now();
+			std::cout << "[ STATS ]: Uploaded " << pendingUploads.size() << " buffers and the textures ("
+					  << uploadedBytes / 1024 << " KB) in " << uploadSubmissions << " submissions on the "
+					  << (hasTransferQueue() ? "transfer" : "graphics") << " queue, "
+					  << std::chrono::duration<float, std::chrono::milliseconds::period>
+							(endTime - startTime).count() << " ms to complete them" << std::endl;
+		}
+		pendingUploads.clear();
 	}
 	
 	uint32_t findMemoryType(uint32_t typeFilter,
@@ -1496,19 +3193,25 @@ protected:
 	}
     
 	void createDescriptorPool() {
-		std::array<VkDescriptorPoolSize, 2> poolSizes{};
-		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		poolSizes[0].descriptorCount = static_cast<uint32_t>(uniformBlocksInPool *
-															 swapChainImages.size());
-		poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		poolSizes[1].descriptorCount = static_cast<uint32_t>(texturesInPool *
-															 swapChainImages.size());
+		// A single descriptor set per object: per frame uniforms are selected
+		// with a dynamic offset in the uniform ring buffer when the set is bound
+		std::array<VkDescriptorPoolSize, 5> poolSizes{};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		poolSizes[0].descriptorCount = static_cast<uint32_t>(uniformBlocksInPool);
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		poolSizes[1].descriptorCount = static_cast<uint32_t>(uniformBlocksInPool);
+		poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		poolSizes[2].descriptorCount = static_cast<uint32_t>(texturesInPool);
+		poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSizes[3].descriptorCount = static_cast<uint32_t>(storageBlocksInPool);
+		poolSizes[4].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		poolSizes[4].descriptorCount = static_cast<uint32_t>(storageBlocksInPool);
 															 
 		VkDescriptorPoolCreateInfo poolInfo{};
 		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());;
 		poolInfo.pPoolSizes = poolSizes.data();
-		poolInfo.maxSets = static_cast<uint32_t>(setsInPool * swapChainImages.size());
+		poolInfo.maxSets = static_cast<uint32_t>(setsInPool);
 		
 		VkResult result = vkCreateDescriptorPool(device, &poolInfo, nullptr,
 									&descriptorPool);
@@ -1518,7 +3221,10 @@ protected:
 		}
 	}
 	
-	virtual void populateCommandBuffer(VkCommandBuffer commandBuffer, int i) = 0;
+	// Applications either record everything in populateCommandBuffer, or set commandBuckets
+	// and record each bucket in populateCommandBucket (called in parallel)
+	virtual void populateCommandBuffer(VkCommandBuffer /*commandBuffer*/, int /*i*/) {}
+	virtual void populateCommandBucket(VkCommandBuffer /*commandBuffer*/, int /*bucket*/, int /*i*/) {}
 
     void createCommandBuffers() {
     	commandBuffers.resize(swapChainFramebuffers.size());
@@ -1536,44 +3242,133 @@ protected:
 			throw std::runtime_error("failed to allocate command buffers!");
 		}
 		
+		bucketCommandBuffers.resize(commandBuckets);
+		bucketsOutdated.assign(commandBuckets, std::vector<bool>(commandBuffers.size(), true));
+		for(int b = 0; b < commandBuckets; b++) {
+			bucketCommandBuffers[b].resize(commandBuffers.size());
+			
+			VkCommandBufferAllocateInfo bucketAllocInfo{};
+			bucketAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			bucketAllocInfo.commandPool = bucketCommandPools[b];
+			bucketAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			bucketAllocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+			
+			result = vkAllocateCommandBuffers(device, &bucketAllocInfo,
+					bucketCommandBuffers[b].data());
+			if (result != VK_SUCCESS) {
+			 	PrintVkError(result);
+				throw std::runtime_error("failed to allocate command buffers!");
+			}
+		}
+		
+		commandBuffersOutdated.assign(commandBuffers.size(), false);
 		for (size_t i = 0; i < commandBuffers.size(); i++) {
-			VkCommandBufferBeginInfo beginInfo{};
-			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-			beginInfo.flags = 0; // Optional
-			beginInfo.pInheritanceInfo = nullptr; // Optional
-
-			if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
-						VK_SUCCESS) {
-				throw std::runtime_error("failed to begin recording command buffer!");
+			recordCommandBuffer(i);
+		}
+	}
+	
+	// Records in parallel the outdated buckets of image i
+	void recordBuckets(int i) {
+		std::vector<std::function<void()>> jobs;
+		for(int b = 0; b < commandBuckets; b++) {
+			if(bucketsOutdated[b][i]) {
+				jobs.push_back([this, b, i]() { recordBucket(b, i); });
+				bucketsOutdated[b][i] = false;
 			}
+		}
+		workerPool.run(jobs);
+	}
+	
+	void recordBucket(int b, int i) {
+		VkCommandBuffer commandBuffer = bucketCommandBuffers[b][i];
+		vkResetCommandBuffer(commandBuffer, 0);
+		
+		VkCommandBufferInheritanceInfo inheritanceInfo{};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = renderPass;
+		inheritanceInfo.subpass = 0;
+		inheritanceInfo.framebuffer = swapChainFramebuffers[i];
+		
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+		
+		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
+		
+		populateCommandBucket(commandBuffer, b, i);
+		
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
+		}
+	}
+	
+	void recordCommandBuffer(int i) {
+		if(commandBuckets > 0) {
+			recordBuckets(i);
+		}
+		
+		vkResetCommandBuffer(commandBuffers[i], 0);
+		
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = 0; // Optional
+		beginInfo.pInheritanceInfo = nullptr; // Optional
+
+		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) !=
+					VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
+		
+		if(timestampQueryPool != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(commandBuffers[i], timestampQueryPool, 2 * i, 2);
+			vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+								timestampQueryPool, 2 * i);
+		}
+		
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = renderPass; 
+		renderPassInfo.framebuffer = swapChainFramebuffers[i];
+		renderPassInfo.renderArea.offset = {0, 0};
+		renderPassInfo.renderArea.extent = swapChainExtent;
+
+		std::array<VkClearValue, 2> clearValues{};
+		clearValues[0].color = initialBackgroundColor;
+		clearValues[1].depthStencil = {1.0f, 0};
+
+		renderPassInfo.clearValueCount =
+						static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+		
+		if(commandBuckets > 0) {
+			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
+					VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 			
-			VkRenderPassBeginInfo renderPassInfo{};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-			renderPassInfo.renderPass = renderPass; 
-			renderPassInfo.framebuffer = swapChainFramebuffers[i];
-			renderPassInfo.renderArea.offset = {0, 0};
-			renderPassInfo.renderArea.extent = swapChainExtent;
-	
-			std::array<VkClearValue, 2> clearValues{};
-			clearValues[0].color = initialBackgroundColor;
-			clearValues[1].depthStencil = {1.0f, 0};
-	
-			renderPassInfo.clearValueCount =
-							static_cast<uint32_t>(clearValues.size());
-			renderPassInfo.pClearValues = clearValues.data();
-			
+			std::vector<VkCommandBuffer> buckets(commandBuckets);
+			for(int b = 0; b < commandBuckets; b++) {
+				buckets[b] = bucketCommandBuffers[b][i];
+			}
+			vkCmdExecuteCommands(commandBuffers[i], commandBuckets, buckets.data());
+		} else {
 			vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
 					VK_SUBPASS_CONTENTS_INLINE);			
-	
 
 			populateCommandBuffer(commandBuffers[i], i);
-			
+		}
+		
 
-			vkCmdEndRenderPass(commandBuffers[i]);
+		vkCmdEndRenderPass(commandBuffers[i]);
+		
+		if(timestampQueryPool != VK_NULL_HANDLE) {
+			vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+								timestampQueryPool, 2 * i + 1);
+		}
 
-			if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-				throw std::runtime_error("failed to record command buffer!");
-			}
+		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
 		}
 	}
     
@@ -1608,7 +3403,63 @@ protected:
 		}
 	}
 	
+	// Headless mode: two timestamps for each image, at the start and at the end of its command buffer
+	void createTimestampQueries() {
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+		uint32_t validBits = queueFamilies[graphicsQueueFamily].timestampValidBits;
+		if(validBits == 0) {
+			std::cout << "[ STATS ]: No timestamps on the graphics queue, GPU times are not measured" << std::endl;
+			return;
+		}
+		
+		VkPhysicalDeviceProperties properties{};
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		timestampPeriod = properties.limits.timestampPeriod;
+		timestampMask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+		
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2 * static_cast<uint32_t>(swapChainImages.size());
+		
+		VkResult result = vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timestampQueryPool);
+		if (result != VK_SUCCESS) {
+		 	PrintVkError(result);
+			throw std::runtime_error("failed to create timestamp query pool!");
+		}
+		imageFrames.assign(swapChainImages.size(), -1);
+	}
+	
+	// GPU time of the last frame rendered to image i, once its fence has been waited
+	void readFrameTimestamps(uint32_t i) {
+		if(timestampQueryPool == VK_NULL_HANDLE || imageFrames[i] < 0) {
+			return;
+		}
+		uint64_t timestamps[2];
+		if(vkGetQueryPoolResults(device, timestampQueryPool, 2 * i, 2, sizeof(timestamps), timestamps,
+								 sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+			frameGpuTimes[imageFrames[i]] = ((timestamps[1] - timestamps[0]) & timestampMask) *
+											timestampPeriod / 1000000.0f;
+		}
+		imageFrames[i] = -1;
+	}
+	
     void mainLoop() {
+    	if(headless) {
+    		while (!headlessDone) {
+    			drawFrame();
+    		}
+    		
+    		vkDeviceWaitIdle(device);
+    		for (uint32_t i = 0; i < swapChainImages.size(); i++) {
+    			readFrameTimestamps(i);
+    		}
+    		return;
+    	}
+    	
         while (!glfwWindowShouldClose(window)){
             glfwPollEvents();
             drawFrame();
@@ -1622,15 +3473,21 @@ protected:
 						VK_TRUE, UINT64_MAX);
 		
 		uint32_t imageIndex;
+		VkResult result;
 		
-		VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
-				imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
-
-		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-			recreateSwapChain();
-			return;
-		} else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-			throw std::runtime_error("failed to acquire swap chain image!");
+		if (headless) {
+			// The offscreen images are used in turn
+			imageIndex = frameCpuTimes.size() % swapChainImages.size();
+		} else {
+			result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
+					imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+			if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+				recreateSwapChain();
+				return;
+			} else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+				throw std::runtime_error("failed to acquire swap chain image!");
+			}
 		}
 
 		if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
@@ -1639,7 +3496,22 @@ protected:
 		}
 		imagesInFlight[imageIndex] = inFlightFences[currentFrame];
 		
+		auto frameStartTime = std::chrono::high_resolution_clock::now();
+		if (headless) {
+			readFrameTimestamps(imageIndex);
+		}
+		
+		uniformRing.beginFrame(imageIndex);
 		updateUniformBuffer(imageIndex);
+		if(printStats) {
+			printFrameStats();
+		}
+		
+		// The fence of this image has been waited: its command buffer can be recorded again
+		if(commandBuffersOutdated[imageIndex]) {
+			recordCommandBuffer(imageIndex);
+			commandBuffersOutdated[imageIndex] = false;
+		}
 		
 		VkSubmitInfo submitInfo{};
 		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -1654,6 +3526,11 @@ protected:
 		VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
 		submitInfo.signalSemaphoreCount = 1;
 		submitInfo.pSignalSemaphores = signalSemaphores;
+		if (headless) {
+			// No image to acquire and nothing to present
+			submitInfo.waitSemaphoreCount = 0;
+			submitInfo.signalSemaphoreCount = 0;
+		}
 		
 		vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
@@ -1662,6 +3539,18 @@ protected:
 			throw std::runtime_error("failed to submit draw command buffer!");
 		}
 		
+		if (headless) {
+			auto submitTime = std::chrono::high_resolution_clock::now();
+			if (timestampQueryPool != VK_NULL_HANDLE) {
+				imageFrames[imageIndex] = frameCpuTimes.size();
+			}
+			frameCpuTimes.push_back(std::chrono::duration<float, std::chrono::milliseconds::period>
+									(submitTime - frameStartTime).count());
+			frameGpuTimes.push_back(-1.0f);
+			currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+			return;
+		}
+		
 		VkPresentInfoKHR presentInfo{};
 		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 		presentInfo.waitSemaphoreCount = 1;
@@ -1701,6 +3590,8 @@ protected:
 		}
 
 		vkDeviceWaitIdle(device);
+		auto startTime = std::chrono::high_resolution_clock::now();
+		pipelineCreateTime = 0.0f;
     	
     	cleanupSwapChain();
 
@@ -1711,20 +3602,30 @@ protected:
 		createDepthResources();
 		createFramebuffers();
 		createDescriptorPool();
+		uniformRing.init(this, uniformBytesPerFrame, swapChainImages.size());
 
+		beginUploadBatch();
 		pipelinesAndDescriptorSetsInit();
+		endUploadBatch();
 
 		createCommandBuffers();
+		
+		if(printStats) {
+			auto endTime = std::chrono::high_resolution_clock::now();
+			std::cout << "[ STATS ]: Swapchain recreated in "
+					  << std::chrono::duration<float, std::chrono::milliseconds::period>(endTime - startTime).count()
+					  << " ms, pipelines " << pipelineCreateTime << " ms" << std::endl;
+		}
 	}
 
 	void cleanupSwapChain() {
     	vkDestroyImageView(device, colorImageView, nullptr);
     	vkDestroyImage(device, colorImage, nullptr);
-    	vkFreeMemory(device, colorImageMemory, nullptr);
+    	memoryAllocator.free(colorImageMemory);
     	
 		vkDestroyImageView(device, depthImageView, nullptr);
 		vkDestroyImage(device, depthImage, nullptr);
-		vkFreeMemory(device, depthImageMemory, nullptr);
+		memoryAllocator.free(depthImageMemory);
 
 		for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
 			vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
@@ -1732,8 +3633,13 @@ protected:
 		
 		vkFreeCommandBuffers(device, commandPool,
 				static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+		for(int b = 0; b < commandBuckets; b++) {
+			vkFreeCommandBuffers(device, bucketCommandPools[b],
+					static_cast<uint32_t>(bucketCommandBuffers[b].size()), bucketCommandBuffers[b].data());
+		}
 				
 		pipelinesAndDescriptorSetsCleanup();
+		uniformRing.cleanup();
 
 		vkDestroyRenderPass(device, renderPass, nullptr);
 
@@ -1741,7 +3647,14 @@ protected:
 			vkDestroyImageView(device, swapChainImageViews[i], nullptr);
 		}
 		
-		vkDestroySwapchainKHR(device, swapChain, nullptr);
+		if (headless) {
+			for (size_t i = 0; i < swapChainImages.size(); i++) {
+				vkDestroyImage(device, swapChainImages[i], nullptr);
+				memoryAllocator.free(offscreenImagesMemory[i]);
+			}
+		} else {
+			vkDestroySwapchainKHR(device, swapChain, nullptr);
+		}
 
 		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 	}
@@ -1756,13 +3669,35 @@ protected:
 			vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
 			vkDestroyFence(device, inFlightFences[i], nullptr);
     	}
+		if (timestampQueryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+		}
     	
     	vkDestroyCommandPool(device, commandPool, nullptr);
+		if(hasTransferQueue()) {
+			vkDestroyCommandPool(device, transferCommandPool, nullptr);
+		}
+		for(int b = 0; b < commandBuckets; b++) {
+			vkDestroyCommandPool(device, bucketCommandPools[b], nullptr);
+		}
+		workerPool.cleanup();
     	
+    	memoryAllocator.cleanup();
+		
+		for(auto &module : shaderModuleCache) {
+			vkDestroyShaderModule(device, module.second, nullptr);
+		}
+		shaderModuleCache.clear();
+		savePipelineCache();
+		vkDestroyPipelineCache(device, pipelineCache, nullptr);
  		vkDestroyDevice(device, nullptr);
 		
 		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
 		
+		if (headless) {
+			vkDestroyInstance(instance, nullptr);
+			return;
+		}
 		vkDestroySurfaceKHR(instance, surface, nullptr);
     	vkDestroyInstance(instance, nullptr);
 
@@ -1771,8 +3706,37 @@ protected:
         glfwTerminate();
     }
 	
+	// Called when the content of the scene changes: the command buffers are recorded
+	// again, each one the next time its image is acquired (no swapchain recreation)
 	void RebuildPipeline() {
-		framebufferResized = true;
+		std::fill(commandBuffersOutdated.begin(), commandBuffersOutdated.end(), true);
+		for(int b = 0; b < commandBuckets; b++) {
+			std::fill(bucketsOutdated[b].begin(), bucketsOutdated[b].end(), true);
+		}
+	}
+	
+	// Only the given bucket is recorded again, the others are reused
+	void RebuildBucket(int b) {
+		std::fill(commandBuffersOutdated.begin(), commandBuffersOutdated.end(), true);
+		std::fill(bucketsOutdated[b].begin(), bucketsOutdated[b].end(), true);
+	}
+	
+	// Applications can add their own lines to the periodic statistics
+	virtual void printApplicationStats() {}
+	
+	void printFrameStats() {
+		static auto lastTime = std::chrono::high_resolution_clock::now();
+		auto currentTime = std::chrono::high_resolution_clock::now();
+		if(std::chrono::duration<float, std::chrono::seconds::period>
+					(currentTime - lastTime).count() < 2.0f) {
+			return;
+		}
+		lastTime = currentTime;
+
+		std::cout << "[ STATS ]: Uniform bytes written last frame: "
+				  << uniformRing.lastFrameBytes << std::endl;
+		memoryAllocator.printStats();
+		printApplicationStats();
 	}
 	
 	
@@ -2130,18 +4094,11 @@ protected:
 		}
 		// Create memory to back up the image
 		VkMemoryRequirements memRequirements;
-		VkMemoryAllocateInfo memAllocInfo(vks_initializers_memoryAllocateInfo());
-		VkDeviceMemory dstImageMemory;
+		MemoryAllocation dstImageMemory;
 		vkGetImageMemoryRequirements(device, dstImage, &memRequirements);
-		memAllocInfo.allocationSize = memRequirements.size;
 		// Memory must be host visible to copy from
-		memAllocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		result = vkAllocateMemory(device, &memAllocInfo, nullptr, &dstImageMemory);
-		if(result != VK_SUCCESS) {
-		 	PrintVkError(result);
-			throw std::runtime_error("failed to create screenshot!!");
-		}
-		result = vkBindImageMemory(device, dstImage, dstImageMemory, 0);
+		dstImageMemory = memoryAllocator.allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true);
+		result = vkBindImageMemory(device, dstImage, dstImageMemory.memory, dstImageMemory.offset);
 		if(result != VK_SUCCESS) {
 		 	PrintVkError(result);
 			throw std::runtime_error("failed to create screenshot!!");
@@ -2252,8 +4209,7 @@ protected:
 		vkGetImageSubresourceLayout(device, dstImage, &subResource, &subResourceLayout);
 
 		// Map image memory so we can start copying from it
-		const char* data;
-		vkMapMemory(device, dstImageMemory, 0, VK_WHOLE_SIZE, 0, (void**)&data);
+		const char* data = (const char*)dstImageMemory.mapped;
 		data += subResourceLayout.offset;
 
 /*		std::ofstream file(filename, std::ios::out | std::ios::binary);
@@ -2333,9 +4289,8 @@ protected:
 		std::cout << "Screenshot saved to disk" << std::endl;
 
 		// Clean up resources
-		vkUnmapMemory(device, dstImageMemory);
-		vkFreeMemory(device, dstImageMemory, nullptr);
 		vkDestroyImage(device, dstImage, nullptr);
+		memoryAllocator.free(dstImageMemory);
 
 		screenshotSaved = true;
 	}	
@@ -2475,6 +4430,9 @@ void Model::loadModelOBJ(std::string file) {
 //	std::cout << "UV " << VD->UV.hasIt << "," << VD->UV.offset << "\n";	
 //	std::cout << "Normal " << VD->Normal.hasIt << "," << VD->Normal.offset << "\n";
 	int mainStride = VD->Bindings[0].stride;
+	// Identical vertices (same bytes: position, UV, normal, ...) are welded in a single one
+	std::unordered_map<std::string, uint32_t> uniqueVertices;
+	int corners = 0;
 	for (const auto& shape : shapes) {
 		for (const auto& index : shape.mesh.indices) {
 			std::vector<unsigned char> vertex(mainStride, 0);
@@ -2517,11 +4475,204 @@ void Model::loadModelOBJ(std::string file) {
 				*o = norm;
 			}
 			
-			vertices.insert(vertices.end(), vertex.begin(), vertex.end());
-			indices.push_back((vertices.size()/mainStride)-1);
+			std::string key(vertex.begin(), vertex.end());
+			auto found = uniqueVertices.find(key);
+			if(found == uniqueVertices.end()) {
+				found = uniqueVertices.emplace(key, vertices.size()/mainStride).first;
+				vertices.insert(vertices.end(), vertex.begin(), vertex.end());
+			}
+			indices.push_back(found->second);
+			corners++;
 		}
 	}
 	
+	computeBounds();
+	
+	float ACMRbefore = ACMR(16);
+	optimizeVertexCache();
+	if(BP->printStats) {
+		std::cout << "[ STATS ]: " << file << ": " << corners << " -> "
+				  << vertices.size()/mainStride << " vertices, ACMR "
+				  << ACMRbefore << " -> " << ACMR(16) << std::endl;
+	}
+}
+
+// Average number of vertex shader invocations per triangle, with a FIFO post-transform cache
+float Model::ACMR(int cacheSize) {
+	if(indices.size() < 3) {
+		return 0.0f;
+	}
+	std::vector<int> cacheTime(vertices.size() / VD->Bindings[0].stride, -cacheSize - 1);
+	int time = 0;
+	int misses = 0;
+	for(uint32_t v : indices) {
+		if(time - cacheTime[v] > cacheSize) {
+			cacheTime[v] = time++;
+			misses++;
+		}
+	}
+	return (float)misses / (indices.size() / 3);
+}
+
+// Triangle reordering for vertex locality and reduced overdraw, from
+// "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander et al. 2007):
+// Tipsify for the post-transform cache, then the clusters it produces are sorted
+// to draw first the ones facing out of the mesh. Vertices are then stored in order of first use.
+void Model::optimizeVertexCache() {
+	const int cacheSize = 16;
+	int stride = VD->Bindings[0].stride;
+	int vertexCount = vertices.size() / stride;
+	int triangleCount = indices.size() / 3;
+	if(triangleCount == 0) {
+		return;
+	}
+
+	// Vertex-triangle adjacency
+	std::vector<int> liveTriangles(vertexCount, 0);
+	for(uint32_t v : indices) {
+		liveTriangles[v]++;
+	}
+	std::vector<int> adjacencyOffset(vertexCount + 1, 0);
+	for(int v = 0; v < vertexCount; v++) {
+		adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+	}
+	std::vector<int> adjacency(indices.size());
+	std::vector<int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+	for(int t = 0; t < triangleCount; t++) {
+		for(int c = 0; c < 3; c++) {
+			adjacency[fill[indices[3 * t + c]]++] = t;
+		}
+	}
+
+	// Tipsify
+	std::vector<int> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<int> deadEnd;
+	std::vector<uint32_t> outIndices;
+	std::vector<int> clusterStart;
+	outIndices.reserve(indices.size());
+	int time = cacheSize + 1;
+	int cursor = 0;
+	int fanning = 0;
+	bool newCluster = true;
+
+	while(fanning >= 0) {
+		if(newCluster) {
+			clusterStart.push_back(outIndices.size() / 3);
+		}
+		std::vector<int> candidates;
+		for(int a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; a++) {
+			int t = adjacency[a];
+			if(emitted[t]) {
+				continue;
+			}
+			for(int c = 0; c < 3; c++) {
+				int v = indices[3 * t + c];
+				outIndices.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if(time - cacheTime[v] > cacheSize) {
+					cacheTime[v] = time++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// Next fanning vertex: the candidate still in cache with the most live triangles
+		int next = -1;
+		int bestPriority = -1;
+		for(int v : candidates) {
+			if(liveTriangles[v] > 0) {
+				int priority = 0;
+				if(time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+					priority = time - cacheTime[v];
+				}
+				if(priority > bestPriority) {
+					bestPriority = priority;
+					next = v;
+				}
+			}
+		}
+		newCluster = (next == -1);
+		if(next == -1) {
+			// Dead end: go back to a recently used vertex, or to the next one with live triangles
+			while(!deadEnd.empty() && next == -1) {
+				int d = deadEnd.back();
+				deadEnd.pop_back();
+				if(liveTriangles[d] > 0) {
+					next = d;
+				}
+			}
+			while(next == -1 && cursor < vertexCount) {
+				if(liveTriangles[cursor] > 0) {
+					next = cursor;
+				}
+				cursor++;
+			}
+		}
+		fanning = next;
+	}
+	clusterStart.push_back(triangleCount);
+
+	// Overdraw: clusters facing out of the mesh (from its centroid) are drawn first
+	int positionOffset = VD->Position.offset;
+	auto position = [&](uint32_t v) {
+		return *((glm::vec3 *)(&vertices[v * stride + positionOffset]));
+	};
+	glm::vec3 meshCenter = glm::vec3(0.0f);
+	for(int v = 0; v < vertexCount; v++) {
+		meshCenter += position(v);
+	}
+	meshCenter /= (float)vertexCount;
+
+	int clusterCount = clusterStart.size() - 1;
+	std::vector<float> clusterOrder(clusterCount);
+	for(int k = 0; k < clusterCount; k++) {
+		glm::vec3 center = glm::vec3(0.0f);
+		glm::vec3 normal = glm::vec3(0.0f);
+		float area = 0.0f;
+		for(int t = clusterStart[k]; t < clusterStart[k + 1]; t++) {
+			glm::vec3 p0 = position(outIndices[3 * t]);
+			glm::vec3 p1 = position(outIndices[3 * t + 1]);
+			glm::vec3 p2 = position(outIndices[3 * t + 2]);
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float a = glm::length(n);
+			center += (p0 + p1 + p2) / 3.0f * a;
+			normal += n;
+			area += a;
+		}
+		center = (area > 0.0f) ? center / area : position(outIndices[3 * clusterStart[k]]);
+		float len = glm::length(normal);
+		clusterOrder[k] = (len > 0.0f) ? glm::dot(center - meshCenter, normal / len) : 0.0f;
+	}
+	std::vector<int> clusters(clusterCount);
+	for(int k = 0; k < clusterCount; k++) {
+		clusters[k] = k;
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [&](int a, int b) {
+		return clusterOrder[a] > clusterOrder[b];
+	});
+
+	indices.clear();
+	for(int k : clusters) {
+		indices.insert(indices.end(), outIndices.begin() + 3 * clusterStart[k],
+									  outIndices.begin() + 3 * clusterStart[k + 1]);
+	}
+
+	// Vertices in order of first use, to read the vertex buffer sequentially
+	std::vector<int> remap(vertexCount, -1);
+	std::vector<unsigned char> newVertices;
+	newVertices.reserve(vertices.size());
+	for(uint32_t &v : indices) {
+		if(remap[v] < 0) {
+			remap[v] = newVertices.size() / stride;
+			newVertices.insert(newVertices.end(), vertices.begin() + v * stride,
+											  vertices.begin() + (v + 1) * stride);
+		}
+		v = remap[v];
+	}
+	vertices.swap(newVertices);
 }
 
 void Model::loadModelGLTF(std::string file, bool encoded) {
@@ -2534,33 +4685,53 @@ void Model::loadModelGLTF(std::string file, bool encoded) {
 	if(encoded) {
 		auto modelString = readFile(file);
 		
-		const std::vector<unsigned char> key = plusaes::key_from_string(&"CG2023SkelKey128"); // 16-char = 128-bit
-		const unsigned char iv[16] = {
-			0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
-			0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
-		};
-
-		// decrypt
-		unsigned long padded_size = 0;
-		std::vector<unsigned char> decrypted(modelString.size());
+		// The decoded glTF of the same content is reused from the cache of the previous runs
+		char hashName[17];
+		snprintf(hashName, sizeof(hashName), "%016llx", (unsigned long long)contentHash(modelString));
+		std::string cachedFile = BP->decodedCacheDir + "/" + hashName + ".gltf";
+		std::vector<char> decomp;
+		std::ifstream cached(cachedFile, std::ios::ate | std::ios::binary);
+		if(cached.is_open()) {
+			decomp.resize((size_t)cached.tellg());
+			cached.seekg(0);
+			cached.read(decomp.data(), decomp.size());
+		}
+		
+		if(decomp.empty() || !loader.LoadASCIIFromString(&model, &warn, &err,
+						decomp.data(), decomp.size(), "/")) {
+			const std::vector<unsigned char> key = plusaes::key_from_string(&"CG2023SkelKey128"); // 16-char = 128-bit
+			const unsigned char iv[16] = {
+				0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+				0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+			};
 
-		plusaes::decrypt_cbc((unsigned char*)modelString.data(), modelString.size(), &key[0], key.size(), &iv, &decrypted[0], decrypted.size(), &padded_size);
+			// decrypt
+			std::vector<unsigned char> decrypted(modelString.size());
+			decryptCBC((unsigned char*)modelString.data(), modelString.size(), key, iv, &decrypted[0]);
 
-		int size = 0;
-		void *decomp;
-		
-		sscanf(reinterpret_cast<char *const>(&decrypted[0]), "%d", &size);
-//std::cout << decrypted.size() << ", decomp: " << size << "\n";
-//for(int i=0;i<32;i++) {
-//	std::cout << (int)decrypted[i] << "\n";
-//}
+			int size = 0;
+			sscanf(reinterpret_cast<char *const>(&decrypted[0]), "%d", &size);
 
-		decomp = calloc(size, 1);
-		int n = sinflate(decomp, (int)size, &decrypted[16], decrypted.size()-16);
-		
-		if (!loader.LoadASCIIFromString(&model, &warn, &err, 
-						reinterpret_cast<const char *>(decomp), size, "/")) {
-			throw std::runtime_error(warn + err);
+			decomp.assign(size, 0);
+			sinflate(decomp.data(), (int)size, &decrypted[16], decrypted.size()-16);
+			
+			warn.clear();
+			err.clear();
+			if (!loader.LoadASCIIFromString(&model, &warn, &err, 
+							decomp.data(), size, "/")) {
+				throw std::runtime_error(warn + err);
+			}
+			
+			// Written under a temporary name, so that parallel loads never read a partial file
+			std::error_code ec;
+			std::filesystem::create_directories(BP->decodedCacheDir, ec);
+			std::string tempFile = cachedFile + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+			std::ofstream out(tempFile, std::ios::out | std::ios::binary | std::ios::trunc);
+			if(out.is_open()) {
+				out.write(decomp.data(), decomp.size());
+				out.close();
+				std::filesystem::rename(tempFile, cachedFile, ec);
+			}
 		}
 	} else {
 		if (!loader.LoadASCIIFromFile(&model, &warn, &err, 
@@ -2731,74 +4902,192 @@ void Model::loadModelGLTF(std::string file, bool encoded) {
 		}
 	}
 
+	computeBounds();
+}
+
+// Axis aligned box and enclosing sphere of the vertex positions
+void Model::computeBounds() {
+	int stride = VD->Bindings[0].stride;
+	localBounds = BoundingVolume();
+	if(!VD->Position.hasIt || vertices.size() < static_cast<size_t>(stride)) {
+		// Without positions the mesh is never culled
+		localBounds.radius = std::numeric_limits<float>::max();
+		return;
+	}
+	for(size_t v = 0; v + stride <= vertices.size(); v += stride) {
+		glm::vec3 pos = *((glm::vec3 *)(&vertices[v + VD->Position.offset]));
+		localBounds.aabbMin = (v == 0 ? pos : glm::min(localBounds.aabbMin, pos));
+		localBounds.aabbMax = (v == 0 ? pos : glm::max(localBounds.aabbMax, pos));
+	}
+	localBounds.center = 0.5f * (localBounds.aabbMin + localBounds.aabbMax);
+	for(size_t v = 0; v + stride <= vertices.size(); v += stride) {
+		glm::vec3 pos = *((glm::vec3 *)(&vertices[v + VD->Position.offset]));
+		localBounds.radius = std::max(localBounds.radius, glm::distance(pos, localBounds.center));
+	}
 }
 
 void Model::createVertexBuffer() {
 //	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
 	VkDeviceSize bufferSize = vertices.size();
 
-	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-						vertexBuffer, vertexBufferMemory);
-
-	void* data;
-	vkMapMemory(BP->device, vertexBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, vertices.data(), (size_t) bufferSize);
-	vkUnmapMemory(BP->device, vertexBufferMemory);			
+	// Geometry lives in device local memory, uploaded with the current batch
+	BP->createDeviceLocalBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+						vertices.data(), vertexBuffer, vertexBufferMemory);
 }
 
 void Model::createIndexBuffer() {
 	VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
 
-	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-							 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-							 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-							 indexBuffer, indexBufferMemory);
-
-	void* data;
-	vkMapMemory(BP->device, indexBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), (size_t) bufferSize);
-	vkUnmapMemory(BP->device, indexBufferMemory);
+	BP->createDeviceLocalBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+						indices.data(), indexBuffer, indexBufferMemory);
 }
 
 void Model::initMesh(BaseProject *bp, VertexDescriptor *vd) {
 	BP = bp;
 	VD = vd;
+	source = this;
+	users = 1;
+	geometry = nullptr;
+	geometryFirstIndex = 0;
+	geometryVertexOffset = 0;
+	lodOffsets.clear();
 	int mainStride = VD->Bindings[0].stride;
 	createVertexBuffer();
 	createIndexBuffer();
 }
 
-void Model::init(BaseProject *bp, VertexDescriptor *vd, std::string file, ModelType MT) {
+void Model::init(BaseProject *bp, VertexDescriptor *vd, std::string file, ModelType MT,
+				 GeometryBuffer *geometry, int lodLevels) {
 	BP = bp;
 	VD = vd;
-	if(MT == OBJ) {
-		loadModelOBJ(file);
-	} else if(MT == GLTF) {
-		loadModelGLTF(file, false);
-	} else if(MT == MGCG) {
-		loadModelGLTF(file, true);
+	this->geometry = nullptr;
+	geometryFirstIndex = 0;
+	geometryVertexOffset = 0;
+	this->lodLevels = std::min(std::max(lodLevels, 1), MODEL_LODS);
+	lodOffsets.clear();
+	
+	// The same file with the same vertex format and levels of detail is parsed and uploaded only once:
+	// the other models share the buffers of the first one (or its place in the geometry buffer)
+	auto cached = BP->meshCache.find({file, vd, this->lodLevels});
+	if(cached != BP->meshCache.end()) {
+		source = cached->second;
+		source->users++;
+		return;
+	}
+	source = this;
+	users = 1;
+	BP->meshCache[{file, vd, this->lodLevels}] = this;
+	
+	// The file is parsed on the worker pool if a load batch is open
+	BP->queueLoad([this, file, MT]() { loadMeshData(file, MT); },
+				  [this, geometry]() { createBuffers(geometry); });
+}
+
+void Model::loadMeshData(std::string file, ModelType MT) {
+	// A fresh bake next to the source file replaces the parsing of the source
+	if(MT == BAKED) {
+		if(!loadModelBaked(file, "")) {
+			throw std::runtime_error("invalid baked model: " + file);
+		}
+	} else if(!loadModelBaked(file + ".bake", file)) {
+		if(MT == OBJ) {
+			loadModelOBJ(file);
+		} else if(MT == GLTF) {
+			loadModelGLTF(file, false);
+		} else if(MT == MGCG) {
+			loadModelGLTF(file, true);
+		}
+		// The bake keeps the levels of detail: they are simplified only from the source
+		generateLods(file);
+		if(BP->bakeAssets) {
+			saveModelBaked(file + ".bake", file);
+		}
+	}
+}
+
+// The levels are appended to the indices of the full mesh, they use the same vertices
+void Model::generateLods(std::string file) {
+	if(lodLevels <= 1 || !VD->Position.hasIt || !lodOffsets.empty()) {
+		return;
+	}
+	int stride = VD->Bindings[0].stride;
+	size_t vertexCount = vertices.size() / stride;
+	std::vector<glm::vec3> positions(vertexCount);
+	std::vector<glm::vec2> uvs(vertexCount, glm::vec2(0.0f));
+	for(size_t v = 0; v < vertexCount; v++) {
+		positions[v] = *((glm::vec3 *)(&vertices[v * stride + VD->Position.offset]));
+		if(VD->UV.hasIt) {
+			uvs[v] = *((glm::vec2 *)(&vertices[v * stride + VD->UV.offset]));
+		}
+	}
+	size_t triangleCount = indices.size() / 3;
+	std::vector<size_t> levelTriangles;
+	for(int l = 1; l < lodLevels; l++) {
+		levelTriangles.push_back(triangleCount >> (2 * l));
+	}
+	std::vector<std::vector<uint32_t>> levels = simplifyMesh(positions, uvs, indices, levelTriangles);
+	
+	lodOffsets = {0, static_cast<uint32_t>(indices.size())};
+	for(const std::vector<uint32_t> &level : levels) {
+		indices.insert(indices.end(), level.begin(), level.end());
+		lodOffsets.push_back(static_cast<uint32_t>(indices.size()));
+	}
+	if(BP->printStats) {
+		std::cout << "[ STATS ]: " << file << ": levels of detail of";
+		for(uint32_t l = 0; l < lods(); l++) {
+			std::cout << " " << indexCount(l) / 3;
+		}
+		std::cout << " triangles" << std::endl;
+	}
+}
+
+void Model::createBuffers(GeometryBuffer *geometry) {
+	// Packed meshes are uploaded by the geometry buffer, together with the others
+	if(geometry != nullptr) {
+		geometry->add(this);
+		return;
+	}
+	createVertexBuffer();
+	createIndexBuffer();
+}
+
+void Model::cleanup() {
+	// Shared buffers are released by the last model that uses them
+	Model *owner = source;
+	source = this;
+	if(--owner->users > 0) {
+		return;
+	}
+	for(auto it = BP->meshCache.begin(); it != BP->meshCache.end(); it++) {
+		if(it->second == owner) {
+			BP->meshCache.erase(it);
+			break;
+		}
+	}
+	
+	// Packed meshes are released with their geometry buffer
+	if(owner->geometry != nullptr) {
+		return;
 	}
 	
-	createVertexBuffer();
-	createIndexBuffer();
-}
-
-void Model::cleanup() {
-   	vkDestroyBuffer(BP->device, indexBuffer, nullptr);
-   	vkFreeMemory(BP->device, indexBufferMemory, nullptr);
-	vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
-   	vkFreeMemory(BP->device, vertexBufferMemory, nullptr);
+   	vkDestroyBuffer(BP->device, owner->indexBuffer, nullptr);
+   	BP->memoryAllocator.free(owner->indexBufferMemory);
+	vkDestroyBuffer(BP->device, owner->vertexBuffer, nullptr);
+   	BP->memoryAllocator.free(owner->vertexBufferMemory);
 }
 
+// Packed meshes bind the whole geometry buffer: draw them with firstIndex() and vertexOffset()
 void Model::bind(VkCommandBuffer commandBuffer) {
-	VkBuffer vertexBuffers[] = {vertexBuffer};
+	if(source->geometry != nullptr) {
+		source->geometry->bind(commandBuffer);
+		return;
+	}
+	VkBuffer vertexBuffers[] = {source->vertexBuffer};
 	// property .vertexBuffer of models, contains the VkBuffer handle to its vertex buffer
 	VkDeviceSize offsets[] = {0};
 	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
 	// property .indexBuffer of models, contains the VkBuffer handle to its index buffer
-	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0,
+	vkCmdBindIndexBuffer(commandBuffer, source->indexBuffer, 0,
 							VK_INDEX_TYPE_UINT32);
 }
 
@@ -2807,10 +5096,15 @@ void Model::bind(VkCommandBuffer commandBuffer) {
 
 
 
-void Texture::createTextureImage(std::string files[], VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
-	int texWidth, texHeight, texChannels;
+// Only decodes the images: it does not use Vulkan, so it can run on a worker thread.
+// A fresh baked texture replaces both the decoding and the mip generation
+void Texture::loadTextureImages(std::vector<std::string> files, VkFormat Fmt) {
+	if(imgs == 1 && loadTextureBaked(files[0] + ".dds", files[0])) {
+		return;
+	}
+	
+	int texChannels;
 	int curWidth = -1, curHeight = -1, curChannels = -1;
-	stbi_uc* pixels[maxImgs];
 	
 	for(int i = 0; i < imgs; i++) {
 	 	pixels[i] = stbi_load(files[i].c_str(), &texWidth, &texHeight,
@@ -2832,6 +5126,183 @@ void Texture::createTextureImage(std::string files[], VkFormat Fmt = VK_FORMAT_R
 			}
 		}
 	}
+	if(imgs == 1 && BP->bakeAssets) {
+		saveTextureBaked(files[0] + ".dds", Fmt == VK_FORMAT_R8G8B8A8_SRGB);
+	}
+}
+
+// Returns false if the bake is missing, older than the source or not usable on this device:
+// the caller falls back to the source image. Without BC support BC1 and BC3 are decoded
+// on the CPU, keeping the baked mips (there is no CPU decoder for BC7)
+bool Texture::loadTextureBaked(std::string file, const std::string &sourceFile) {
+	MappedFile mapped;
+	if(!mapped.open(file) || mapped.size < sizeof(DDSHeader)) {
+		return false;
+	}
+	DDSHeader header;
+	memcpy(&header, mapped.data, sizeof(header));
+	if(header.magic != DDS_MAGIC || header.size != sizeof(DDSHeader) - sizeof(uint32_t) ||
+	   header.width == 0 || header.height == 0) {
+		return false;
+	}
+	std::error_code ec;
+	auto sourceTime = std::filesystem::last_write_time(sourceFile, ec);
+	if(!ec && std::filesystem::last_write_time(file, ec) < sourceTime) {
+		return false;
+	}
+	
+	size_t dataOffset = sizeof(header);
+	TextureCompression fileCompression = BC_NONE;
+	if(header.pixelFormat.fourCC == DDS_FOURCC_DXT1) {
+		fileCompression = BC1;
+	} else if(header.pixelFormat.fourCC == DDS_FOURCC_DXT5) {
+		fileCompression = BC3;
+	} else if(header.pixelFormat.fourCC == DDS_FOURCC_DX10 &&
+			  mapped.size >= sizeof(header) + sizeof(DDSHeaderDX10)) {
+		DDSHeaderDX10 headerDX10;
+		memcpy(&headerDX10, mapped.data + sizeof(header), sizeof(headerDX10));
+		dataOffset += sizeof(headerDX10);
+		if(headerDX10.arraySize <= 1) {
+			switch(headerDX10.dxgiFormat) {
+				case 71: case 72: fileCompression = BC1; break;
+				case 77: case 78: fileCompression = BC3; break;
+				case 98: case 99: fileCompression = BC7; break;
+			}
+		}
+	}
+	if(fileCompression == BC_NONE || (fileCompression == BC7 && !BP->textureCompressionBC)) {
+		return false;
+	}
+	
+	int width = header.width, height = header.height;
+	uint32_t fullChain = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+	uint32_t levels = (header.flags & 0x20000) ? std::min(std::max(header.mipMapCount, 1u), fullChain) : 1;
+	size_t totalSize = 0;
+	for(uint32_t level = 0; level < levels; level++) {
+		totalSize += compressedImageSize(std::max(1, width >> level), std::max(1, height >> level),
+										 fileCompression);
+	}
+	if(mapped.size < dataOffset + totalSize) {
+		return false;
+	}
+	
+	texWidth = width;
+	texHeight = height;
+	mipLevels = levels;
+	mipOffsets.clear();
+	const unsigned char *blocks = mapped.data + dataOffset;
+	if(BP->textureCompressionBC) {
+		compression = fileCompression;
+		mipData.assign(blocks, blocks + totalSize);
+		VkDeviceSize offset = 0;
+		for(uint32_t level = 0; level < levels; level++) {
+			mipOffsets.push_back(offset);
+			offset += compressedImageSize(std::max(1, width >> level), std::max(1, height >> level),
+										  fileCompression);
+		}
+	} else {
+		compression = BC_NONE;
+		VkDeviceSize offset = 0;
+		for(uint32_t level = 0; level < levels; level++) {
+			int levelWidth = std::max(1, width >> level), levelHeight = std::max(1, height >> level);
+			mipOffsets.push_back(offset);
+			mipData.resize(offset + static_cast<size_t>(levelWidth) * levelHeight * 4);
+			decompressImageBC(blocks, levelWidth, levelHeight, fileCompression, &mipData[offset]);
+			blocks += compressedImageSize(levelWidth, levelHeight, fileCompression);
+			offset = mipData.size();
+		}
+	}
+	return true;
+}
+
+// The mips are filtered on the CPU, then every level is compressed: BC3 if any texel
+// is not opaque, BC1 otherwise
+void Texture::saveTextureBaked(std::string file, bool srgb) {
+	size_t texelCount = static_cast<size_t>(texWidth) * texHeight;
+	bool alpha = false;
+	for(size_t i = 0; i < texelCount && !alpha; i++) {
+		alpha = pixels[0][i * 4 + 3] < 255;
+	}
+	TextureCompression fileCompression = alpha ? BC3 : BC1;
+	uint32_t levels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+	
+	std::vector<unsigned char> blocks;
+	std::vector<unsigned char> level(pixels[0], pixels[0] + texelCount * 4), nextLevel;
+	int levelWidth = texWidth, levelHeight = texHeight;
+	for(uint32_t l = 0; l < levels; l++) {
+		size_t offset = blocks.size();
+		blocks.resize(offset + compressedImageSize(levelWidth, levelHeight, fileCompression));
+		compressImageBC(level.data(), levelWidth, levelHeight, fileCompression, &blocks[offset]);
+		if(l + 1 < levels) {
+			downsampleRGBA(level.data(), levelWidth, levelHeight, srgb, nextLevel);
+			level.swap(nextLevel);
+			levelWidth = std::max(1, levelWidth / 2);
+			levelHeight = std::max(1, levelHeight / 2);
+		}
+	}
+	
+	DDSHeader header{};
+	header.magic = DDS_MAGIC;
+	header.size = sizeof(DDSHeader) - sizeof(uint32_t);
+	header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;	// caps, size, pixel format, mips, linear size
+	header.height = texHeight;
+	header.width = texWidth;
+	header.linearSize = static_cast<uint32_t>(compressedImageSize(texWidth, texHeight, fileCompression));
+	header.mipMapCount = levels;
+	header.pixelFormat.size = sizeof(DDSPixelFormat);
+	header.pixelFormat.flags = 0x4;	// fourCC
+	header.pixelFormat.fourCC = alpha ? DDS_FOURCC_DXT5 : DDS_FOURCC_DXT1;
+	header.caps[0] = 0x1000 | 0x400000 | 0x8;	// texture, mipmap, complex
+	
+	std::ofstream out(file, std::ios::out | std::ios::binary | std::ios::trunc);
+	if(!out.is_open()) {
+		std::cout << "[ ERROR ]: Cannot write " << file << std::endl;
+		return;
+	}
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)blocks.data(), blocks.size());
+	if(BP->printStats) {
+		std::cout << "[ STATS ]: Baked " << file << " (" << (alpha ? "BC3" : "BC1") << ", "
+				  << levels << " mips, " << (sizeof(header) + blocks.size()) / 1024 << " KB)" << std::endl;
+	}
+}
+
+// Format of the Vulkan image: the block compressed variant of Fmt for the baked textures
+VkFormat Texture::imageFormat(VkFormat Fmt) {
+	bool srgb = (Fmt == VK_FORMAT_R8G8B8A8_SRGB);
+	switch(compression) {
+		case BC1:
+			return srgb ? VK_FORMAT_BC1_RGBA_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+		case BC3:
+			return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+		case BC7:
+			return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+		default:
+			return Fmt;
+	}
+}
+
+void Texture::createTextureImage(VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
+	// A baked texture brings its mip chain: every level is copied, nothing is blitted
+	if(!mipData.empty()) {
+		VkFormat format = imageFormat(Fmt);
+		VkBuffer stagingBuffer;
+		MemoryAllocation stagingBufferMemory;
+		BP->createBuffer(mipData.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+								VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+								VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+								stagingBuffer, stagingBufferMemory);
+		memcpy(stagingBufferMemory.mapped, mipData.data(), mipData.size());
+		
+		BP->createImage(texWidth, texHeight, mipLevels, 1, VK_SAMPLE_COUNT_1_BIT, format,
+					VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+					0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+		BP->uploadImage(stagingBuffer, stagingBufferMemory, mipData.size(), textureImage, format,
+						texWidth, texHeight, mipLevels, 1, mipOffsets);
+		std::vector<unsigned char>().swap(mipData);
+		mipOffsets.clear();
+		return;
+	}
 	
 	VkDeviceSize imageSize = texWidth * texHeight * 4;
 	VkDeviceSize totalImageSize = texWidth * texHeight * 4 * imgs;
@@ -2839,19 +5310,17 @@ void Texture::createTextureImage(std::string files[], VkFormat Fmt = VK_FORMAT_R
 					std::log2(std::max(texWidth, texHeight)))) + 1;
 	
 	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+	MemoryAllocation stagingBufferMemory;
 	 
 	BP->createBuffer(totalImageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 	  						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 	  						VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 	  						stagingBuffer, stagingBufferMemory);
-	void* data;
-	vkMapMemory(BP->device, stagingBufferMemory, 0, totalImageSize, 0, &data);
+	void* data = stagingBufferMemory.mapped;
 	for(int i = 0; i < imgs; i++) {
 		memcpy(static_cast<char *>(data) + imageSize * i, pixels[i], static_cast<size_t>(imageSize));
 		stbi_image_free(pixels[i]);
 	}
-	vkUnmapMemory(BP->device, stagingBufferMemory);
 	
 	
 	BP->createImage(texWidth, texHeight, mipLevels, imgs, VK_SAMPLE_COUNT_1_BIT, Fmt,
@@ -2861,21 +5330,14 @@ void Texture::createTextureImage(std::string files[], VkFormat Fmt = VK_FORMAT_R
 				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage,
 				textureImageMemory);
 				
-	BP->transitionImageLayout(textureImage, Fmt,
-			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, imgs);
-	BP->copyBufferToImage(stagingBuffer, textureImage,
-			static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), imgs);
-
-	BP->generateMipmaps(textureImage, Fmt,
+	// Recorded in the open upload batch, the staging buffer is freed after its fence
+	BP->uploadImage(stagingBuffer, stagingBufferMemory, totalImageSize, textureImage, Fmt,
 					texWidth, texHeight, mipLevels, imgs);
-
-	vkDestroyBuffer(BP->device, stagingBuffer, nullptr);
-	vkFreeMemory(BP->device, stagingBufferMemory, nullptr);
 }
 
 void Texture::createTextureImageView(VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB) {
 	textureImageView = BP->createImageView(textureImage,
-									   Fmt,
+									   imageFormat(Fmt),
 									   VK_IMAGE_ASPECT_COLOR_BIT,
 									   mipLevels,
 									   imgs == 6 ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D,
@@ -2920,24 +5382,31 @@ void Texture::createTextureSampler(
 	
 
 
+// The image is decoded on the worker pool if a load batch is open
 void Texture::init(BaseProject *bp, std::string file, VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB, bool initSampler = true) {
-	std::string files[1] = {file};
 	BP = bp;
 	imgs = 1;
-	createTextureImage(files, Fmt);
-	createTextureImageView(Fmt);
-	if(initSampler) {
-		createTextureSampler();
-	}
+	BP->queueLoad([this, file, Fmt]() { loadTextureImages({file}, Fmt); },
+				  [this, Fmt, initSampler]() {
+		createTextureImage(Fmt);
+		createTextureImageView(Fmt);
+		if(initSampler) {
+			createTextureSampler();
+		}
+	});
 }
 
 
 void Texture::initCubic(BaseProject *bp, std::string files[6]) {
 	BP = bp;
 	imgs = 6;
-	createTextureImage(files);
-	createTextureImageView();
-	createTextureSampler();
+	std::vector<std::string> faces(files, files + 6);
+	BP->queueLoad([this, faces]() { loadTextureImages(faces, VK_FORMAT_R8G8B8A8_SRGB); },
+				  [this]() {
+		createTextureImage();
+		createTextureImageView();
+		createTextureSampler();
+	});
 }
 
 
@@ -2945,7 +5414,7 @@ void Texture::cleanup() {
    	vkDestroySampler(BP->device, textureSampler, nullptr);
    	vkDestroyImageView(BP->device, textureImageView, nullptr);
 	vkDestroyImage(BP->device, textureImage, nullptr);
-	vkFreeMemory(BP->device, textureImageMemory, nullptr);
+	BP->memoryAllocator.free(textureImageMemory);
 }
 
 
@@ -2958,18 +5427,15 @@ void Pipeline::init(BaseProject *bp, VertexDescriptor *vd,
 	BP = bp;
 	VD = vd;
 	
-	auto vertShaderCode = readFile(VertShader);
-	auto fragShaderCode = readFile(FragShader);
-	
-	vertShaderModule =
-			createShaderModule(vertShaderCode);
-	fragShaderModule =
-			createShaderModule(fragShaderCode);
+	// Pipelines using the same files share the modules
+	vertShaderModule = BP->shaderModule(VertShader);
+	fragShaderModule = BP->shaderModule(FragShader);
 
  	compareOp = VK_COMPARE_OP_LESS;
  	polyModel = VK_POLYGON_MODE_FILL;
  	CM = VK_CULL_MODE_BACK_BIT;
  	transp = false;
+	pushConstantSize = 0;
 
 	D = d;
 }
@@ -3106,8 +5572,12 @@ void Pipeline::create() {
 		VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutInfo.setLayoutCount = DSL.size();
 	pipelineLayoutInfo.pSetLayouts = DSL.data();
-	pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-	pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = pushConstantSize;
+	pipelineLayoutInfo.pushConstantRangeCount = (pushConstantSize > 0) ? 1 : 0;
+	pipelineLayoutInfo.pPushConstantRanges = (pushConstantSize > 0) ? &pushConstantRange : nullptr;
 	
 	VkResult result = vkCreatePipelineLayout(BP->device, &pipelineLayoutInfo, nullptr,
 				&pipelineLayout);
@@ -3148,18 +5618,23 @@ void Pipeline::create() {
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
 	pipelineInfo.basePipelineIndex = -1; // Optional
 	
-	result = vkCreateGraphicsPipelines(BP->device, VK_NULL_HANDLE, 1,
+	auto startTime = std::chrono::high_resolution_clock::now();
+	result = vkCreateGraphicsPipelines(BP->device, BP->pipelineCache, 1,
 			&pipelineInfo, nullptr, &graphicsPipeline);
 	if (result != VK_SUCCESS) {
 	 	PrintVkError(result);
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
+	auto endTime = std::chrono::high_resolution_clock::now();
+	BP->pipelineCreateTime += std::chrono::duration<float, std::chrono::milliseconds::period>
+									(endTime - startTime).count();
 	
 }
 
+// The shader modules are shared: they are destroyed with the cache of the project
 void Pipeline::destroy() {
-	vkDestroyShaderModule(BP->device, fragShaderModule, nullptr);
-	vkDestroyShaderModule(BP->device, vertShaderModule, nullptr);
+	vertShaderModule = VK_NULL_HANDLE;
+	fragShaderModule = VK_NULL_HANDLE;
 }	
 
 void Pipeline::bind(VkCommandBuffer commandBuffer) {
@@ -3169,22 +5644,15 @@ void Pipeline::bind(VkCommandBuffer commandBuffer) {
 
 }
 
-VkShaderModule Pipeline::createShaderModule(const std::vector<char>& code) {
-	VkShaderModuleCreateInfo createInfo{};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-	
-	VkShaderModule shaderModule;
+// Push constants are visible to both shaders, starting from offset 0
+void Pipeline::setPushConstants(uint32_t size) {
+	pushConstantSize = size;
+}
 
-	VkResult result = vkCreateShaderModule(BP->device, &createInfo, nullptr,
-					&shaderModule);
-	if (result != VK_SUCCESS) {
-	 	PrintVkError(result);
-		throw std::runtime_error("failed to create shader module!");
-	}
-	
-	return shaderModule;
+void Pipeline::push(VkCommandBuffer commandBuffer, const void *data) {
+	vkCmdPushConstants(commandBuffer, pipelineLayout,
+					   VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+					   0, pushConstantSize, data);
 }
 
 void Pipeline::cleanup() {
@@ -3200,7 +5668,7 @@ void DescriptorSetLayout::init(BaseProject *bp, std::vector<DescriptorSetLayoutB
 	for(int i = 0; i < B.size(); i++) {
 		bindings[i].binding = B[i].binding;
 		bindings[i].descriptorType = B[i].type;
-		bindings[i].descriptorCount = 1;
+		bindings[i].descriptorCount = B[i].count;
 		bindings[i].stageFlags = B[i].flags;
 		bindings[i].pImmutableSamplers = nullptr;
 	}
@@ -3229,17 +5697,33 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 	uniformBuffers.resize(E.size());
 	uniformBuffersMemory.resize(E.size());
 	toFree.resize(E.size());
+	types.resize(E.size());
+	uniformOffsets.resize(E.size());
+	dynamicBindings.clear();
 
 	for (int j = 0; j < E.size(); j++) {
 		uniformBuffers[j].resize(BP->swapChainImages.size());
 		uniformBuffersMemory[j].resize(BP->swapChainImages.size());
-		if(E[j].type == UNIFORM) {
+		types[j] = E[j].type;
+		if(E[j].type == UNIFORM || E[j].type == STORAGE) {
+			// Uniforms (and storage buffers) updated every frame live in the persistently mapped ring buffer:
+			// the same range is reserved in the segment of each swapchain image,
+			// and the segment is selected by the dynamic offset passed in bind()
+			uniformOffsets[j] = BP->uniformRing.reserve(E[j].size);
+			dynamicBindings.push_back(E[j].binding);
 			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
-				VkDeviceSize bufferSize = E[j].size;
-				BP->createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-									 	 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-									 	 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-									 	 uniformBuffers[j][i], uniformBuffersMemory[j][i]);
+				uniformBuffers[j][i] = BP->uniformRing.buffer;
+			}
+			toFree[j] = false;
+		} else if(E[j].type == STATIC_UNIFORM || E[j].type == STATIC_STORAGE) {
+			// Data that never changes is uploaded once in device local memory,
+			// and the same buffer is shared by all the swapchain images
+			BP->createDeviceLocalBuffer(E[j].size, (E[j].type == STATIC_UNIFORM) ?
+								VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT : VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+								E[j].data, uniformBuffers[j][0], uniformBuffersMemory[j][0]);
+			for (size_t i = 1; i < BP->swapChainImages.size(); i++) {
+				uniformBuffers[j][i] = uniformBuffers[j][0];
+				uniformBuffersMemory[j][i] = uniformBuffersMemory[j][0];
 			}
 			toFree[j] = true;
 		} else {
@@ -3247,15 +5731,17 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 		}
 	}
 	
-	std::vector<VkDescriptorSetLayout> layouts(BP->swapChainImages.size(),
-											   DSL->descriptorSetLayout);
+	// Dynamic offsets are consumed in binding order
+	std::sort(dynamicBindings.begin(), dynamicBindings.end());
+	
+	std::vector<VkDescriptorSetLayout> layouts(1, DSL->descriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = BP->descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(BP->swapChainImages.size());
+	allocInfo.descriptorSetCount = 1;
 	allocInfo.pSetLayouts = layouts.data();
 	
-	descriptorSets.resize(BP->swapChainImages.size());
+	descriptorSets.resize(1);
 	
 	VkResult result = vkAllocateDescriptorSets(BP->device, &allocInfo,
 										descriptorSets.data());
@@ -3264,50 +5750,75 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 		throw std::runtime_error("failed to allocate descriptor sets!");
 	}
 	
-	for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
-		std::vector<VkWriteDescriptorSet> descriptorWrites(E.size());
-		std::vector<VkDescriptorBufferInfo> bufferInfo(E.size());
-		std::vector<VkDescriptorImageInfo> imageInfo(E.size());
-		for (int j = 0; j < E.size(); j++) {
-			if(E[j].type == UNIFORM) {
-				bufferInfo[j].buffer = uniformBuffers[j][i];
-				bufferInfo[j].offset = 0;
-				bufferInfo[j].range = E[j].size;
-				
-				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				descriptorWrites[j].dstSet = descriptorSets[i];
-				descriptorWrites[j].dstBinding = E[j].binding;
-				descriptorWrites[j].dstArrayElement = 0;
-				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-				descriptorWrites[j].descriptorCount = 1;
-				descriptorWrites[j].pBufferInfo = &bufferInfo[j];
-			} else if(E[j].type == TEXTURE) {
-				imageInfo[j].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-				imageInfo[j].imageView = E[j].tex->textureImageView;
-				imageInfo[j].sampler = E[j].tex->textureSampler;
-		
-				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				descriptorWrites[j].dstSet = descriptorSets[i];
-				descriptorWrites[j].dstBinding = E[j].binding;
-				descriptorWrites[j].dstArrayElement = 0;
-				descriptorWrites[j].descriptorType =
-											VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				descriptorWrites[j].descriptorCount = 1;
-				descriptorWrites[j].pImageInfo = &imageInfo[j];
+	std::vector<VkWriteDescriptorSet> descriptorWrites(E.size());
+	std::vector<VkDescriptorBufferInfo> bufferInfo(E.size());
+	std::vector<VkDescriptorImageInfo> imageInfo(E.size());
+	std::vector<std::vector<VkDescriptorImageInfo>> imageArrayInfo(E.size());
+	for (int j = 0; j < E.size(); j++) {
+		if(E[j].type == UNIFORM || E[j].type == STATIC_UNIFORM || E[j].type == STATIC_STORAGE ||
+		   E[j].type == STORAGE) {
+			bufferInfo[j].buffer = uniformBuffers[j][0];
+			bufferInfo[j].offset = (E[j].type == UNIFORM || E[j].type == STORAGE) ? uniformOffsets[j] : 0;
+			bufferInfo[j].range = E[j].size;
+			
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = descriptorSets[0];
+			descriptorWrites[j].dstBinding = E[j].binding;
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType = (E[j].type == UNIFORM) ?
+										VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC :
+										((E[j].type == STORAGE) ?
+										VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC :
+										((E[j].type == STATIC_UNIFORM) ?
+										VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER :
+										VK_DESCRIPTOR_TYPE_STORAGE_BUFFER));
+			descriptorWrites[j].descriptorCount = 1;
+			descriptorWrites[j].pBufferInfo = &bufferInfo[j];
+		} else if(E[j].type == TEXTURE) {
+			imageInfo[j].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			imageInfo[j].imageView = E[j].tex->textureImageView;
+			imageInfo[j].sampler = E[j].tex->textureSampler;
+	
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = descriptorSets[0];
+			descriptorWrites[j].dstBinding = E[j].binding;
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType =
+										VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[j].descriptorCount = 1;
+			descriptorWrites[j].pImageInfo = &imageInfo[j];
+		} else if(E[j].type == TEXTURE_ARRAY) {
+			// All the textures of the array are written in a single descriptor write
+			imageArrayInfo[j].resize(E[j].textures.size());
+			for(size_t t = 0; t < E[j].textures.size(); t++) {
+				imageArrayInfo[j][t].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				imageArrayInfo[j][t].imageView = E[j].textures[t]->textureImageView;
+				imageArrayInfo[j][t].sampler = E[j].textures[t]->textureSampler;
 			}
-		}		
-		vkUpdateDescriptorSets(BP->device,
-						static_cast<uint32_t>(descriptorWrites.size()),
-						descriptorWrites.data(), 0, nullptr);
-	}
+	
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = descriptorSets[0];
+			descriptorWrites[j].dstBinding = E[j].binding;
+			descriptorWrites[j].dstArrayElement = 0;
+			descriptorWrites[j].descriptorType =
+										VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			descriptorWrites[j].descriptorCount = static_cast<uint32_t>(imageArrayInfo[j].size());
+			descriptorWrites[j].pImageInfo = imageArrayInfo[j].data();
+		}
+	}		
+	vkUpdateDescriptorSets(BP->device,
+					static_cast<uint32_t>(descriptorWrites.size()),
+					descriptorWrites.data(), 0, nullptr);
 }
 
 void DescriptorSet::cleanup() {
 	for(int j = 0; j < uniformBuffers.size(); j++) {
 		if(toFree[j]) {
-			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+			size_t count = (types[j] == STATIC_UNIFORM || types[j] == STATIC_STORAGE) ?
+								1 : BP->swapChainImages.size();
+			for (size_t i = 0; i < count; i++) {
 				vkDestroyBuffer(BP->device, uniformBuffers[j][i], nullptr);
-				vkFreeMemory(BP->device, uniformBuffersMemory[j][i], nullptr);
+				BP->memoryAllocator.free(uniformBuffersMemory[j][i]);
 			}
 		}
 	}
@@ -3315,17 +5826,666 @@ void DescriptorSet::cleanup() {
 
 void DescriptorSet::bind(VkCommandBuffer commandBuffer, Pipeline &P, int setId,
 						 int currentImage) {
+	std::vector<uint32_t> dynamicOffsets(dynamicBindings.size(),
+			static_cast<uint32_t>(BP->uniformRing.descriptorOffset(currentImage, 0)));
 	vkCmdBindDescriptorSets(commandBuffer,
 					VK_PIPELINE_BIND_POINT_GRAPHICS,
-					P.pipelineLayout, setId, 1, &descriptorSets[currentImage],
-					0, nullptr);
+					P.pipelineLayout, setId, 1, &descriptorSets[0],
+					static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
 }
 
 void DescriptorSet::map(int currentImage, void *src, int size, int slot) {
-	void* data;
+	BP->uniformRing.write(currentImage, uniformOffsets[slot], src, size);
+}
+
+void UniformRing::init(BaseProject *bp, VkDeviceSize size, int frameCount) {
+	BP = bp;
+
+	VkPhysicalDeviceProperties properties{};
+	vkGetPhysicalDeviceProperties(BP->physicalDevice, &properties);
+	alignment = std::max<VkDeviceSize>(std::max(properties.limits.minUniformBufferOffsetAlignment,
+									   properties.limits.minStorageBufferOffsetAlignment), 16);
+
+	frameSize = alignUp(size);
+	frames = frameCount;
+	reserved = 0;
+	frameOffset = 0;
+	currentImage = 0;
+	bytesWritten = 0;
+	lastFrameBytes = 0;
+
+	BP->createBuffer(frameSize * frames, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+					 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+					 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+					 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					 buffer, bufferMemory);
+
+	// The ring stays mapped for its whole life: writes are plain memcpy
+	mapped = bufferMemory.mapped;
+}
+
+VkDeviceSize UniformRing::alignUp(VkDeviceSize size) {
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+// Reserves a range with the same offset in the segment of every swapchain image
+VkDeviceSize UniformRing::reserve(VkDeviceSize size) {
+	VkDeviceSize offset = reserved;
+	if(offset + size > frameSize) {
+		throw std::runtime_error("uniform ring buffer is too small, increase uniformBytesPerFrame!");
+	}
+	reserved += alignUp(size);
+	frameOffset = reserved;
+	return offset;
+}
+
+// Sub-allocates a range valid only for the current frame, after the reserved ones
+UniformAllocation UniformRing::allocate(VkDeviceSize size) {
+	VkDeviceSize offset = frameOffset;
+	if(offset + size > frameSize) {
+		throw std::runtime_error("uniform ring buffer is full!");
+	}
+	frameOffset += alignUp(size);
+	bytesWritten += size;
+
+	UniformAllocation A;
+	A.offset = currentImage * frameSize + offset;
+	A.data = mapped + A.offset;
+	return A;
+}
+
+VkDeviceSize UniformRing::descriptorOffset(int currentImage, VkDeviceSize offset) {
+	return currentImage * frameSize + offset;
+}
+
+void UniformRing::write(int currentImage, VkDeviceSize offset, const void *src, VkDeviceSize size) {
+	memcpy(mapped + descriptorOffset(currentImage, offset), src, size);
+	bytesWritten += size;
+}
+
+void UniformRing::beginFrame(int currentImage) {
+	this->currentImage = currentImage;
+	frameOffset = reserved;
+	lastFrameBytes = bytesWritten;
+	bytesWritten = 0;
+}
+
+void UniformRing::cleanup() {
+	vkDestroyBuffer(BP->device, buffer, nullptr);
+	BP->memoryAllocator.free(bufferMemory);
+}
+
+void MemoryAllocator::init(BaseProject *bp, VkDeviceSize size) {
+	BP = bp;
+	blockSize = size;
+	blocks.clear();
+	deviceAllocations = 0;
+	liveAllocations = 0;
+	bytesUsed = 0;
+
+	vkGetPhysicalDeviceMemoryProperties(BP->physicalDevice, &memProperties);
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter,
+										 VkMemoryPropertyFlags properties) {
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) &&
+			(memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+// Buffers and linear images never share a block with optimal images, so
+// bufferImageGranularity cannot be violated by two neighbouring resources
+MemoryAllocation MemoryAllocator::allocate(VkMemoryRequirements memRequirements,
+										   VkMemoryPropertyFlags properties, bool linear) {
+	uint32_t memoryType = findMemoryType(memRequirements.memoryTypeBits, properties);
+	MemoryAllocation A;
+
+	for(size_t b = 0; b < blocks.size(); b++) {
+		if(blocks[b].memory != VK_NULL_HANDLE && !blocks[b].dedicated &&
+		   blocks[b].memoryType == memoryType && blocks[b].linear == linear &&
+		   allocateFromBlock(b, memRequirements, A)) {
+			return A;
+		}
+	}
+
+	// Resources larger than a block get a block of their own
+	VkDeviceSize size = std::max(blockSize, memRequirements.size);
+	int b = createBlock(size, memoryType, linear);
+	blocks[b].dedicated = size > blockSize;
+	if(!allocateFromBlock(b, memRequirements, A)) {
+		throw std::runtime_error("failed to allocate memory from a new block!");
+	}
+	return A;
+}
+
+// First fit in the sorted free list of the block
+bool MemoryAllocator::allocateFromBlock(int b, VkMemoryRequirements memRequirements,
+										MemoryAllocation &A) {
+	MemoryBlock &B = blocks[b];
+	VkDeviceSize alignment = std::max<VkDeviceSize>(memRequirements.alignment, 1);
+
+	for(size_t i = 0; i < B.freeRanges.size(); i++) {
+		VkDeviceSize start = B.freeRanges[i].first;
+		VkDeviceSize end = start + B.freeRanges[i].second;
+		VkDeviceSize offset = (start + alignment - 1) / alignment * alignment;
+		if(offset + memRequirements.size > end) {
+			continue;
+		}
+
+		// The alignment padding stays in the free list, and is merged back on free
+		B.freeRanges.erase(B.freeRanges.begin() + i);
+		if(offset + memRequirements.size < end) {
+			B.freeRanges.insert(B.freeRanges.begin() + i,
+						{offset + memRequirements.size, end - offset - memRequirements.size});
+		}
+		if(offset > start) {
+			B.freeRanges.insert(B.freeRanges.begin() + i, {start, offset - start});
+		}
+
+		A.memory = B.memory;
+		A.offset = offset;
+		A.size = memRequirements.size;
+		A.block = b;
+		A.mapped = B.mapped ? B.mapped + offset : nullptr;
+
+		B.allocations++;
+		liveAllocations++;
+		bytesUsed += A.size;
+		return true;
+	}
+	return false;
+}
+
+int MemoryAllocator::createBlock(VkDeviceSize size, uint32_t memoryType, bool linear) {
+	MemoryBlock B{};
+	B.size = size;
+	B.memoryType = memoryType;
+	B.linear = linear;
+	B.dedicated = false;
+	B.mapped = nullptr;
+	B.allocations = 0;
+	B.freeRanges.push_back({0, size});
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	VkResult result = vkAllocateMemory(BP->device, &allocInfo, nullptr, &B.memory);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to allocate memory block!");
+	}
+	deviceAllocations++;
+
+	// Host visible blocks are mapped once, for their whole life
+	if(memProperties.memoryTypes[memoryType].propertyFlags &
+							VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		void *data;
+		result = vkMapMemory(BP->device, B.memory, 0, VK_WHOLE_SIZE, 0, &data);
+		if (result != VK_SUCCESS) {
+			PrintVkError(result);
+			throw std::runtime_error("failed to map memory block!");
+		}
+		B.mapped = (unsigned char *)data;
+	}
+
+	// Reuse the slot of a released block, so the indices of the others stay valid
+	for(size_t b = 0; b < blocks.size(); b++) {
+		if(blocks[b].memory == VK_NULL_HANDLE) {
+			blocks[b] = B;
+			return b;
+		}
+	}
+	blocks.push_back(B);
+	return blocks.size() - 1;
+}
+
+void MemoryAllocator::free(MemoryAllocation &A) {
+	if(A.block < 0) {
+		return;
+	}
+	MemoryBlock &B = blocks[A.block];
+
+	// Insert the range keeping the list sorted, then merge it with its neighbours
+	size_t i = 0;
+	while(i < B.freeRanges.size() && B.freeRanges[i].first < A.offset) {
+		i++;
+	}
+	B.freeRanges.insert(B.freeRanges.begin() + i, {A.offset, A.size});
+	if(i + 1 < B.freeRanges.size() &&
+	   B.freeRanges[i].first + B.freeRanges[i].second == B.freeRanges[i + 1].first) {
+		B.freeRanges[i].second += B.freeRanges[i + 1].second;
+		B.freeRanges.erase(B.freeRanges.begin() + i + 1);
+	}
+	if(i > 0 &&
+	   B.freeRanges[i - 1].first + B.freeRanges[i - 1].second == B.freeRanges[i].first) {
+		B.freeRanges[i - 1].second += B.freeRanges[i].second;
+		B.freeRanges.erase(B.freeRanges.begin() + i);
+	}
+
+	B.allocations--;
+	liveAllocations--;
+	bytesUsed -= A.size;
+
+	// Shared blocks are kept for later allocations, dedicated ones are released
+	if(B.dedicated && B.allocations == 0) {
+		if(B.mapped) {
+			vkUnmapMemory(BP->device, B.memory);
+		}
+		vkFreeMemory(BP->device, B.memory, nullptr);
+		B.memory = VK_NULL_HANDLE;
+		B.freeRanges.clear();
+		deviceAllocations--;
+	}
+
+	A.block = -1;
+	A.memory = VK_NULL_HANDLE;
+	A.mapped = nullptr;
+}
+
+void MemoryAllocator::printStats() {
+	VkDeviceSize bytesReserved = 0;
+	int largestFreeRanges = 0;
+	for(size_t b = 0; b < blocks.size(); b++) {
+		if(blocks[b].memory != VK_NULL_HANDLE) {
+			bytesReserved += blocks[b].size;
+			largestFreeRanges = std::max(largestFreeRanges, (int)blocks[b].freeRanges.size());
+		}
+	}
+	std::cout << "[ STATS ]: Device memory: " << deviceAllocations << " blocks, "
+			  << liveAllocations << " allocations, "
+			  << bytesUsed / 1024 << " KB used of " << bytesReserved / 1024 << " KB, "
+			  << "at most " << largestFreeRanges << " free ranges per block" << std::endl;
+}
+
+void MemoryAllocator::cleanup() {
+	for(size_t b = 0; b < blocks.size(); b++) {
+		if(blocks[b].memory != VK_NULL_HANDLE) {
+			if(blocks[b].mapped) {
+				vkUnmapMemory(BP->device, blocks[b].memory);
+			}
+			vkFreeMemory(BP->device, blocks[b].memory, nullptr);
+		}
+	}
+	blocks.clear();
+}
+
+void WorkerPool::init(int threadCount) {
+	stopping = false;
+	for(int t = 0; t < threadCount; t++) {
+		threads.emplace_back(&WorkerPool::workerLoop, this);
+	}
+}
+
+void WorkerPool::workerLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true) {
+		workAvailable.wait(lock, [this]() { return stopping || nextJob < jobs.size(); });
+		if(stopping) {
+			return;
+		}
+		
+		std::function<void()> &job = jobs[nextJob++];
+		runningJobs++;
+		lock.unlock();
+		try {
+			job();
+		} catch(...) {
+			std::lock_guard<std::mutex> errorLock(mutex);
+			if(!error) {
+				error = std::current_exception();
+			}
+		}
+		lock.lock();
+		runningJobs--;
+		if(runningJobs == 0 && nextJob == jobs.size()) {
+			workDone.notify_all();
+		}
+	}
+}
+
+void WorkerPool::run(std::vector<std::function<void()>> &newJobs) {
+	start(newJobs);
+	wait();
+}
+
+void WorkerPool::start(std::vector<std::function<void()>> &newJobs) {
+	if(newJobs.empty()) {
+		return;
+	}
+	// Without threads (or for a single job) there is nothing to gain from the pool
+	if(threads.empty() || newJobs.size() == 1) {
+		for(auto &job : newJobs) {
+			job();
+		}
+		return;
+	}
+	
+	std::lock_guard<std::mutex> lock(mutex);
+	jobs = std::move(newJobs);
+	nextJob = 0;
+	error = nullptr;
+	workAvailable.notify_all();
+}
+
+void WorkerPool::wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	workDone.wait(lock, [this]() { return runningJobs == 0 && nextJob == jobs.size(); });
+	jobs.clear();
+	nextJob = 0;
+	
+	if(error) {
+		std::exception_ptr e = error;
+		error = nullptr;
+		std::rethrow_exception(e);
+	}
+}
+
+void WorkerPool::cleanup() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+	for(auto &t : threads) {
+		t.join();
+	}
+	threads.clear();
+}
+
+// Planes are extracted from the rows of the view-projection matrix (Gribb & Hartmann),
+// with the near plane at z = 0 (GLM_FORCE_DEPTH_ZERO_TO_ONE), and normalized
+void Frustum::fromMatrix(const glm::mat4 &ViewPrj) {
+	glm::vec4 r0 = glm::vec4(ViewPrj[0][0], ViewPrj[1][0], ViewPrj[2][0], ViewPrj[3][0]);
+	glm::vec4 r1 = glm::vec4(ViewPrj[0][1], ViewPrj[1][1], ViewPrj[2][1], ViewPrj[3][1]);
+	glm::vec4 r2 = glm::vec4(ViewPrj[0][2], ViewPrj[1][2], ViewPrj[2][2], ViewPrj[3][2]);
+	glm::vec4 r3 = glm::vec4(ViewPrj[0][3], ViewPrj[1][3], ViewPrj[2][3], ViewPrj[3][3]);
+	
+	// Left, right, bottom, top, near, far, and two planes that accept everything
+	glm::vec4 planes[8] = {r3 + r0, r3 - r0, r3 + r1, r3 - r1, r2, r3 - r2,
+						   glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)};
+	for(int p = 0; p < 6; p++) {
+		planes[p] /= glm::length(glm::vec3(planes[p]));
+	}
+	for(int g = 0; g < 2; g++) {
+		a[g] = glm::vec4(planes[4*g].x, planes[4*g+1].x, planes[4*g+2].x, planes[4*g+3].x);
+		b[g] = glm::vec4(planes[4*g].y, planes[4*g+1].y, planes[4*g+2].y, planes[4*g+3].y);
+		c[g] = glm::vec4(planes[4*g].z, planes[4*g+1].z, planes[4*g+2].z, planes[4*g+3].z);
+		d[g] = glm::vec4(planes[4*g].w, planes[4*g+1].w, planes[4*g+2].w, planes[4*g+3].w);
+	}
+}
+
+bool Frustum::sphereVisible(glm::vec3 center, float radius) const {
+	for(int g = 0; g < 2; g++) {
+		glm::vec4 dist = a[g] * center.x + b[g] * center.y + c[g] * center.z + d[g];
+		if(glm::any(glm::lessThan(dist, glm::vec4(-radius)))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The box is outside if, for some plane, its corner farthest along the plane normal is behind it
+bool Frustum::boxVisible(glm::vec3 bbMin, glm::vec3 bbMax) const {
+	for(int g = 0; g < 2; g++) {
+		glm::vec4 x = glm::mix(glm::vec4(bbMin.x), glm::vec4(bbMax.x), glm::greaterThanEqual(a[g], glm::vec4(0.0f)));
+		glm::vec4 y = glm::mix(glm::vec4(bbMin.y), glm::vec4(bbMax.y), glm::greaterThanEqual(b[g], glm::vec4(0.0f)));
+		glm::vec4 z = glm::mix(glm::vec4(bbMin.z), glm::vec4(bbMax.z), glm::greaterThanEqual(c[g], glm::vec4(0.0f)));
+		glm::vec4 dist = a[g] * x + b[g] * y + c[g] * z + d[g];
+		if(glm::any(glm::lessThan(dist, glm::vec4(0.0f)))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+VkDrawIndexedIndirectCommand Model::drawCommand(uint32_t instanceCount, uint32_t firstInstance, uint32_t lod) {
+	VkDrawIndexedIndirectCommand command{};
+	command.indexCount = indexCount(lod);
+	command.instanceCount = instanceCount;
+	command.firstIndex = firstIndex(lod);
+	command.vertexOffset = vertexOffset();
+	command.firstInstance = firstInstance;
+	return command;
+}
+
+void GeometryBuffer::init(BaseProject *bp, VertexDescriptor *vd) {
+	BP = bp;
+	VD = vd;
+	meshes.clear();
+	vertexBytes = 0;
+	indexCount = 0;
+	created = false;
+}
+
+// The mesh keeps its data on the CPU: it is copied in place when the buffer is created
+void GeometryBuffer::add(Model *M) {
+	M->geometry = this;
+	M->geometryFirstIndex = indexCount;
+	M->geometryVertexOffset = static_cast<int32_t>(vertexBytes / VD->Bindings[0].stride);
+	vertexBytes += M->vertices.size();
+	indexCount += static_cast<uint32_t>(M->indices.size());
+	meshes.push_back(M);
+}
+
+void GeometryBuffer::create() {
+	if(meshes.empty()) {
+		return;
+	}
+	BP->createBuffer(vertexBytes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+	BP->createBuffer(indexCount * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+	
+	// One copy region per mesh (a single submission if an upload batch is open)
+	for(Model *M : meshes) {
+		BP->uploadBuffer(vertexBuffer, M->vertices.data(), M->vertices.size(),
+						 M->geometryVertexOffset * VD->Bindings[0].stride);
+		BP->uploadBuffer(indexBuffer, M->indices.data(), M->indices.size() * sizeof(uint32_t),
+						 M->geometryFirstIndex * sizeof(uint32_t));
+	}
+	created = true;
+	
+	if(BP->printStats) {
+		std::cout << "[ STATS ]: Geometry buffer: " << meshes.size() << " meshes, "
+				  << vertexBytes / 1024 << " KB of vertices, " << indexCount << " indices" << std::endl;
+	}
+}
+
+void GeometryBuffer::bind(VkCommandBuffer commandBuffer) {
+	VkBuffer vertexBuffers[] = {vertexBuffer};
+	VkDeviceSize offsets[] = {0};
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+void GeometryBuffer::cleanup() {
+	if(created) {
+		vkDestroyBuffer(BP->device, indexBuffer, nullptr);
+		BP->memoryAllocator.free(indexBufferMemory);
+		vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
+		BP->memoryAllocator.free(vertexBufferMemory);
+	}
+	meshes.clear();
+	created = false;
+}
+
+// The commands use the same range in the segment of every swapchain image
+// (reserve it again when the ring is recreated)
+void IndirectCommands::init(BaseProject *bp, uint32_t draws) {
+	BP = bp;
+	maxDraws = draws;
+	offset = BP->uniformRing.reserve(maxDraws * sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void IndirectCommands::map(int currentImage, const VkDrawIndexedIndirectCommand *commands, uint32_t count) {
+	BP->uniformRing.write(currentImage, offset, commands,
+						  std::min(count, maxDraws) * sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void IndirectCommands::draw(VkCommandBuffer commandBuffer, int currentImage, uint32_t first, uint32_t count) {
+	if(count == 0) {
+		return;
+	}
+	VkDeviceSize commandOffset = BP->uniformRing.descriptorOffset(currentImage, offset) +
+								 first * sizeof(VkDrawIndexedIndirectCommand);
+	if(BP->multiDrawIndirect) {
+		vkCmdDrawIndexedIndirect(commandBuffer, BP->uniformRing.buffer, commandOffset,
+								 count, sizeof(VkDrawIndexedIndirectCommand));
+		return;
+	}
+	// Without multiDrawIndirect the draw count must be 1: one call per command
+	for(uint32_t i = 0; i < count; i++) {
+		vkCmdDrawIndexedIndirect(commandBuffer, BP->uniformRing.buffer,
+								 commandOffset + i * sizeof(VkDrawIndexedIndirectCommand),
+								 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
+
+bool MappedFile::open(const std::string &file) {
+	close();
+#ifndef _WIN32
+	int fd = ::open(file.c_str(), O_RDONLY);
+	if(fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(mapping == MAP_FAILED) {
+		return false;
+	}
+	data = static_cast<const unsigned char *>(mapping);
+	size = st.st_size;
+#else
+	std::ifstream in(file, std::ios::ate | std::ios::binary);
+	if(!in.is_open()) {
+		return false;
+	}
+	buffer.resize((size_t)in.tellg());
+	in.seekg(0);
+	in.read((char *)buffer.data(), buffer.size());
+	data = buffer.data();
+	size = buffer.size();
+#endif
+	return true;
+}
+
+void MappedFile::close() {
+#ifndef _WIN32
+	if(data != nullptr) {
+		munmap((void *)data, size);
+	}
+#endif
+	buffer.clear();
+	data = nullptr;
+	size = 0;
+}
+
+// FNV-1a of the stride and of the attributes of the vertex descriptor
+uint32_t Model::vertexLayoutHash() {
+	uint32_t hash = 2166136261u;
+	auto mix = [&hash](uint32_t v) {
+		for(int b = 0; b < 4; b++) {
+			hash = (hash ^ ((v >> (8 * b)) & 0xff)) * 16777619u;
+		}
+	};
+	mix(VD->Bindings[0].stride);
+	for(const VertexDescriptorElement &E : VD->Layout) {
+		mix(E.location);
+		mix(E.format);
+		mix(E.offset);
+		mix(E.usage);
+	}
+	return hash;
+}
 
-	vkMapMemory(BP->device, uniformBuffersMemory[slot][currentImage], 0,
-						size, 0, &data);
-	memcpy(data, src, size);
-	vkUnmapMemory(BP->device, uniformBuffersMemory[slot][currentImage]);	
+// Returns false if the bake is missing or stale: the caller falls back to the source file
+// (an empty sourceFile, or a source that no longer exists, skips the source check)
+bool Model::loadModelBaked(std::string file, const std::string &sourceFile) {
+	MappedFile mapped;
+	if(!mapped.open(file) || mapped.size < sizeof(BakedMeshHeader)) {
+		return false;
+	}
+	BakedMeshHeader header;
+	memcpy(&header, mapped.data, sizeof(header));
+	if(memcmp(header.magic, "MBAK", 4) != 0 || header.version != BAKED_MESH_VERSION ||
+	   header.stride != VD->Bindings[0].stride || header.layoutHash != vertexLayoutHash() ||
+	   mapped.size != sizeof(header) + header.vertexBytes + header.indexCount * sizeof(uint32_t)) {
+		return false;
+	}
+	if(!sourceFile.empty()) {
+		std::error_code ec;
+		uintmax_t sourceSize = std::filesystem::file_size(sourceFile, ec);
+		if(!ec) {
+			int64_t sourceTime = std::filesystem::last_write_time(sourceFile, ec).time_since_epoch().count();
+			if(ec || sourceSize != header.sourceSize || sourceTime != header.sourceTime) {
+				return false;
+			}
+		}
+	}
+	
+	// No parsing: the vertex and index data are copied as they are
+	const unsigned char *vertexData = mapped.data + sizeof(header);
+	vertices.assign(vertexData, vertexData + header.vertexBytes);
+	indices.resize(header.indexCount);
+	memcpy(indices.data(), vertexData + header.vertexBytes, header.indexCount * sizeof(uint32_t));
+	
+	localBounds.aabbMin = glm::vec3(header.bounds[0], header.bounds[1], header.bounds[2]);
+	localBounds.aabbMax = glm::vec3(header.bounds[3], header.bounds[4], header.bounds[5]);
+	localBounds.center = glm::vec3(header.bounds[6], header.bounds[7], header.bounds[8]);
+	localBounds.radius = header.bounds[9];
+	
+	// A single level is valid too: the mesh could not be simplified
+	lodOffsets.clear();
+	if(header.lodCount >= 1 && header.lodCount <= MODEL_LODS &&
+	   header.lodOffsets[header.lodCount] == header.indexCount) {
+		lodOffsets.assign(header.lodOffsets, header.lodOffsets + header.lodCount + 1);
+	}
+	return true;
+}
+
+void Model::saveModelBaked(std::string file, const std::string &sourceFile) {
+	BakedMeshHeader header{};
+	memcpy(header.magic, "MBAK", 4);
+	header.version = BAKED_MESH_VERSION;
+	header.stride = VD->Bindings[0].stride;
+	header.layoutHash = vertexLayoutHash();
+	std::error_code ec;
+	header.sourceSize = std::filesystem::file_size(sourceFile, ec);
+	header.sourceTime = std::filesystem::last_write_time(sourceFile, ec).time_since_epoch().count();
+	header.vertexBytes = vertices.size();
+	header.indexCount = indices.size();
+	const float bounds[10] = {localBounds.aabbMin.x, localBounds.aabbMin.y, localBounds.aabbMin.z,
+							  localBounds.aabbMax.x, localBounds.aabbMax.y, localBounds.aabbMax.z,
+							  localBounds.center.x, localBounds.center.y, localBounds.center.z,
+							  localBounds.radius};
+	memcpy(header.bounds, bounds, sizeof(bounds));
+	header.lodCount = lods();
+	for(uint32_t l = 0; l <= header.lodCount && !lodOffsets.empty(); l++) {
+		header.lodOffsets[l] = lodOffsets[l];
+	}
+	
+	std::ofstream out(file, std::ios::out | std::ios::binary | std::ios::trunc);
+	if(!out.is_open()) {
+		std::cout << "[ ERROR ]: Cannot write " << file << std::endl;
+		return;
+	}
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)vertices.data(), vertices.size());
+	out.write((const char *)indices.data(), indices.size() * sizeof(uint32_t));
+	if(BP->printStats) {
+		std::cout << "[ STATS ]: Baked " << file << " (" << (sizeof(header) + vertices.size() +
+				  indices.size() * sizeof(uint32_t)) / 1024 << " KB)" << std::endl;
+	}
 }
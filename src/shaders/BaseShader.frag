@@ -5,11 +5,14 @@
  * This shader is used by the majority of the objects in the scene (taxi, NPCs, city and people)
  * It considers the direct light, the taxi lights, the street lights and the pickup point light
  * Taxi lights and street lights are only considered if is night (sun below the horizon)
- * As seen in the code, some values are stored in the global uniform buffer object (gubo) and some in the local uniform buffer object (lubo)
+ * They are read from the light clusters: each fragment only loops over the lights of its cluster
+ * As seen in the code, some values are stored in the global uniform buffer object (gubo) and some in the material of the object (lubo)
+ * The material and its texture are selected with a push constant of the draw call
  * The shader accounts also for the graphics settings (low, medium, high)
  * In fact if it is setted to low, only the direct light, the pickup point light and the ambient are considered
  * If it is setted to medium, the taxi lights are also considered
  * If it is setted to high, the street lights are also considered (all the light sources)
+ * (the lights of each setting are chosen on the CPU when the clusters are filled)
  */
 
 // Data coming from the vertex shader
@@ -20,32 +23,56 @@ layout(location = 2) in vec3 fragNormal;	// Normal
 // Output of the fragment shader
 layout(location = 0) out vec4 outColor;	// Color
 
-// Sampler 2D for the texture
-layout(set = 0, binding = 1) uniform sampler2D textureSampler;
+// Textures of the scene (city, people and taxi), indexed by the material
+layout(set = 0, binding = 1) uniform sampler2D textures[3];
 
 // Global uniform buffer object
 layout(set = 1, binding = 0) uniform GlobalUniformBufferObject {
+	mat4 viewProjMat;	// View-Projection matrix (used by the vertex shader)
 	vec4 directLightPos;	// Position of the direct light
 	vec4 directLightColor;	// Color of the direct light
-	vec4 taxiLightPos[4];	// Position of the taxi lights
-	vec4 frontLightColor;	// Color of the front taxi light
-	vec4 rearLightColor;	// Color of the rear taxi light
-	vec4 frontLightDirection;	// Direction of the front taxi light (SPOT LIGHT)
-	vec4 frontLightCosines;	// Cosines of the front taxi light
-	vec4 streetLightCol;	// Color of the street lights
-	vec4 streetLightDirection;	// Direction of the street lights (SPOT LIGHT)
-	vec4 streetLightCosines;	// Cosines of the street lights
 	vec4 pickupPointPos;	// Position of the pickup point
 	vec4 pickupPointCol;	// Color of the pickup point (POINT LIGHT)
 	vec4 eyePos;	// Position of the camera
 	vec4 settingsAndNight;	// Settings and night values
 } gubo;
 
-// Local uniform buffer object
-layout(set = 0, binding = 2) uniform LocalUniformBufferObject {
-		vec4 streetLightPos[5];	// Position of the street lights
-		vec4 gammaAndMetallic;	// Gamma and metallic values
-} lubo;
+// Light clusters: grid on the XZ plane, each cluster references the lights whose range touches it
+#define CLUSTER_GRID 16	// Number of clusters along X and along Z
+#define MAX_CLUSTER_LIGHTS 256	// Maximum number of lights
+
+struct Light {
+	vec4 posRange;	// Position and range of the light
+	vec4 colorIntensity;	// Color, and distance at which the intensity is 1
+	vec4 direction;	// Direction of the light, w = 1 for SPOT LIGHTS and 0 for POINT LIGHTS
+	vec4 cosines;	// Cosines of the inner and outer angles (SPOT LIGHTS)
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer LightClusterBuffer {
+	vec4 gridOrigin;	// X and Z of the corner of the grid, size of a cluster
+	uvec4 gridSize;	// Clusters along X and Z, number of lights
+	Light lights[MAX_CLUSTER_LIGHTS];	// Active lights of the frame
+	uvec2 clusters[CLUSTER_GRID * CLUSTER_GRID];	// First index and number of lights of each cluster
+	uint lightIndices[];	// Lights of the clusters, grouped by cluster
+} lightClusters;
+
+// Materials of the scene
+struct Material {
+	vec4 gammaAndMetallic;	// Gamma and metallic values
+	uvec4 texture;	// Index of the texture (x)
+};
+
+layout(std430, set = 0, binding = 4) readonly buffer MaterialBuffer {
+	Material materials[];
+};
+
+// Material and kind of objects of the draw call (same block as the vertex shader)
+layout(push_constant) uniform PushConstants {
+	uint material;	// Index of the material
+	uint instanced;	// 1 if the object is selected by the instance ids (used by the vertex shader)
+} pc;
+
+#define lubo materials[pc.material]
 
 /* BRDF function, used to calculate the color of the fragment, parameters:
  * - v: viewer direction
@@ -68,7 +95,7 @@ void main() {
 
 	vec3 norm = normalize(fragNormal);	// Normal of the fragment
 	vec3 viewerDir = normalize(gubo.eyePos.xyz - fragPos);	// Viewer direction
-	vec3 albedo = texture(textureSampler, fragUV).rgb;	// Albedo of the fragment
+	vec3 albedo = texture(textures[lubo.texture.x], fragUV).rgb;	// Albedo of the fragment
 
 	vec3 res = vec3(0.0);	// Initialization of the resulting color
 
@@ -99,38 +126,25 @@ void main() {
 
 	// If the night flag is setted to 1 (true):
 	if(gubo.settingsAndNight.y == 1.0) {
-		// For all the taxi lights:
-		for(int i = 0; i < 4; i++) {
-			vec3 taxiLightDir = normalize(gubo.taxiLightPos[i].xyz - fragPos);	// Direction of the taxi light
-			vec3 taxiLightColor = vec3(0.0);	// Color of the taxi light initially setted to 0
-			// If the taxi light is a rear light:
-			if(i < 2) {
-				// The color for the rear lght is considered as red POINT LIGHT
-				taxiLightColor = gubo.rearLightColor.rgb * pow((1 / length(gubo.taxiLightPos[i].xyz - fragPos)), 2.0);
+		// Cluster of the fragment (fragments outside of the grid use the closest cluster on the border)
+		ivec2 cell = clamp(ivec2(floor((fragPos.xz - lightClusters.gridOrigin.xy) / lightClusters.gridOrigin.z)),
+						   ivec2(0), ivec2(lightClusters.gridSize.xy) - 1);
+		uvec2 cluster = lightClusters.clusters[cell.y * lightClusters.gridSize.x + cell.x];
+
+		// For each light of the cluster (taxi lights and street lights):
+		for(uint i = 0; i < cluster.y; i++) {
+			Light light = lightClusters.lights[lightClusters.lightIndices[cluster.x + i]];
+			float dist = length(light.posRange.xyz - fragPos);	// Distance from the light
+			vec3 lightDir = normalize(light.posRange.xyz - fragPos);	// Direction of the light
+			// Decay with the squared distance, smoothly faded to 0 at the range of the light
+			float decay = pow(light.colorIntensity.w / dist, 2.0) * pow(clamp(1.0 - pow(dist / light.posRange.w, 4.0), 0.0, 1.0), 2.0);
+			// SPOT LIGHTS are also limited to their cone
+			if(light.direction.w == 1.0) {
+				decay *= clamp((dot(lightDir, light.direction.xyz) - light.cosines.y) / (light.cosines.x - light.cosines.y), 0.0, 1.0);
 			}
-			else {
-				// Else the color for the front light is considered as yellow SPOT LIGHT 
-				taxiLightColor = gubo.frontLightColor.rgb * dot(pow((3 / length(gubo.taxiLightPos[i].xyz - fragPos)), 2.0), clamp((dot(normalize(gubo.taxiLightPos[i].xyz - fragPos), gubo.frontLightDirection.xyz) - gubo.frontLightCosines.y) / (gubo.frontLightCosines.x - gubo.frontLightCosines.y), 0.0, 1.0));
-			}
-			// Calculate the BRDF of the fragment for each taxi light
-			vec3 taxiLightBRDF = BRDF(viewerDir, norm, taxiLightDir, albedo, vec3(lubo.gammaAndMetallic.y), lubo.gammaAndMetallic.x);
-			res += taxiLightBRDF * taxiLightColor;	// Add the calculated taxi light to the resulting color
-		}
-
-		// If the graphics settings are setted to medium:
-		if(gubo.settingsAndNight.x == 1.0) {
-			outColor = vec4(res, 1.0);	// Output the resulting color (direct light + pickup point light + ambient light + taxi lights)
-			return;	// Exit the shader calculation
-		}
-
-		// For each street light:
-		for(int i = 0; i < 5; i++) {
-			vec3 streetLightDir = normalize(lubo.streetLightPos[i].xyz - fragPos);	// Direction of the street light
-			// Color of the street light (yellow SPOT LIGHT)
-			vec3 streetLightColor = gubo.streetLightCol.rgb * dot(pow((10 / length(lubo.streetLightPos[i].xyz - fragPos)), 2.0), clamp((dot(normalize(lubo.streetLightPos[i].xyz - fragPos), gubo.streetLightDirection.xyz) - gubo.streetLightCosines.y) / (gubo.streetLightCosines.x - gubo.streetLightCosines.y), 0.0, 1.0));
-			// Calculate the BRDF of the fragment for each street light
-			vec3 streetLightBRDF = BRDF(viewerDir, norm, streetLightDir, albedo, vec3(lubo.gammaAndMetallic.y), lubo.gammaAndMetallic.x);
-			res += streetLightBRDF * streetLightColor;	// Add the calculated street light to the resulting color
+			// Calculate the BRDF of the fragment for the light
+			vec3 lightBRDF = BRDF(viewerDir, norm, lightDir, albedo, vec3(lubo.gammaAndMetallic.y), lubo.gammaAndMetallic.x);
+			res += lightBRDF * light.colorIntensity.rgb * decay;	// Add the light to the resulting color
 		}
 
 	}
@@ -9,11 +9,15 @@
 
 // Uniform buffer object
 layout(set = 0, binding = 0) uniform UniformBufferObject {
-	mat4 mvpMat;	// Model-View-Projection matrix
 	mat4 mMat;	// Model matrix
 	mat4 nMat;	// Normal matrix
 } ubo;
 
+// Global uniform buffer object (only the view-projection matrix is needed here)
+layout(set = 1, binding = 0) uniform GlobalUniformBufferObject {
+	mat4 viewProjMat;	// View-Projection matrix
+} gubo;
+
 // Vertex attributes
 layout(location = 0) in vec3 inPosition;	// Vertex position
 layout(location = 1) in vec2 inUV;	// Vertex UV coordinates
@@ -26,8 +30,9 @@ layout(location = 2) out vec3 outNormal;	// Vertex normal
 
 
 void main() {
-	gl_Position = ubo.mvpMat * vec4(inPosition, 1.0);	// Transform the vertex position to clip space
-	outPoistion = (ubo.mMat * vec4(inPosition, 1.0)).xyz;	// Transform the vertex position to world space
+	vec4 worldPos = ubo.mMat * vec4(inPosition, 1.0);	// Transform the vertex position to world space
+	gl_Position = gubo.viewProjMat * worldPos;	// Transform the vertex position to clip space
+	outPoistion = worldPos.xyz;	// Pass the world space position to the fragment shader
 	outUV = inUV;	// Pass the UV coordinates to the fragment shader
 	outNormal = (ubo.nMat * vec4(inNormal, 0.0)).xyz;	// Transform the vertex normal to world space
 }
\ No newline at end of file
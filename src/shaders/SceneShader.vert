@@ -0,0 +1,69 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/* --- SCENE VERTEX SHADER ---
+ * Same as the base vertex shader, but used by all the objects of the scene (taxi, NPCs, city and people).
+ * The matrices of every object are read from storage buffers of the scene set:
+ * the city and the people are drawn with instancing and use the instance ids of the draw call,
+ * the taxi and the NPCs select their object with the firstInstance of the draw call.
+ */
+
+// Model and normal matrices of one object
+struct ObjectData {
+	mat4 mMat;	// Model matrix
+	mat4 nMat;	// Normal matrix
+};
+
+// Objects that never move (city, then people)
+layout(std430, set = 0, binding = 0) readonly buffer StaticObjectBuffer {
+	ObjectData staticObjects[];
+};
+
+// Visible instance ids grouped by mesh (firstInstance of each draw call points to its group)
+layout(std430, set = 0, binding = 2) readonly buffer InstanceIdBuffer {
+	uint ids[];
+} instanceIds;
+
+// Objects that move (taxi, then NPCs), rewritten every frame
+layout(std430, set = 0, binding = 3) readonly buffer DynamicObjectBuffer {
+	ObjectData dynamicObjects[];
+};
+
+// Global uniform buffer object (only the view-projection matrix is needed here)
+layout(set = 1, binding = 0) uniform GlobalUniformBufferObject {
+	mat4 viewProjMat;	// View-Projection matrix
+} gubo;
+
+// Material and kind of objects of the draw call
+layout(push_constant) uniform PushConstants {
+	uint material;	// Index of the material (used by the fragment shader)
+	uint instanced;	// 1 if the object is selected by the instance ids
+} pc;
+
+// Vertex attributes
+layout(location = 0) in vec3 inPosition;	// Vertex position
+layout(location = 1) in vec2 inUV;	// Vertex UV coordinates
+layout(location = 2) in vec3 inNormal;	// Vertex normal
+
+// Fragment shader outputs (passed to the fragment shader)
+layout(location = 0) out vec3 outPoistion;	// Vertex position
+layout(location = 1) out vec2 outUV;	// Vertex UV coordinates
+layout(location = 2) out vec3 outNormal;	// Vertex normal
+
+
+void main() {
+	mat4 mMat, nMat;
+	if(pc.instanced != 0) {
+		uint object = instanceIds.ids[gl_InstanceIndex];	// gl_InstanceIndex already includes firstInstance
+		mMat = staticObjects[object].mMat;
+		nMat = staticObjects[object].nMat;
+	} else {
+		mMat = dynamicObjects[gl_InstanceIndex].mMat;	// firstInstance is the index of the dynamic object
+		nMat = dynamicObjects[gl_InstanceIndex].nMat;
+	}
+	vec4 worldPos = mMat * vec4(inPosition, 1.0);	// Transform the vertex position to world space
+	gl_Position = gubo.viewProjMat * worldPos;	// Transform the vertex position to clip space
+	outPoistion = worldPos.xyz;	// Pass the world space position to the fragment shader
+	outUV = inUV;	// Pass the UV coordinates to the fragment shader
+	outNormal = (nMat * vec4(inNormal, 0.0)).xyz;	// Transform the vertex normal to world space
+}